@@ -0,0 +1,154 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_vma.h"
+#include "acpi.h"
+
+/* Where the BIOS data area keeps the segment of the extended BIOS data area */
+#define BDA_EBDA_SEGMENT (0x40E)
+
+/* The RSDP is on a 16 byte boundary, in the first 1KB of the EBDA or in the BIOS ROM */
+#define RSDP_ALIGN (16)
+#define EBDA_SEARCH_SIZE (0x400)
+#define BIOS_ROM_START (0xE0000)
+#define BIOS_ROM_END (0x100000)
+
+/* The RSDT is kept mapped, tables that are found are left mapped for whoever asked */
+static page_directory_t *acpi_directory;
+static acpi_header_t *rsdt = 0;
+
+/*
+ * Internal Function Declarations
+ */
+static acpi_rsdp_t *find_rsdp(uintptr_t start, uintptr_t end);
+static acpi_header_t *map_table(phys_addr_t addr);
+static void unmap_table(acpi_header_t *table);
+static bool checksum_ok(const void *data, uintptr_t length);
+static bool signature_is(const char *signature, const char *expected, uintptr_t length);
+
+
+bool acpi_init(page_directory_t *page_directory)
+{
+    acpi_directory = page_directory;
+
+    /* The BIOS area is below DIRECT_MAP_SIZE, so the direct map reaches it */
+    uintptr_t ebda = (uintptr_t)*(uint16_t*)PHY_TO_DIRECT(BDA_EBDA_SEGMENT) << 4;
+    acpi_rsdp_t *rsdp = 0;
+    if (ebda != 0)
+    {
+        rsdp = find_rsdp(ebda, ebda + EBDA_SEARCH_SIZE);
+    }
+    if (!rsdp)
+    {
+        rsdp = find_rsdp(BIOS_ROM_START, BIOS_ROM_END);
+    }
+    if (!rsdp)
+    {
+        return false;
+    }
+
+    /* Every revision has an RSDT, and its 32 bit pointers are all this kernel can use anyway */
+    rsdt = map_table(rsdp->rsdt_address);
+    if (rsdt && !signature_is(rsdt->signature, "RSDT", 4))
+    {
+        unmap_table(rsdt);
+        rsdt = 0;
+    }
+    return rsdt != 0;
+}
+
+void *acpi_find_table(const char *signature)
+{
+    if (!rsdt)
+    {
+        return 0;
+    }
+
+    uint32_t *entries = (uint32_t*)(rsdt + 1);
+    uintptr_t n_entries = (rsdt->length - sizeof(acpi_header_t)) / sizeof(uint32_t);
+
+    for (uintptr_t ii = 0; ii < n_entries; ii++)
+    {
+        acpi_header_t *table = map_table(entries[ii]);
+        if (!table)
+        {
+            continue;
+        }
+        if (signature_is(table->signature, signature, 4))
+        {
+            return table;
+        }
+        unmap_table(table);
+    }
+    return 0;
+}
+
+/* Looks for a valid RSDP on each 16 byte boundary from start to end */
+static acpi_rsdp_t *find_rsdp(uintptr_t start, uintptr_t end)
+{
+    for (uintptr_t addr = start; addr + sizeof(acpi_rsdp_t) <= end; addr += RSDP_ALIGN)
+    {
+        acpi_rsdp_t *rsdp = (acpi_rsdp_t*)PHY_TO_DIRECT(addr);
+        if (signature_is(rsdp->signature, "RSD PTR ", 8) && checksum_ok(rsdp, sizeof(acpi_rsdp_t)))
+        {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+/* Maps a whole table given its physical address, returns null if it can't be mapped or its checksum is wrong */
+static acpi_header_t *map_table(phys_addr_t addr)
+{
+    /* Map just the header to find out how long it is */
+    acpi_header_t *header = vma_map_physical(acpi_directory, addr, sizeof(acpi_header_t), 0);
+    if (!header)
+    {
+        return 0;
+    }
+    uint32_t length = header->length;
+    unmap_table(header);
+
+    if (length < sizeof(acpi_header_t))
+    {
+        return 0;
+    }
+
+    acpi_header_t *table = vma_map_physical(acpi_directory, addr, length, 0);
+    if (table && !checksum_ok(table, length))
+    {
+        unmap_table(table);
+        return 0;
+    }
+    return table;
+}
+
+static void unmap_table(acpi_header_t *table)
+{
+    vma_release(acpi_directory, (void*)((uintptr_t)table & ~(uintptr_t)(PAGE_SIZE - 1)));
+}
+
+/* ACPI structures are valid if all of their bytes add up to zero */
+static bool checksum_ok(const void *data, uintptr_t length)
+{
+    const uint8_t *bytes = (const uint8_t*)data;
+    uint8_t sum = 0;
+    for (uintptr_t ii = 0; ii < length; ii++)
+    {
+        sum += bytes[ii];
+    }
+    return sum == 0;
+}
+
+static bool signature_is(const char *signature, const char *expected, uintptr_t length)
+{
+    for (uintptr_t ii = 0; ii < length; ii++)
+    {
+        if (signature[ii] != expected[ii])
+        {
+            return false;
+        }
+    }
+    return true;
+}
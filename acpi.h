@@ -0,0 +1,73 @@
+#ifndef _ACPI_H_
+#define _ACPI_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memmgr_virtual.h"
+
+/* Root system description pointer, found in the BIOS area */
+struct acpi_rsdp
+{
+    char signature[8];                  /* "RSD PTR " */
+    uint8_t checksum;                   /* Makes the first 20 bytes add up to zero */
+    char oem_id[6];
+    uint8_t revision;                   /* 0 for ACPI 1.0, 2 for later versions */
+    uint32_t rsdt_address;              /* Physical address of the RSDT */
+} __attribute__((packed));
+typedef struct acpi_rsdp acpi_rsdp_t;
+
+/* Header every system description table starts with */
+struct acpi_header
+{
+    char signature[4];
+    uint32_t length;                    /* Of the whole table, including the header */
+    uint8_t revision;
+    uint8_t checksum;                   /* Makes the whole table add up to zero */
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+typedef struct acpi_header acpi_header_t;
+
+/* The multiple APIC description table, signature "APIC" */
+struct acpi_madt
+{
+    acpi_header_t header;
+    uint32_t lapic_address;             /* Physical address of every cpu's local APIC */
+    uint32_t flags;
+    uint8_t entries[];                  /* Variable length entries up to header.length */
+} __attribute__((packed));
+typedef struct acpi_madt acpi_madt_t;
+
+/* Every MADT entry starts with its type and length */
+struct acpi_madt_entry
+{
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+typedef struct acpi_madt_entry acpi_madt_entry_t;
+
+#define ACPI_MADT_LAPIC (0)             /* A processor and its local APIC */
+
+struct acpi_madt_lapic
+{
+    acpi_madt_entry_t entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+typedef struct acpi_madt_lapic acpi_madt_lapic_t;
+
+#define ACPI_MADT_LAPIC_ENABLED (0x1)   /* The processor can be started */
+
+/*
+ * Finds the RSDP and maps the RSDT into page_directory. Returns false if
+ * there are no ACPI tables. kmalloc and the memory areas must be ready.
+ */
+bool acpi_init(page_directory_t *page_directory);
+
+/* Maps the table with the four character signature, or returns null if there isn't a valid one */
+void *acpi_find_table(const char *signature);
+#endif
@@ -0,0 +1,101 @@
+#!/bin/bash
+
+# Boots the kernel headless in QEMU over and over, and reports the
+# median and 99th percentile boot times for each memory size.
+#
+# usage: bench_boot.sh [-n runs] [-m "sizes in MB"] [-c cpus]
+#
+# QEMU's multiboot loader boots kernel.bin directly, with the "exit"
+# option, so the kernel turns QEMU off through the isa-debug-exit
+# device once boot is done. Two times are reported: the wall clock
+# time QEMU ran for, and the total of the boot phase table the kernel
+# prints to COM1, from the bootstrap to the end of kmain.
+
+# ---- begin config params ----
+
+runs=10
+memory_sizes="128 512 2048"
+cpus=2
+timeout_s=60
+kernel_binary="kernel.bin"
+
+# ----  end config params  ----
+
+
+function fail() { echo "$1"; exit 1; }
+function prereq() {
+	local c x
+	if [ "$1" = "f" ]; then c=stat;x=file; else c=which;x=program; fi
+	if [ -z "$3" ]; then
+		$c "$2" >/dev/null || fail "$x $2 not found"
+	else
+		$c "$2" >/dev/null || fail "$x $2 (from package $3) not found"
+	fi
+}
+
+# prints the value at percentile $1 of the numbers on stdin, nearest rank
+function percentile() {
+	sort -n | awk -v p="$1" '{ v[NR] = $1 } END { r = int((p * NR + 99) / 100); if (r < 1) r = 1; print v[r] }'
+}
+
+while getopts "n:m:c:" opt; do
+	case $opt in
+		n) runs="$OPTARG" ;;
+		m) memory_sizes="$OPTARG" ;;
+		c) cpus="$OPTARG" ;;
+		*) fail "usage: $0 [-n runs] [-m \"sizes in MB\"] [-c cpus]" ;;
+	esac
+done
+
+# check prerequisites
+prereq x qemu-system-i386 qemu-system-x86
+prereq f "$kernel_binary"
+
+# KVM when this user can have it, otherwise QEMU's own translator
+if [ -w /dev/kvm ]; then
+	accel="kvm"
+else
+	accel="tcg"
+fi
+
+work=$(mktemp -d) || fail "could not create a temporary directory"
+trap 'rm -rf "$work"' EXIT
+
+echo "$runs runs per size, $cpus cpus, accel=$accel"
+printf "%8s %12s %12s %12s %12s\n" "memory" "wall p50 ms" "wall p99 ms" "boot p50 us" "boot p99 us"
+
+for mem in $memory_sizes; do
+	: > "$work/wall"
+	: > "$work/boot"
+
+	for ((run = 0; run < runs; run++)); do
+		serial="$work/serial.log"
+		start=$(date +%s%N)
+		timeout "$timeout_s" qemu-system-i386 -accel "$accel" -m "$mem" -smp "$cpus" \
+			-display none -no-reboot -serial "file:$serial" \
+			-device isa-debug-exit,iobase=0xf4,iosize=0x01 \
+			-kernel "$kernel_binary" -append exit
+		status=$?
+		end=$(date +%s%N)
+
+		# isa-debug-exit exits with (code << 1) | 1, and the kernel writes 0 once it has booted
+		if [ $status -ne 1 ]; then
+			cat "$serial"
+			fail "boot with -m $mem failed, QEMU exited with $status"
+		fi
+
+		echo $(( (end - start) / 1000000 )) >> "$work/wall"
+		awk '/\] total / { print $NF }' "$serial" >> "$work/boot"
+	done
+
+	# without a TSC the kernel doesn't print a boot phase table
+	if [ ! -s "$work/boot" ]; then
+		boot_p50="-"
+		boot_p99="-"
+	else
+		boot_p50=$(percentile 50 < "$work/boot")
+		boot_p99=$(percentile 99 < "$work/boot")
+	fi
+	printf "%8s %12s %12s %12s %12s\n" "${mem}M" \
+		"$(percentile 50 < "$work/wall")" "$(percentile 99 < "$work/wall")" "$boot_p50" "$boot_p99"
+done
@@ -0,0 +1,395 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "util.h"
+#include "kernel.h"
+#include "multiboot.h"
+#include "multiboot2.h"
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "bootinfo.h"
+
+/* Most separate pieces of memory that can be mapped, and reserved */
+#define BOOTINFO_MAX_REGIONS (32)
+
+/* Strings longer than this are taken to be garbage */
+#define BOOTINFO_STRING_MAX (PAGE_SIZE)
+
+struct region
+{
+    phys_addr_t start;
+    phys_addr_t end;                            /* One past the last byte */
+    uintptr_t virt;                             /* Where start is in the window, for mapped regions */
+};
+typedef struct region region_t;
+
+/* Page table at BOOTINFO_BASE, and how many of its pages are used, from the start */
+static page_table_t *window_table = 0;
+static uintptr_t window_used = 0;
+
+/* Whole pages mapped into the window */
+static region_t mapped[BOOTINFO_MAX_REGIONS];
+static uint32_t n_mapped = 0;
+
+/* Exactly what the bootloader left, modules included */
+static region_t reserved[BOOTINFO_MAX_REGIONS];
+static uint32_t n_reserved = 0;
+
+/* The memory map, with entries mmap_entry_size apart, or 0 if each starts with its size (multiboot) */
+static const uint8_t *mmap_start = 0;
+static uintptr_t mmap_length = 0;
+static uintptr_t mmap_entry_size = 0;
+
+static const char *cmdline = 0;
+
+static bootinfo_module_t modules[BOOTINFO_MAX_MODULES];
+static uint32_t n_modules = 0;
+
+static const void *elf_sections = 0;
+static uint32_t elf_num = 0;
+static uint32_t elf_entsize = 0;
+static uint32_t elf_shndx = 0;
+
+/*
+ * Internal Function Declarations
+ */
+static void parse_multiboot(phys_addr_t addr);
+static void parse_multiboot2(phys_addr_t addr);
+static void add_module(phys_addr_t start, phys_addr_t end, const char *module_cmdline);
+static void add_reserved(phys_addr_t addr, uintptr_t size);
+static const void *map(phys_addr_t addr, uintptr_t size);
+static const void *map_reserved(phys_addr_t addr, uintptr_t size);
+static const char *map_string(phys_addr_t addr);
+
+
+void bootinfo_init(page_directory_t *page_directory, page_table_t *window)
+{
+    window_table = window;
+    memmgr_virtual_add_table(page_directory, (void*)BOOTINFO_BASE, window);
+
+    /* The bootstrap has already made sure it is one or the other */
+    if (_b_magic == MULTIBOOT_BOOTLOADER_MAGIC)
+    {
+        parse_multiboot(_b_mbd);
+    }
+    else
+    {
+        parse_multiboot2(_b_mbd);
+    }
+
+    /* The window's pages weren't present before, so the TLB has nothing to forget */
+}
+
+bool bootinfo_has_mmap(void)
+{
+    return mmap_start != 0;
+}
+
+void bootinfo_walk_mmap(bootinfo_mmap_cb *cb)
+{
+    const uint8_t *entry = mmap_start;
+    const uint8_t *end = mmap_start + mmap_length;
+
+    while (entry < end)
+    {
+        if (mmap_entry_size == 0)
+        {
+            cb((const bootinfo_mmap_t *)(entry + sizeof(uint32_t)));
+            entry += *(const uint32_t *)entry + sizeof(uint32_t);   /* The size doesn't count itself */
+        }
+        else
+        {
+            cb((const bootinfo_mmap_t *)entry);
+            entry += mmap_entry_size;
+        }
+    }
+}
+
+const char *bootinfo_cmdline(void)
+{
+    return cmdline;
+}
+
+bool bootinfo_has_option(const char *option)
+{
+    const char *word = cmdline;
+    if (!word)
+    {
+        return false;
+    }
+
+    while (*word)
+    {
+        const char *match = option;
+        while (*match && *match == *word)
+        {
+            match++;
+            word++;
+        }
+        if (*match == 0 && (*word == ' ' || *word == 0))
+        {
+            return true;
+        }
+
+        while (*word && *word != ' ')                           /* Skip the rest of the word */
+        {
+            word++;
+        }
+        while (*word == ' ')
+        {
+            word++;
+        }
+    }
+    return false;
+}
+
+uint32_t bootinfo_n_modules(void)
+{
+    return n_modules;
+}
+
+const bootinfo_module_t *bootinfo_module(uint32_t n)
+{
+    return (n < n_modules) ? &modules[n] : 0;
+}
+
+const void *bootinfo_elf_sections(uint32_t *num, uint32_t *entsize, uint32_t *shndx)
+{
+    *num = elf_num;
+    *entsize = elf_entsize;
+    *shndx = elf_shndx;
+    return elf_sections;
+}
+
+bool bootinfo_frame_used(phys_addr_t frame_addr)
+{
+    for (uint32_t ii = 0; ii < n_reserved; ii++)
+    {
+        if (reserved[ii].start < frame_addr + PAGE_SIZE && reserved[ii].end > frame_addr)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void bootinfo_reserve(memmgr_physical_t *memmgr_phy)
+{
+    for (uint32_t ii = 0; ii < n_reserved; ii++)
+    {
+        phys_addr_t first = reserved[ii].start / PAGE_SIZE;
+        phys_addr_t last = idivc(reserved[ii].end, PAGE_SIZE);  /* Any frame it touches */
+        if (first >= memmgr_phy->n_frames)
+        {
+            continue;                                           /* Above the memory map, nothing to do */
+        }
+        if (last > memmgr_phy->n_frames)
+        {
+            last = memmgr_phy->n_frames;
+        }
+        memmgr_physical_set_range(memmgr_phy, first * PAGE_SIZE, last - first);
+    }
+}
+
+/* Finds everything in a multiboot info structure */
+static void parse_multiboot(phys_addr_t addr)
+{
+    const multiboot_info_t *info = map_reserved(addr, sizeof(multiboot_info_t));
+    if (!info)
+    {
+        panic("Multiboot info can't be mapped");
+    }
+
+    if (info->flags & MULTIBOOT_INFO_MEM_MAP)
+    {
+        mmap_start = map_reserved(info->mmap_addr, info->mmap_length);
+        mmap_length = info->mmap_length;
+        mmap_entry_size = 0;                                    /* Each entry starts with its size */
+    }
+
+    if (info->flags & MULTIBOOT_INFO_CMDLINE)
+    {
+        cmdline = map_string(info->cmdline);
+    }
+
+    if (info->flags & MULTIBOOT_INFO_MODS)
+    {
+        const multiboot_module_t *mods = map_reserved(info->mods_addr, info->mods_count * sizeof(multiboot_module_t));
+        for (uint32_t ii = 0; mods && ii < info->mods_count; ii++)
+        {
+            add_module(mods[ii].mod_start, mods[ii].mod_end, mods[ii].cmdline ? map_string(mods[ii].cmdline) : 0);
+        }
+    }
+
+    if (info->flags & MULTIBOOT_INFO_ELF_SHDR)
+    {
+        const multiboot_elf_section_header_table_t *elf = &info->u.elf_sec;
+        elf_sections = map_reserved(elf->addr, elf->num * elf->size);
+        elf_num = elf->num;
+        elf_entsize = elf->size;
+        elf_shndx = elf->shndx;
+    }
+}
+
+/* Finds everything in the tags of a multiboot2 info structure */
+static void parse_multiboot2(phys_addr_t addr)
+{
+    const multiboot2_info_t *header = map(addr, sizeof(multiboot2_info_t));
+    const uint8_t *info = header ? map_reserved(addr, header->total_size) : 0;
+    if (!info)
+    {
+        panic("Multiboot2 info can't be mapped");
+    }
+
+    const uint8_t *end = info + header->total_size;
+    const uint8_t *tag_addr = info + sizeof(multiboot2_info_t);
+    while (tag_addr + sizeof(multiboot2_tag_t) <= end)
+    {
+        const multiboot2_tag_t *tag = (const multiboot2_tag_t *)tag_addr;
+        if (tag->type == MULTIBOOT2_TAG_END || tag->size < sizeof(multiboot2_tag_t))
+        {
+            break;
+        }
+
+        switch (tag->type)
+        {
+        case MULTIBOOT2_TAG_CMDLINE:
+            cmdline = ((const multiboot2_tag_string_t *)tag)->string;
+            break;
+        case MULTIBOOT2_TAG_MODULE:
+        {
+            const multiboot2_tag_module_t *module = (const multiboot2_tag_module_t *)tag;
+            add_module(module->mod_start, module->mod_end, module->cmdline);
+            break;
+        }
+        case MULTIBOOT2_TAG_MMAP:
+        {
+            const multiboot2_tag_mmap_t *mmap = (const multiboot2_tag_mmap_t *)tag;
+            if (mmap->entry_size >= sizeof(bootinfo_mmap_t))    /* Newer entries can only be longer */
+            {
+                mmap_start = mmap->entries;
+                mmap_length = mmap->size - offsetof(multiboot2_tag_mmap_t, entries);
+                mmap_entry_size = mmap->entry_size;
+            }
+            break;
+        }
+        case MULTIBOOT2_TAG_ELF_SECTIONS:
+        {
+            const multiboot2_tag_elf_sections_t *elf = (const multiboot2_tag_elf_sections_t *)tag;
+            elf_sections = elf->sections;
+            elf_num = elf->num;
+            elf_entsize = elf->entsize;
+            elf_shndx = elf->shndx;
+            break;
+        }
+        default:
+            break;
+        }
+
+        tag_addr += (tag->size + MULTIBOOT2_TAG_ALIGN - 1) & ~(MULTIBOOT2_TAG_ALIGN - 1);
+    }
+}
+
+/* Remembers a module, and reserves its memory, but doesn't map it */
+static void add_module(phys_addr_t start, phys_addr_t end, const char *module_cmdline)
+{
+    if (end > start)
+    {
+        add_reserved(start, end - start);
+    }
+
+    if (n_modules < BOOTINFO_MAX_MODULES)
+    {
+        modules[n_modules].start = start;
+        modules[n_modules].end = end;
+        modules[n_modules].cmdline = module_cmdline;
+        n_modules++;
+    }
+}
+
+static void add_reserved(phys_addr_t addr, uintptr_t size)
+{
+    if (n_reserved == BOOTINFO_MAX_REGIONS)
+    {
+        panic("Too many bootloader regions to reserve");        /* Better than handing them out */
+    }
+
+    reserved[n_reserved].start = addr;
+    reserved[n_reserved].end = addr + size;
+    reserved[n_reserved].virt = 0;
+    n_reserved++;
+}
+
+/* Returns where the size bytes at addr are in the window, mapping their pages if they aren't yet, or null if it is full */
+static const void *map(phys_addr_t addr, uintptr_t size)
+{
+    phys_addr_t first = addr & ~(phys_addr_t)(PAGE_SIZE - 1);
+    phys_addr_t end = (addr + size + PAGE_SIZE - 1) & ~(phys_addr_t)(PAGE_SIZE - 1);
+
+    for (uint32_t ii = 0; ii < n_mapped; ii++)
+    {
+        if (first >= mapped[ii].start && end <= mapped[ii].end)
+        {
+            return (const void *)(mapped[ii].virt + (uintptr_t)(addr - mapped[ii].start));
+        }
+    }
+
+    uintptr_t n_pages = (end - first) / PAGE_SIZE;
+    if (n_mapped == BOOTINFO_MAX_REGIONS || n_pages > PAGES_PER_TABLE - window_used)
+    {
+        return 0;
+    }
+
+    region_t *region = &mapped[n_mapped++];
+    region->start = first;
+    region->end = end;
+    region->virt = BOOTINFO_BASE + window_used * PAGE_SIZE;
+
+    for (uintptr_t ii = 0; ii < n_pages; ii++)
+    {
+        memmgr_virtual_map_page(&window_table->pages[window_used++], first + ii * PAGE_SIZE, true, false);
+    }
+
+    return (const void *)(region->virt + (uintptr_t)(addr - first));
+}
+
+/* Maps the size bytes at addr, and reserves them */
+static const void *map_reserved(phys_addr_t addr, uintptr_t size)
+{
+    const void *result = map(addr, size);
+    if (result)
+    {
+        add_reserved(addr, size);
+    }
+    return result;
+}
+
+/* Maps the string at addr, and reserves it, or returns null if it isn't terminated within BOOTINFO_STRING_MAX bytes */
+static const char *map_string(phys_addr_t addr)
+{
+    uintptr_t size = PAGE_SIZE - addr % PAGE_SIZE;              /* The rest of its first page */
+
+    for (;;)
+    {
+        const char *string = map(addr, size);
+        if (!string)
+        {
+            return 0;
+        }
+
+        for (uintptr_t ii = 0; ii < size; ii++)
+        {
+            if (string[ii] == 0)
+            {
+                add_reserved(addr, ii + 1);
+                return string;
+            }
+        }
+
+        if (size >= BOOTINFO_STRING_MAX)
+        {
+            return 0;
+        }
+        size += PAGE_SIZE;                                      /* Map it again with the next page */
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef _BOOTINFO_H_
+#define _BOOTINFO_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+
+/* Types of memory map entries, the same for multiboot and multiboot2 */
+#define BOOTINFO_MEMORY_AVAILABLE (1)
+#define BOOTINFO_MEMORY_RESERVED (2)
+
+/* Most modules bootinfo keeps track of */
+#define BOOTINFO_MAX_MODULES (16)
+
+/*
+ * A memory map entry, pointing into the bootloader's map. Multiboot2's
+ * entries are laid out like this, and multiboot's are after their size.
+ */
+struct bootinfo_mmap
+{
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+} __attribute__((packed));
+typedef struct bootinfo_mmap bootinfo_mmap_t;
+
+/* A module the bootloader loaded, which is reserved but not mapped */
+struct bootinfo_module
+{
+    phys_addr_t start;
+    phys_addr_t end;                            /* One past the last byte */
+    const char *cmdline;                        /* In the window, or null */
+};
+typedef struct bootinfo_module bootinfo_module_t;
+
+typedef void (bootinfo_mmap_cb)(const bootinfo_mmap_t *mmap);
+
+/*
+ * Finds what the multiboot or multiboot2 loader left in memory, from the
+ * magic number and address the bootstrap kept, and maps it read only
+ * through window, which is put in the directory at BOOTINFO_BASE. Nothing
+ * is copied, it is all read where the bootloader put it. Has to be called
+ * before unmap_bootstrap, and before anything takes frames.
+ */
+void bootinfo_init(page_directory_t *page_directory, page_table_t *window);
+
+/* Returns true if the bootloader gave a memory map */
+bool bootinfo_has_mmap(void);
+
+/* Calls cb for every entry in the memory map */
+void bootinfo_walk_mmap(bootinfo_mmap_cb *cb);
+
+/* Returns the kernel command line, or null */
+const char *bootinfo_cmdline(void);
+
+/* Whether option is one of the space separated words on the kernel command line */
+bool bootinfo_has_option(const char *option);
+
+/* Returns the number of modules, and the nth of them */
+uint32_t bootinfo_n_modules(void);
+const bootinfo_module_t *bootinfo_module(uint32_t n);
+
+/*
+ * Returns the kernel's ELF section headers, and sets num, entsize and shndx
+ * from the bootloader. Null if it didn't pass them.
+ */
+const void *bootinfo_elf_sections(uint32_t *num, uint32_t *entsize, uint32_t *shndx);
+
+/* Returns true if the frame at frame_addr holds anything the bootloader left, for dumb_set_frame_used */
+bool bootinfo_frame_used(phys_addr_t frame_addr);
+
+/* Marks the frames of everything the bootloader left, modules included, as in use */
+void bootinfo_reserve(memmgr_physical_t *memmgr_phy);
+#endif
@@ -1,8 +1,14 @@
 global bootstrap
 global _b_page_directory
+%ifdef PAE
+global _b_pdpt
+%endif
 global _b_PAGE_TABLES
-global _b_multiboot_info
+global _b_magic
+global _b_mbd
 global _b_print
+global _b_tsc_entry
+global _b_tsc_paging
 
 extern kinit
 extern _start
@@ -16,6 +22,22 @@ section .text
 
 STACKSIZE equ 0x1000                        ; Amount of memory to reserve for the stack
 
+%ifdef PAE
+ENTRY_SIZE equ 8                            ; PAE paging structures have 64 bit entries
+%else
+ENTRY_SIZE equ 4
+%endif
+
+%macro TIMESTAMP 1
+    ; Store the TSC in the quadword %1, if the cpu has one
+    cmp     DWORD [_b_has_tsc], 0
+    je      %%NoTsc
+    rdtsc
+    mov     [%1], eax
+    mov     [%1 + 4], edx
+    %%NoTsc:
+%endmacro
+
 ;
 ;   Bootstrap
 ;       The main entry point for the OS.  Sets up GDT, and calls kinit
@@ -27,24 +49,22 @@ bootstrap:
     mov     [_b_magic], eax                 ; Store the multiboot magic number
     mov     [_b_mbd], ebx                   ; Store pointer to multiboot info structure
 
+    mov     eax, 1                          ; CPUID leaf 1 has the feature flags
+    cpuid
+    and     edx, 1 << 4                     ; Is there a time stamp counter?
+    mov     [_b_has_tsc], edx
+    TIMESTAMP _b_tsc_entry                  ; Boot tracing starts here
+
     push    msg_welcome                     ; Display a nice hello world
     call    _b_print
     add     esp, 4                          ; Clean up the stack
 
 check_magic:
-    cmp     DWORD [_b_magic], 0x2BADB002    ; Make sure the magic value is correct
-    jne     bad_magic                       ; If its not, print a message and die
-
-copy_multiboot:
-    mov     ecx, 22                         ; 1/4 length of multiboot structure (4 bytes at a time)
-    mov     eax, [_b_mbd]                   ; Get the location of the multiboot structure
-    mov     ebx, _b_multiboot_info          ; Get the destination location
-    .CopyLoop:
-        mov     edx, [eax]
-        mov     [ebx], edx
-        add     eax, 4
-        add     ebx, 4
-        loop .CopyLoop
+    ; The info is left where the bootloader put it, bootinfo.c maps it later
+    cmp     DWORD [_b_magic], 0x2BADB002    ; Booted by a multiboot loader?
+    je      init_paging
+    cmp     DWORD [_b_magic], 0x36D76289    ; or a multiboot2 one?
+    jne     bad_magic                       ; If neither, print a message and die
 
 init_paging:
     ; Set up the page directory
@@ -54,11 +74,9 @@ init_paging:
 
     .DirectoryLoop:
         or      DWORD [ebx], 0x03           ; Set the present and read/write bits
-        add     ebx, 4                      ; Advance to the next page pointer
+        add     ebx, ENTRY_SIZE             ; Advance to the next page pointer
         loop    .DirectoryLoop
 
-    or DWORD [kernel_page], 0x03            ; Set the present bit on the kernel page
-
     mov     cx, 256                         ; Identity map the first megabyte
 
     mov     ebx, _b_end
@@ -71,10 +89,43 @@ init_paging:
 
     .IdentityMap:
         mov     [ebx], edx                  ; Put the address into the page table entry
-        add     ebx, 4                      ; Advance to the next page table entry
+        add     ebx, ENTRY_SIZE             ; Advance to the next page table entry
         add     edx, 0x1000                 ; Advance to the next physical page
         loop    .IdentityMap
 
+map_kernel:
+%ifdef PAE
+    mov     eax, 1                          ; CPUID leaf 1 has the feature flags
+    cpuid
+    test    edx, 1 << 6                     ; Is PAE supported?
+    jz      no_pae
+    mov     eax, _end_pa
+    cmp     eax, 0x400000                   ; The directories map the first 4MB with two 2MB pages
+    ja      kernel_too_big
+
+    mov     eax, cr4
+    or      eax, 1 << 5                     ; Enable PAE (CR4.PAE)
+    mov     cr4, eax
+    jmp     enable_paging
+%else
+    mov     eax, 1                          ; CPUID leaf 1 has the feature flags
+    cpuid
+    test    edx, 1 << 3                     ; Are 4MB pages (PSE) supported?
+    jz      .SmallPages
+    mov     eax, _end_pa
+    cmp     eax, 0x400000                   ; Does the kernel fit in the first 4MB?
+    ja      .SmallPages
+
+    mov     eax, cr4
+    or      eax, 1 << 4                     ; Enable 4MB pages (CR4.PSE)
+    mov     cr4, eax
+
+    mov     DWORD [kernel_page], 0x83       ; Map the first 4MB with one page (present, read/write, 4MB)
+    jmp     enable_paging
+
+    .SmallPages:
+    or DWORD [kernel_page], 0x03            ; Set the present bit on the kernel page
+
     mov     ebx, _start                     ; Get the start addres to calculate offset into page table
     sub     ebx, KERNEL_BASE                ; Subtract the BASE
     shr     ebx, 10                         ; Divide by (size of page) and multiply by size of entry
@@ -96,9 +147,14 @@ init_paging:
         add     edx, 0x1000                 ; Advance the physical address by one page
         add     ebx, 4                      ; Advance the page table pointer
         loop .KernelMap
+%endif
 
 enable_paging:
+%ifdef PAE
+    mov     eax, _b_pdpt                    ; CR3 points at the page directory pointer table
+%else
     mov     eax, _b_page_directory
+%endif
     mov     cr3, eax
 
     mov     eax, cr0
@@ -106,6 +162,7 @@ enable_paging:
     mov     cr0, eax
 
 kernel:
+    TIMESTAMP _b_tsc_paging                 ; The page tables are built
     call    kinit
 
 halt:
@@ -120,6 +177,22 @@ bad_magic:
     add     esp, 4
     jmp     halt
 
+%ifdef PAE
+no_pae:
+    ; The kernel was built for PAE, but the cpu doesn't have it
+    push    msg_no_pae
+    call    _b_print
+    add     esp, 4
+    jmp     halt
+
+kernel_too_big:
+    ; The kernel doesn't fit in the pages mapped for it
+    push    msg_kernel_too_big
+    call    _b_print
+    add     esp, 4
+    jmp     halt
+%endif
+
 _b_print:
     ; print out a message
     mov     eax, [esp+4]                    ; Get pointer to message
@@ -140,10 +213,42 @@ _b_print:
 section .rodata
 msg_welcome:    db  'hello, world', 0x0
 msg_bad_magic:  db  'Bad Multiboot Magic Number', 0x0
+%ifdef PAE
+msg_no_pae:     db  'PAE is not supported', 0x0
+msg_kernel_too_big: db  'Kernel is bigger than 4MB', 0x0
+%endif
 
 section .data
 
 align 0x1000
+%ifdef PAE
+_b_page_directory:                          ; Four page directories of 512 entries, one for each GB
+%assign ii 0                                ; Store pointers to pages created below
+%rep n_pages
+    dd page_table%+ii, 0x0
+    %assign ii ii+1
+%endrep
+
+%assign fill 1536-n_pages                   ; Fill up the directories below KERNEL_BASE with zeros
+%rep fill
+    dd 0x0, 0x0
+%endrep
+%undef fill
+
+    dd 0x00000083, 0x0                      ; Map the first 4MB for the kernel with two 2MB pages
+    dd 0x00200083, 0x0                      ; (present, read/write, 2MB)
+
+%rep 510                                    ; Fill the remaining entries
+    dd 0x0, 0x0
+%endrep
+
+align 0x20
+_b_pdpt:                                    ; Page directory pointer table, one entry per directory
+    dd _b_page_directory + 0x0001, 0x0      ; Bit 0 is present, the rest of the flags must be clear
+    dd _b_page_directory + 0x1001, 0x0
+    dd _b_page_directory + 0x2001, 0x0
+    dd _b_page_directory + 0x3001, 0x0
+%else
 _b_page_directory:                          ; Array of pointers to page tables
 %assign ii 0                                ; Store pointers to pages created below
 %rep n_pages
@@ -162,16 +267,19 @@ kernel_page: dd page_table768               ; Put in a page for the kernel
 %rep 255                                    ; Fill the remaining entries
     dd 0x0
 %endrep
+%endif
 
 section .bss
 
 align 4
 stack:  resb STACKSIZE
 _b_magic:  resd 1                           ; Stores the multiboot magic number
-_b_mbd:    resd 1                           ; Pointer to the multiboot info structure
+_b_mbd:    resd 1                           ; Physical address of the multiboot info structure
+_b_has_tsc: resd 1                          ; Non-zero if rdtsc can be used
 
-align 4
-_b_multiboot_info: resb 88                  ; Store a copy of the multiboot_info
+align 8
+_b_tsc_entry:  resq 1                       ; TSC when the bootstrap started
+_b_tsc_paging: resq 1                       ; TSC once paging is on
 
 ;
 ; Page Data Structures
@@ -188,4 +296,6 @@ _b_multiboot_info: resb 88                  ; Store a copy of the multiboot_info
     %assign ii ii+1
 %endrep
 
+%ifndef PAE
 PAGE_TABLE 768
+%endif
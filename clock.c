@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "cpu.h"
+#include "kernel.h"
+#include "idt.h"
+#include "pit.h"
+#include "lapic.h"
+#include "log.h"
+#include "clock.h"
+
+/* A conversion from one clock's units to another's, to = (from * mult) >> shift */
+struct clock_scale
+{
+    uint32_t mult;
+    uint32_t shift;
+};
+typedef struct clock_scale clock_scale_t;
+
+/* The TSC at clock_init, where clock_now_ns starts */
+static uint64_t tsc_base;
+
+static clock_scale_t tsc_to_ns;
+static clock_scale_t ns_to_tsc;
+static clock_scale_t ns_to_lapic;
+
+/* Whether the local APIC timer can fire at a TSC value */
+static bool tsc_deadline = false;
+
+/*
+ * Internal Function Declarations
+ */
+static clock_scale_t make_scale(uint32_t to, uint32_t from);
+
+
+void clock_init(void)
+{
+    if (!(cpu_features_edx() & CPUID_1_EDX_TSC))
+    {
+        panic("The cpu has no time stamp counter");
+    }
+    tsc_deadline = (cpu_features_ecx() & CPUID_1_ECX_TSC_DEADLINE) != 0;
+
+    /* Run both over the same stretch of the PIT, with the timer counting down from as high as it goes */
+    lapic_timer_setup(INT_TIMER, LAPIC_TIMER_ONESHOT | LAPIC_TIMER_MASKED);
+    lapic_timer_start(0xFFFFFFFFu);
+    uint64_t tsc_start = cpu_rdtsc();
+
+    pit_wait_us(CLOCK_CALIBRATE_US);
+
+    uint64_t tsc_end = cpu_rdtsc();
+    uint32_t lapic_counts = 0xFFFFFFFFu - lapic_timer_count();
+    lapic_timer_start(0);
+
+    /* Less than a few billion cycles go by while calibrating, so 32 bits hold it */
+    uint32_t tsc_cycles = (uint32_t)(tsc_end - tsc_start);
+    uint32_t calibrate_ns = CLOCK_CALIBRATE_US * NSEC_PER_USEC;
+
+    tsc_to_ns = make_scale(calibrate_ns, tsc_cycles);
+    ns_to_tsc = make_scale(tsc_cycles, calibrate_ns);
+    ns_to_lapic = make_scale(lapic_counts, calibrate_ns);
+    tsc_base = tsc_start;
+
+    klog("clock: TSC at %u kHz, local APIC timer at %u kHz%s", tsc_cycles / (CLOCK_CALIBRATE_US / 1000),
+         lapic_counts / (CLOCK_CALIBRATE_US / 1000), tsc_deadline ? ", TSC deadline mode" : "");
+    clock_init_cpu();
+}
+
+void clock_init_cpu(void)
+{
+    lapic_timer_setup(INT_TIMER, tsc_deadline ? LAPIC_TIMER_DEADLINE : LAPIC_TIMER_ONESHOT);
+}
+
+uint64_t clock_now_ns(void)
+{
+    return clock_tsc_to_ns(cpu_rdtsc() - tsc_base);
+}
+
+uint64_t clock_tsc_to_ns(uint64_t cycles)
+{
+    return umul_shift64(cycles, tsc_to_ns.mult, tsc_to_ns.shift);
+}
+
+void clock_set_oneshot(uint64_t ns)
+{
+    if (tsc_deadline)
+    {
+        uint64_t cycles = umul_shift64(ns, ns_to_tsc.mult, ns_to_tsc.shift);
+        cpu_write_msr(MSR_TSC_DEADLINE, cpu_rdtsc() + cycles + 1);  /* 0 would disarm it */
+        return;
+    }
+
+    uint64_t counts = umul_shift64(ns, ns_to_lapic.mult, ns_to_lapic.shift);
+    if (counts == 0)
+    {
+        counts = 1;                                             /* 0 would stop it */
+    }
+    else if (counts > 0xFFFFFFFFu)
+    {
+        counts = 0xFFFFFFFFu;                                   /* Fires early, the handler copes */
+    }
+    lapic_timer_start((uint32_t)counts);
+}
+
+void clock_cancel(void)
+{
+    if (tsc_deadline)
+    {
+        cpu_write_msr(MSR_TSC_DEADLINE, 0);
+    }
+    else
+    {
+        lapic_timer_start(0);
+    }
+}
+
+bool clock_tsc_deadline(void)
+{
+    return tsc_deadline;
+}
+
+/* Finds the biggest shift, for the most precision, where to / from scaled by it still fits in 32 bits */
+static clock_scale_t make_scale(uint32_t to, uint32_t from)
+{
+    clock_scale_t scale = { 0, 0 };
+    if (from == 0)
+    {
+        return scale;
+    }
+
+    for (uint32_t shift = 32; ; shift--)
+    {
+        uint64_t mult = udiv64((uint64_t)to << shift, from);
+        if (mult <= 0xFFFFFFFFu || shift == 0)
+        {
+            scale.mult = (uint32_t)mult;
+            scale.shift = shift;
+            return scale;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef _CLOCK_H_
+#define _CLOCK_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define NSEC_PER_SEC (1000000000u)
+#define NSEC_PER_USEC (1000u)
+
+/* How long the TSC and the local APIC timer are measured against the PIT for */
+#define CLOCK_CALIBRATE_US (10000u)
+
+/*
+ * Measures the TSC and the local APIC timer against the PIT, and sets up
+ * the calling cpu's timer. clock_now_ns() counts from here. The boot cpu's
+ * local APIC must be mapped.
+ */
+void clock_init(void);
+
+/* Sets up the calling cpu's timer to raise INT_TIMER, for the other cpus as they start */
+void clock_init_cpu(void);
+
+/*
+ * Nanoseconds since clock_init, from the TSC. It only goes backwards if
+ * the cpus' TSCs aren't in sync, which the firmware is trusted with.
+ */
+uint64_t clock_now_ns(void);
+
+/* Converts a number of TSC cycles to nanoseconds */
+uint64_t clock_tsc_to_ns(uint64_t cycles);
+
+/* Makes the calling cpu's timer raise INT_TIMER once, ns from now, replacing anything set before */
+void clock_set_oneshot(uint64_t ns);
+
+/* Stops the calling cpu's timer, so it stays asleep until something else wakes it */
+void clock_cancel(void);
+
+/* Returns true if the timer is driven by TSC deadlines rather than its own count */
+bool clock_tsc_deadline(void);
+#endif
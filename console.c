@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include "console.h"
+
+/* VGA text memory, two bytes per cell: the character then its attribute */
+#define CONSOLE_MEMORY (0xB8000)
+
+static uint32_t row = 1;                                /* Below what the bootstrap printed */
+static uint32_t column = 0;
+
+/*
+ * Internal Function Declarations
+ */
+static void newline(void);
+
+
+void console_write(const char *str)
+{
+    volatile uint16_t *screen = (volatile uint16_t *)CONSOLE_MEMORY;
+
+    for (; *str != 0; str++)
+    {
+        if (*str == '\n')
+        {
+            newline();
+            continue;
+        }
+
+        if (column == CONSOLE_COLUMNS)
+        {
+            newline();                                  /* Wrap long lines */
+        }
+        screen[row * CONSOLE_COLUMNS + column] = (uint16_t)((CONSOLE_ATTRIBUTE << 8) | (uint8_t)*str);
+        column++;
+    }
+}
+
+/* Moves to the start of the next line, scrolling everything up a line at the bottom */
+static void newline(void)
+{
+    volatile uint16_t *screen = (volatile uint16_t *)CONSOLE_MEMORY;
+
+    column = 0;
+    if (row + 1 < CONSOLE_ROWS)
+    {
+        row++;
+        return;
+    }
+
+    for (uint32_t ii = 0; ii < (CONSOLE_ROWS - 1) * CONSOLE_COLUMNS; ii++)
+    {
+        screen[ii] = screen[ii + CONSOLE_COLUMNS];
+    }
+    for (uint32_t ii = 0; ii < CONSOLE_COLUMNS; ii++)
+    {
+        screen[(CONSOLE_ROWS - 1) * CONSOLE_COLUMNS + ii] = (uint16_t)(CONSOLE_ATTRIBUTE << 8 | ' ');
+    }
+}
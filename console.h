@@ -0,0 +1,17 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_ 1
+
+/* Size of the VGA text screen */
+#define CONSOLE_COLUMNS (80)
+#define CONSOLE_ROWS (25)
+
+/* Colour of the text, light grey on black */
+#define CONSOLE_ATTRIBUTE (0x07)
+
+/*
+ * Writes a string to the VGA text screen, from where the last one stopped.
+ * '\n' starts a new line, and the screen scrolls up once the bottom is
+ * reached. It needs the first megabyte to still be identity mapped.
+ */
+void console_write(const char *str);
+#endif
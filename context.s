@@ -0,0 +1,28 @@
+global context_switch
+
+section .text
+
+;
+;   context_switch(uintptr_t *old_esp, uintptr_t new_esp)
+;       Saves the callee saved registers on the current stack, stores the
+;       stack pointer in old_esp, and resumes the thread whose stack is at
+;       new_esp. Everything else was saved by the caller, as the C calling
+;       convention requires.
+
+context_switch:
+    mov     eax, [esp+4]                    ; Where to save the old stack pointer
+    mov     edx, [esp+8]                    ; The new stack pointer
+
+    push    ebp                             ; Save the registers C expects to survive the call
+    push    ebx
+    push    esi
+    push    edi
+
+    mov     [eax], esp                      ; Switch stacks
+    mov     esp, edx
+
+    pop     edi                             ; Restore the new thread's registers
+    pop     esi
+    pop     ebx
+    pop     ebp
+    ret                                     ; Return to wherever the new thread called us from
@@ -0,0 +1,227 @@
+#ifndef _CPU_H_
+#define _CPU_H_ 1
+
+#include <stdint.h>
+
+/* Most CPUs the kernel keeps per-CPU state for */
+#define MAX_CPUS (8)
+
+/* Size of a cache line, per-CPU data is aligned to this to avoid false sharing */
+#define CACHE_LINE_SIZE (64)
+
+/* Bits in CPUID leaf 1 EDX */
+#define CPUID_1_EDX_PSE (1u << 3)               /* 4MB pages */
+#define CPUID_1_EDX_TSC (1u << 4)               /* Time stamp counter */
+#define CPUID_1_EDX_PAE (1u << 6)               /* Physical address extension */
+#define CPUID_1_EDX_PGE (1u << 13)              /* Global pages */
+#define CPUID_1_EDX_SSE2 (1u << 26)             /* SSE2, which has movnti */
+
+/* Bits in CPUID leaf 1 ECX */
+#define CPUID_1_ECX_TSC_DEADLINE (1u << 24)     /* The local APIC timer can fire at a TSC value */
+
+/* Structured extended feature flags, subleaf 0, and the bits in EBX */
+#define CPUID_7_FEATURES (7u)
+#define CPUID_7_EBX_ERMS (1u << 9)              /* Enhanced rep movsb and stosb, fast for any size */
+
+/* Extended CPUID leaves, and the bits in EDX of the extended feature flags */
+#define CPUID_EXT_BASE (0x80000000u)            /* Returns the highest extended leaf */
+#define CPUID_EXT_FEATURES (0x80000001u)
+#define CPUID_EXT_EDX_NX (1u << 20)             /* No-execute bit in PAE page tables */
+
+/* Model specific registers */
+#define MSR_APIC_BASE (0x1Bu)
+#define MSR_TSC_DEADLINE (0x6E0u)
+#define MSR_EFER (0xC0000080u)
+#define EFER_NXE (1ull << 11)                   /* Enables the NX bit */
+
+/* Bits in CR0 */
+#define CR0_WP (1u << 16)                       /* Read only pages are read only for ring 0 too */
+
+/* Bits in CR4 */
+#define CR4_PSE (1u << 4)
+#define CR4_PAE (1u << 5)
+#define CR4_PGE (1u << 7)
+
+static inline void cpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+    __asm__ volatile (
+        "cpuid"
+        : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+        : "a" (leaf), "c" (0)
+    );
+}
+
+/* Returns EDX of CPUID leaf 1, the basic feature flags */
+static inline uint32_t cpu_features_edx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    return edx;
+}
+
+/* Returns ECX of CPUID leaf 1, the newer feature flags */
+static inline uint32_t cpu_features_ecx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    return ecx;
+}
+
+/* Reads the time stamp counter */
+static inline uint64_t cpu_rdtsc(void)
+{
+    uint64_t tsc;
+    __asm__ volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
+}
+
+/*
+ * Everything below needs ring 0 or the kernel's gs. The host test harness
+ * (make test) builds with HOSTED defined and supplies these itself, see
+ * tests/host_cpu.c.
+ */
+#ifdef HOSTED
+uint32_t cpu_id(void);
+uint32_t cpu_read_cr2(void);
+uint32_t cpu_read_cr0(void);
+void cpu_write_cr0(uint32_t cr0);
+uint32_t cpu_read_cr3(void);
+void cpu_write_cr3(uint32_t cr3);
+uint32_t cpu_read_cr4(void);
+void cpu_write_cr4(uint32_t cr4);
+uint64_t cpu_read_msr(uint32_t msr);
+void cpu_write_msr(uint32_t msr, uint64_t value);
+void cpu_flush_tlb(void);
+void cpu_invlpg(uintptr_t addr);
+uint32_t cpu_irq_save(void);
+void cpu_irq_enable(void);
+void cpu_idle(void);
+void cpu_irq_restore(uint32_t flags);
+#else
+/* Returns the index of the CPU this is running on, percpu_init must have run on it */
+static inline uint32_t cpu_id(void)
+{
+    uint32_t id;
+    __asm__ volatile ("mov %0, gs:[0]" : "=r" (id));  /* The first field of its percpu_t */
+    return id;
+}
+
+/* Returns the address the last page fault was for */
+static inline uint32_t cpu_read_cr2(void)
+{
+    uint32_t cr2;
+    __asm__ volatile ("mov %0, cr2" : "=r" (cr2));
+    return cr2;
+}
+
+static inline uint32_t cpu_read_cr0(void)
+{
+    uint32_t cr0;
+    __asm__ volatile ("mov %0, cr0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void cpu_write_cr0(uint32_t cr0)
+{
+    __asm__ volatile ("mov cr0, %0" : : "r" (cr0) : "memory");
+}
+
+static inline uint32_t cpu_read_cr3(void)
+{
+    uint32_t cr3;
+    __asm__ volatile ("mov %0, cr3" : "=r" (cr3));
+    return cr3;
+}
+
+/* Loads a page directory, or with PAE a page directory pointer table */
+static inline void cpu_write_cr3(uint32_t cr3)
+{
+    __asm__ volatile ("mov cr3, %0" : : "r" (cr3) : "memory");
+}
+
+static inline uint32_t cpu_read_cr4(void)
+{
+    uint32_t cr4;
+    __asm__ volatile ("mov %0, cr4" : "=r" (cr4));
+    return cr4;
+}
+
+static inline void cpu_write_cr4(uint32_t cr4)
+{
+    __asm__ volatile ("mov cr4, %0" : : "r" (cr4) : "memory");
+}
+
+static inline uint64_t cpu_read_msr(uint32_t msr)
+{
+    uint64_t value;
+    __asm__ volatile ("rdmsr" : "=A" (value) : "c" (msr));
+    return value;
+}
+
+static inline void cpu_write_msr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile ("wrmsr" : : "c" (msr), "A" (value) : "memory");
+}
+
+/* Flushes the TLB by reloading CR3, global pages survive it */
+static inline void cpu_flush_tlb(void)
+{
+    __asm__ volatile (
+        "mov eax, cr3;"
+        "mov cr3, eax;"
+        : /* No output values */
+        : /* No input values */
+        : "eax", "memory"
+    );
+}
+
+/* Flushes the TLB entry for the page containing addr */
+static inline void cpu_invlpg(uintptr_t addr)
+{
+    __asm__ volatile (
+        "invlpg [%0]"
+        : /* No output values */
+        : "r" (addr)
+        : "memory"
+    );
+}
+
+/* Disables interrupts and returns the previous EFLAGS for cpu_irq_restore */
+static inline uint32_t cpu_irq_save(void)
+{
+    uint32_t flags;
+    __asm__ volatile (
+        "pushfd;"
+        "pop %0;"
+        "cli;"
+        : "=r" (flags)
+        : /* No input values */
+        : "memory"
+    );
+    return flags;
+}
+
+static inline void cpu_irq_enable(void)
+{
+    __asm__ volatile ("sti" : : : "memory");
+}
+
+/* Enables interrupts and waits for one, sti delays them until hlt has started */
+static inline void cpu_idle(void)
+{
+    __asm__ volatile ("sti; hlt" : : : "memory");
+}
+
+/* Restores the interrupt flag saved by cpu_irq_save */
+static inline void cpu_irq_restore(uint32_t flags)
+{
+    __asm__ volatile (
+        "push %0;"
+        "popfd;"
+        : /* No output values */
+        : "r" (flags)
+        : "memory", "cc"
+    );
+}
+#endif
+#endif
@@ -1,75 +1,140 @@
+global isr_table
+
+extern isr_handlers
+
+KERNEL_CODE equ 0x08                        ; Kernel code segment selector
+KERNEL_DATA equ 0x10                        ; Kernel data segment selector
+PERCPU_DATA equ 0x20                        ; Per-cpu segment selector, GDT_PERCPU in percpu.h
+REGS_INT_NO equ 40                          ; Offset of int_no in registers_t
+REGS_CS equ 52                              ; Offset of cs in registers_t
+
+; Hot vectors get a stub that goes straight to their handler, these match idt.h
+%define INT_PAGE_FAULT 14
+%define INT_TIMER 0x20
+%define INT_IPI 0xF0
+
 ;
 ;   Interrupts
 ;
 
+section .text
+
 isr_dispatch:
     pusha
 
+    mov     ax, gs                          ; Save the per-cpu segment on its own,
+    push    eax                             ; it isn't the same as the others
     mov     ax, ds                          ; Get the data segment
     push    eax                             ; Push it onto the stack
 
-    ; Load the kernel data segment
-    mov     ax, 0x10
+    ; Load the kernel data segment, unless it already is. SS doesn't need it,
+    ; it is either already the kernel's or the cpu loaded it from the TSS.
+    ; GS points at the cpu's percpu_t whenever the kernel is running
+    cmp     ax, KERNEL_DATA
+    je      .Dispatch
+    mov     ax, KERNEL_DATA
     mov     ds, ax
     mov     es, ax
     mov     fs, ax
+    mov     ax, PERCPU_DATA
     mov     gs, ax
-    mov     ss, ax
 
-    jmp $
+    .Dispatch:
+    cld                                     ; C expects the direction flag clear
+    mov     eax, [esp + REGS_INT_NO]        ; Get the interrupt number
+    push    esp                             ; The saved state is the registers_t argument
+    call    [isr_handlers + eax*4]          ; Call the handler registered for it
+    add     esp, 4
 
     pop     eax                             ; Retrieve the original data segment
+    pop     edx                             ; and the original GS
+    cmp     ax, KERNEL_DATA
+    je      .Return
     mov     ds, ax
     mov     es, ax
     mov     fs, ax
-    mov     gs, ax
-    mov     ss, ax
+    mov     gs, dx
 
+    .Return:
     popa                                    ; Restore the pushed state
     add     esp, 8                          ; Clean up the pushed error code and interrup number
-    sti
     iret
 
 ; Macro to create an interrupt handler for interrupts without error code
 %macro ISR_NOERR 1
     isr%1:
-        cli
         push byte 0                         ; Dummy error code
-        push byte %1                        ; The interrupt number
+        push dword %1                       ; The interrupt number
         jmp isr_dispatch                    ; Jump to the common interrupt handler
 %endmacro
 
 ; Macro to create an interrupt handler for interrupts with an error code
 %macro ISR_ERR 1
     isr%1:
-        cli
-        push byte %1                        ; Push the interrupt number
+        push dword %1                       ; Push the interrupt number
         jmp isr_dispatch
 %endmacro
 
-; 0-7
-%assign ii 0
-%rep 8
-    ISR_NOERR ii
-    %assign ii ii+1
-%endrep
+; Macro to create a fast interrupt handler for a hot vector, the second
+; parameter is 1 if the cpu pushes an error code. DS, ES and FS aren't touched;
+; the user data segments are flat like the kernel's, so whatever was loaded
+; still works. GS is the cpu's percpu_t, which user code doesn't have, so it
+; is loaded only when the interrupted code wasn't the kernel's.
+; make bench times copies of both stubs: this one costs about the same as
+; isr_dispatch when it interrupts the kernel, and saves ~45 cycles by
+; reloading only GS when it interrupts anything else.
+%macro ISR_FAST 2
+    isr%1:
+    %if %2 == 0
+        push byte 0                         ; Dummy error code
+    %endif
+        push dword %1                       ; The interrupt number
+        pusha
+        mov     eax, gs                     ; registers_t gets GS and the data segment
+        push    eax
+        mov     eax, ds
+        push    eax
+        cmp     dword [esp + REGS_CS], KERNEL_CODE
+        je      %%Dispatch
+        mov     ax, PERCPU_DATA             ; Not from the kernel, so GS is the user's
+        mov     gs, ax
 
-; 8
-ISR_ERR ii
-%assign ii ii+1
+    %%Dispatch:
+        cld
+        push    esp                         ; The registers_t argument
+        call    [isr_handlers + %1*4]       ; Straight to the handler
+        add     esp, 8                      ; Clean up the argument and the data segment
+        pop     eax                         ; Retrieve the original GS
+        cmp     dword [esp + REGS_CS - 8], KERNEL_CODE
+        je      %%Return
+        mov     gs, ax
 
-; 9
-ISR_NOERR ii
-%assign ii ii+1
+    %%Return:
+        popa
+        add     esp, 8                      ; Clean up the error code and interrupt number
+        iret
+%endmacro
 
-; 10-14
-%rep 5
-    ISR_ERR ii
+; 0-255, the exceptions that push an error code are 8, 10-14, 17, 21, 29 and 30
+%assign ii 0
+%rep 256
+    %if ii == INT_PAGE_FAULT
+        ISR_FAST ii, 1
+    %elif ii == INT_TIMER || ii == INT_IPI
+        ISR_FAST ii, 0
+    %elif ii == 8 || (ii >= 10 && ii <= 13) || ii == 17 || ii == 21 || ii == 29 || ii == 30
+        ISR_ERR ii
+    %else
+        ISR_NOERR ii
+    %endif
     %assign ii ii+1
 %endrep
 
-; 15-31
-%rep 17
-    ISR_NOERR ii
+section .data
+
+isr_table:                                  ; Addresses of the handlers above, for the IDT
+%assign ii 0
+%rep 256
+    dd isr%+ii
     %assign ii ii+1
 %endrep
@@ -0,0 +1,234 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "util.h"
+#include "format.h"
+
+/* Enough for any 64 bit number in decimal with its sign, or a pointer */
+#define FORMAT_NUMBER_MAX (24)
+
+/* Where the output goes, and how much room there is */
+struct format_output
+{
+    char *buffer;
+    uintptr_t size;                     /* Room for the characters, the null is extra */
+    uintptr_t length;
+};
+typedef struct format_output format_output_t;
+
+/*
+ * Internal Function Declarations
+ */
+static void put(format_output_t *out, char c);
+static void put_padded(format_output_t *out, const char *str, uintptr_t length, uint32_t width, bool left, char pad);
+static uintptr_t format_number(char *end, uint64_t value, uint32_t base, bool upper);
+
+
+uintptr_t format_string_va(char *buffer, uintptr_t size, const char *fmt, va_list args)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    format_output_t out = { buffer, size - 1, 0 };
+    char number[FORMAT_NUMBER_MAX];
+
+    for (; *fmt != 0; fmt++)
+    {
+        if (*fmt != '%')
+        {
+            put(&out, *fmt);
+            continue;
+        }
+        fmt++;
+
+        bool left = false;
+        char pad = ' ';
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+            {
+                left = true;
+            }
+            else if (*fmt == '0')
+            {
+                pad = '0';
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        uint32_t width = 0;
+        if (*fmt == '*')
+        {
+            int arg = va_arg(args, int);
+            left = left || arg < 0;
+            width = (uint32_t)(arg < 0 ? -arg : arg);
+            fmt++;
+        }
+        for (; *fmt >= '0' && *fmt <= '9'; fmt++)
+        {
+            width = width * 10 + (uint32_t)(*fmt - '0');
+        }
+
+        uint32_t longs = 0;             /* How many 'l's, 'z' counts as one since size_t is a long here */
+        for (;; fmt++)
+        {
+            if (*fmt == 'l' || *fmt == 'z')
+            {
+                longs++;
+            }
+            else if (*fmt != 'h')       /* Shorter types are promoted to int anyway */
+            {
+                break;
+            }
+        }
+
+        if (left)
+        {
+            pad = ' ';                  /* Zeros only go in front */
+        }
+
+        char *end = &number[FORMAT_NUMBER_MAX];
+        switch (*fmt)
+        {
+            case 'c':
+                number[0] = (char)va_arg(args, int);
+                put_padded(&out, number, 1, width, left, ' ');
+                break;
+
+            case 's':
+            {
+                const char *str = va_arg(args, const char *);
+                if (!str)
+                {
+                    str = "(null)";
+                }
+                uintptr_t length = 0;
+                while (str[length] != 0)
+                {
+                    length++;
+                }
+                put_padded(&out, str, length, width, left, ' ');
+                break;
+            }
+
+            case 'd':
+            case 'i':
+            {
+                int64_t arg = (longs > 1) ? va_arg(args, long long) : (longs ? va_arg(args, long) : va_arg(args, int));
+                bool negative = arg < 0;
+                uint64_t value = negative ? -(uint64_t)arg : (uint64_t)arg;
+                uintptr_t length = format_number(end, value, 10, false);
+                if (negative && pad == '0')
+                {
+                    put(&out, '-');     /* The sign goes before the zeros */
+                    put_padded(&out, end - length, length, width ? width - 1 : 0, left, pad);
+                }
+                else
+                {
+                    if (negative)
+                    {
+                        *(end - ++length) = '-';
+                    }
+                    put_padded(&out, end - length, length, width, left, pad);
+                }
+                break;
+            }
+
+            case 'u':
+            case 'x':
+            case 'X':
+            {
+                uint64_t value = (longs > 1) ? va_arg(args, unsigned long long) : (longs ? va_arg(args, unsigned long) : va_arg(args, unsigned int));
+                uintptr_t length = format_number(end, value, (*fmt == 'u') ? 10 : 16, *fmt == 'X');
+                put_padded(&out, end - length, length, width, left, pad);
+                break;
+            }
+
+            case 'p':
+            {
+                uintptr_t length = format_number(end, (uintptr_t)va_arg(args, void *), 16, false);
+                while (length < 2 * sizeof(uintptr_t))
+                {
+                    *(end - ++length) = '0';    /* Pointers always get every digit */
+                }
+                *(end - ++length) = 'x';
+                *(end - ++length) = '0';
+                put_padded(&out, end - length, length, width, left, ' ');
+                break;
+            }
+
+            case '%':
+                put(&out, '%');
+                break;
+
+            case 0:
+                fmt--;                  /* A lone '%' at the end, stop at the null */
+                break;
+
+            default:
+                put(&out, '%');         /* Show what wasn't understood */
+                put(&out, *fmt);
+                break;
+        }
+    }
+
+    buffer[out.length] = 0;
+    return out.length;
+}
+
+uintptr_t format_string(char *buffer, uintptr_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    uintptr_t length = format_string_va(buffer, size, fmt, args);
+    va_end(args);
+    return length;
+}
+
+/* Adds c to the output, if there is room */
+static void put(format_output_t *out, char c)
+{
+    if (out->length < out->size)
+    {
+        out->buffer[out->length++] = c;
+    }
+}
+
+/* Adds length characters of str, padded with pad to width */
+static void put_padded(format_output_t *out, const char *str, uintptr_t length, uint32_t width, bool left, char pad)
+{
+    uintptr_t padding = (width > length) ? width - length : 0;
+
+    for (uintptr_t ii = 0; !left && ii < padding; ii++)
+    {
+        put(out, pad);
+    }
+    for (uintptr_t ii = 0; ii < length; ii++)
+    {
+        put(out, str[ii]);
+    }
+    for (uintptr_t ii = 0; left && ii < padding; ii++)
+    {
+        put(out, ' ');
+    }
+}
+
+/* Writes value in base so that it ends just before end, and returns how many digits it took */
+static uintptr_t format_number(char *end, uint64_t value, uint32_t base, bool upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    uintptr_t length = 0;
+    do
+    {
+        uint64_t quotient = udiv64(value, base);
+        *--end = digits[value - quotient * base];
+        value = quotient;
+        length++;
+    } while (value != 0);
+    return length;
+}
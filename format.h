@@ -0,0 +1,17 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_ 1
+
+#include <stdint.h>
+#include <stdarg.h>
+
+/*
+ * printf style formatting into buffer, which always ends up null
+ * terminated and is cut short if it is too small. Understands the
+ * conversions c, s, d, i, u, x, X and p, with the h, hh, l, ll and z
+ * length modifiers, the '-' and '0' flags and a width, which may be '*'.
+ * Returns the length of what was written, without the null.
+ */
+uintptr_t format_string_va(char *buffer, uintptr_t size, const char *fmt, va_list args);
+
+uintptr_t format_string(char *buffer, uintptr_t size, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+#endif
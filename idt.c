@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <stdalign.h>
+#include "idt.h"
+#include "kernel.h"
+
+/* Addresses of isr0 to isr255, from dispatch_int.s */
+extern uint32_t isr_table[IDT_ENTRIES];
+
+alignas(8) static idt_entry_t idt[IDT_ENTRIES];
+
+isr_handler_t *isr_handlers[IDT_ENTRIES];
+
+static void unhandled_interrupt(registers_t *regs);
+
+static const char *exception_names[IDT_EXCEPTIONS] =
+{
+    "Division by zero",
+    "Debug",
+    "Non maskable interrupt",
+    "Breakpoint",
+    "Overflow",
+    "Bound range exceeded",
+    "Invalid opcode",
+    "Device not available",
+    "Double fault",
+    "Coprocessor segment overrun",
+    "Invalid TSS",
+    "Segment not present",
+    "Stack segment fault",
+    "General protection fault",
+    "Page fault",
+    "Reserved exception",
+    "x87 floating point exception",
+    "Alignment check",
+    "Machine check",
+    "SIMD floating point exception",
+    "Virtualization exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Reserved exception",
+    "Security exception",
+    "Reserved exception",
+};
+
+void idt_init(void)
+{
+    for (uint32_t ii = 0; ii < IDT_ENTRIES; ii++)
+    {
+        isr_handlers[ii] = &unhandled_interrupt;
+        idt_set_gate(ii, isr_table[ii], IDT_PRESENT | IDT_INTERRUPT_GATE);
+    }
+
+    idt_load();
+}
+
+void idt_load(void)
+{
+    idt_ptr_t idt_ptr;
+    idt_ptr.limit = sizeof(idt) - 1;
+    idt_ptr.base = (uintptr_t)idt;
+
+    __asm__ volatile (
+        "lidt [%0]"
+        : /* No output values */
+        : "r" (&idt_ptr)
+        : "memory"
+    );
+}
+
+void idt_set_gate(uint8_t vector, uintptr_t handler, uint8_t flags)
+{
+    idt[vector].base_lo = handler & 0xFFFF;
+    idt[vector].base_hi = (handler >> 16) & 0xFFFF;
+    idt[vector].selector = KERNEL_CODE_SELECTOR;
+    idt[vector].zero = 0;
+    idt[vector].flags = flags;
+}
+
+void idt_set_handler(uint8_t vector, isr_handler_t *handler)
+{
+    isr_handlers[vector] = (handler) ? handler : &unhandled_interrupt;
+}
+
+static void unhandled_interrupt(registers_t *regs)
+{
+    if (regs->int_no < IDT_EXCEPTIONS)
+    {
+        panic((char *)exception_names[regs->int_no]);
+    }
+    panic("Unexpected interrupt");
+}
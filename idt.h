@@ -0,0 +1,64 @@
+#ifndef _IDT_H_
+#define _IDT_H_ 1
+
+#include <stdint.h>
+#include "registers.h"
+
+/* Number of entries in the IDT, and how many of them are cpu exceptions */
+#define IDT_ENTRIES (256)
+#define IDT_EXCEPTIONS (32)
+
+/* Non maskable interrupts, which other cpus are sent for TLB shootdowns */
+#define INT_NMI (2)
+
+/* Vectors with their own fast stub in dispatch_int.s, which skips the segment handling */
+#define INT_PAGE_FAULT (14)
+#define INT_TIMER (0x20)                /* Local APIC timer */
+#define INT_IPI (0xF0)                  /* Interprocessor interrupts */
+
+/* Type and attribute byte of a gate */
+#define IDT_PRESENT (0x80)
+#define IDT_DPL_USER (0x60)             /* Can be raised with int from ring 3 */
+#define IDT_INTERRUPT_GATE (0x0E)       /* 32 bit, interrupts are disabled on entry */
+
+/* Selector of the kernel code segment, the same in loader.s's GDT and every cpu's own */
+#define KERNEL_CODE_SELECTOR (0x08)
+
+struct idt_entry
+{
+    uint16_t base_lo;                   /* Bits 0-15 of the handler address */
+    uint16_t selector;                  /* Code segment the handler runs in */
+    uint8_t zero;
+    uint8_t flags;                      /* Present, privilege level and gate type */
+    uint16_t base_hi;                   /* Bits 16-31 of the handler address */
+} __attribute__((packed));
+typedef struct idt_entry idt_entry_t;
+
+struct idt_ptr
+{
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+typedef struct idt_ptr idt_ptr_t;
+
+/* Handles an interrupt, regs is the state saved on the stack and can be changed */
+typedef void (isr_handler_t)(registers_t *regs);
+
+/*
+ * The handler of each vector, called straight from the stubs in
+ * dispatch_int.s. Vectors nobody registered panic.
+ */
+extern isr_handler_t *isr_handlers[IDT_ENTRIES];
+
+/* Points every vector at its stub in dispatch_int.s and loads the IDT */
+void idt_init(void);
+
+/* Loads the IDT idt_init filled in, for the other cpus as they start */
+void idt_load(void);
+
+/* Points vector's IDT entry at handler, an assembly stub */
+void idt_set_gate(uint8_t vector, uintptr_t handler, uint8_t flags);
+
+/* Makes handler the C handler for vector, or restores the default if it is null */
+void idt_set_handler(uint8_t vector, isr_handler_t *handler);
+#endif
@@ -0,0 +1,23 @@
+#ifndef _IO_H_
+#define _IO_H_ 1
+
+#include <stdint.h>
+
+static inline void outb(uint16_t port, uint8_t value)
+{
+    __asm__ volatile ("out %1, %0" : : "a" (value), "Nd" (port));
+}
+
+static inline uint8_t inb(uint16_t port)
+{
+    uint8_t value;
+    __asm__ volatile ("in %0, %1" : "=a" (value) : "Nd" (port));
+    return value;
+}
+
+/* Gives slow devices time to react, by writing to an unused port */
+static inline void io_wait(void)
+{
+    outb(0x80, 0);
+}
+#endif
@@ -1,22 +1,52 @@
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdalign.h>
 #include "util.h"
-#include "multiboot.h"
+#include "mem.h"
 #include "kernel.h"
 #include "memmgr_physical.h"
 #include "memmgr_virtual.h"
+#include "memmgr_frame.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_frame_info.h"
 #include "memmgr_dumb.h"
+#include "memmgr_slab.h"
+#include "memmgr_vma.h"
+#include "memmgr_aspace.h"
+#include "memmgr_zero_pool.h"
+#include "idt.h"
+#include "pic.h"
+#include "lapic.h"
+#include "clock.h"
+#include "sched.h"
+#include "percpu.h"
+#include "smp.h"
+#include "serial.h"
+#include "log.h"
+#include "trace.h"
+#include "qemu.h"
+#include "bootinfo.h"
 
-typedef void (mmap_callback_t)(multiboot_memory_map_t*);
+/* Where check_copy_on_write puts its page, anywhere in the user half will do */
+#define COW_CHECK_ADDR (0x40000000u)
+
+/* Top of the stack loader.s runs kmain on */
+extern uint8_t boot_stack_top;
 
 /* Page Table that maps the bootstrap stuff above KERNEL_BASE */
-alignas(0x1000) static page_table_t page_table769;
+alignas(0x1000) static page_table_t remap_table;
 
 /* Structure for referencing the page directory created by the bootstrap */
 static page_directory_t page_directory;
 
-/* The highest physical address reported by the bootloader */
-static uintptr_t max_physical_address = 0;
+/* Page Table that bootinfo maps what the bootloader left into, at BOOTINFO_BASE */
+alignas(0x1000) static page_table_t bootinfo_table;
+
+/* The highest physical address reported by the bootloader, up to MAX_PHYSICAL_ADDRESS */
+static phys_addr_t max_physical_address = 0;
+
+/* Set by the "exit" kernel option, QEMU's isa-debug-exit device ends the run once boot is done */
+static bool exit_after_boot = false;
 
 /* A very, very basic memory allocator. */
 static memmgr_dumb_t memmgr_dumb;
@@ -24,86 +54,344 @@ static memmgr_dumb_t memmgr_dumb;
 /* The physical memory manager */
 static memmgr_physical_t memmgr_phy;
 
-static void die(char *msg);
-static void multiboot_walk_mmap(mmap_callback_t* cb);
-static void update_max_phy_addr(multiboot_memory_map_t *mmap);
-static void apply_mmap_to_memmgr(multiboot_memory_map_t *mmap);
+#ifdef MEMMGR_BUDDY
+/* The buddy allocator, seeded from the memory map once memmgr_phy knows what is in use */
+static memmgr_buddy_t memmgr_buddy;
+#endif
+
+/* Where every allocator gets its frames from once boot is done with memmgr_phy */
+static memmgr_frame_t *memmgr_frames;
+
+/* Per-CPU caches in front of memmgr_frames */
+static memmgr_frame_cache_t frame_cache;
+
+static phys_addr_t mmap_end(const bootinfo_mmap_t *mmap);
+static void update_max_phy_addr(const bootinfo_mmap_t *mmap);
+static void free_available_in_memmgr(const bootinfo_mmap_t *mmap);
+static void apply_mmap_to_memmgr(const bootinfo_mmap_t *mmap);
+#ifdef MEMMGR_BUDDY
+static void seed_buddy_from_mmap(const bootinfo_mmap_t *mmap);
+#endif
+static page_table_t *alloc_page_table(void *data);
+static void timer_interrupt(registers_t *regs);
 static void unmap_bootstrap(void);
+static void setup_rmap(void);
+static void setup_frame_info(void);
+static void check_copy_on_write(void);
 
 void kmain(void)
 {
-    uint32_t flags = _b_multiboot_info.flags;                   /* Get the multiboot flags */
+    trace_init();                                               /* Before unmap_bootstrap takes its timestamps away */
+    percpu_init(0, (uintptr_t)&boot_stack_top);                 /* The boot cpu is cpu 0 */
+    mem_init();                                                 /* memcpy and memset pick rep movsb or movsd */
+    serial_init();
 
-    if (0 >= (flags & MULTIBOOT_INFO_MEM_MAP))                  /* Ensure that the memory map is valid */
+    idt_init();                                                 /* Exceptions go somewhere from here on */
+    trace_mark("percpu, serial, idt");
+
+    memmgr_virtual_bootstrap(&page_directory, &remap_table);    /* Take over the page directory the bootstrap created */
+    trace_mark("memmgr_virtual_bootstrap");
+
+    bootinfo_init(&page_directory, &bootinfo_table);            /* Map what the bootloader left, before any frames are taken */
+    if (!bootinfo_has_mmap())                                   /* Ensure that the memory map is valid */
     {
-        die("Memory info is not valid");
+        panic("Memory info is not valid");
     }
+    exit_after_boot = bootinfo_has_option("exit");
+    trace_mark("bootinfo_init");
 
-    memmgr_virtual_bootstrap(&page_directory, &page_table769);  /* Take over the page directory the bootstrap created */
     dumb_init(&memmgr_dumb, &page_directory);                   /* Initialize the dumb allocator */
+    dumb_set_frame_used(&memmgr_dumb, &bootinfo_frame_used);    /* which mustn't take the bootloader's frames */
+    memmgr_virtual_set_table_alloc(&page_directory, &alloc_page_table, &memmgr_dumb);
+    trace_mark("dumb_init");
 
-    multiboot_walk_mmap(&update_max_phy_addr);                  /* Find the highest available address to determine how big of a bitmap we need */
+    void *direct_map_tables = 0;
+    if (!memmgr_virtual_large_pages())                          /* Without 4MB pages the direct map needs page tables */
+    {
+        direct_map_tables = dumb_alloc(&memmgr_dumb, DIRECT_MAP_TABLES * sizeof(page_table_t));
+        if (!direct_map_tables)
+        {
+            panic("Could not allocate the direct map's page tables");
+        }
+    }
+    memmgr_virtual_direct_map(&page_directory, (page_table_t *)direct_map_tables);  /* Low physical memory is reachable from here on */
+    trace_mark("direct map");
+
+    bootinfo_walk_mmap(&update_max_phy_addr);                   /* Find the highest available address to determine how big of a bitmap we need */
+    trace_mark("mmap walk: max address");
 
     memmgr_physical_init(&memmgr_phy, max_physical_address);    /* Initialize memmgr_phy */
 
     uintptr_t size = memmgr_physical_size(&memmgr_phy);
     void *frame_bitmap = dumb_alloc(&memmgr_dumb, size);        /* Allocate memory for memmgr_physical */
+    if (!frame_bitmap)
+    {
+        panic("Could not allocate the frame bitmap");           /* More memory than dumb_alloc's window can describe */
+    }
     memmgr_physical_set_frames(&memmgr_phy, (uint32_t *)frame_bitmap);
+    trace_mark("memmgr_physical_set_frames");
 
-    multiboot_walk_mmap(&apply_mmap_to_memmgr);                 /* Walk the mmap again and apply it to the memmgr */
+    /* Holes the memory map doesn't mention aren't RAM, so only what it says is available is free */
+    memmgr_physical_set_range(&memmgr_phy, 0, memmgr_phy.n_frames);
+    bootinfo_walk_mmap(&free_available_in_memmgr);
+    bootinfo_walk_mmap(&apply_mmap_to_memmgr);                  /* Walk the mmap again and apply it to the memmgr */
+    bootinfo_reserve(&memmgr_phy);                              /* The bootloader's data is in available memory */
+    trace_mark("mmap walk: frame bitmap");
 
     unmap_bootstrap();
+    trace_mark("unmap_bootstrap");
+
+#ifdef MEMMGR_BUDDY
+    memmgr_buddy_init(&memmgr_buddy, max_physical_address);
+    void *buddy_bitmaps = dumb_alloc(&memmgr_dumb, memmgr_buddy_size(&memmgr_buddy));
+    if (!buddy_bitmaps)
+    {
+        panic("Could not allocate the buddy bitmaps");
+    }
+    memmgr_buddy_set_bitmaps(&memmgr_buddy, (uint32_t *)buddy_bitmaps);
+#endif
 
     memmgr_set_from_page_directory(&memmgr_phy, &page_directory);
+#ifdef MEMMGR_PAE
+    /* The PDPT was in the bootstrap's data, which is no longer mapped, but CR3 still points at it */
+    memmgr_physical_set_range(&memmgr_phy, page_directory.physicalAddr & ~(PAGE_SIZE - 1), 1);
+#endif
+    trace_mark("memmgr_set_from_page_directory");
+
+#ifdef MEMMGR_BUDDY
+    bootinfo_walk_mmap(&seed_buddy_from_mmap);                  /* Hand the frames memmgr_phy says are free to the buddy allocator */
+    memmgr_frames = &memmgr_buddy;
+    trace_mark("buddy seed");
+#else
+    memmgr_frames = &memmgr_phy;
+#endif
+
+    memmgr_frame_cache_init(&frame_cache, memmgr_frames, FRAME_CACHE_DEPTH);
+    dumb_set_frames(&memmgr_dumb, &frame_cache);                /* Everything in use is marked, so stop bumping frames */
+
+    slab_init(&memmgr_dumb);                                    /* kmalloc is usable from here on */
+    vma_init(&frame_cache);                                     /* and so are lazily filled memory areas, */
+    aspace_init(&page_directory, &memmgr_dumb);                 /* and address spaces sharing the kernel half */
+    setup_frame_info();                                         /* Descriptors for every frame, for copy on write */
+    zero_pool_init(&frame_cache);                               /* The idle loop zeroes frames for page faults */
+
+    if (max_physical_address > DIRECT_MAP_SIZE)
+    {
+        setup_rmap();                                           /* Track frames the direct map can't reach */
+    }
+    trace_mark("frame cache, slab, vma");
+    check_copy_on_write();                                      /* Nothing forks yet, so it is tried out here */
+    trace_mark("check_copy_on_write");
+
+    pic_init();                                                 /* Move the PICs out of the way of the exceptions, */
+    pic_disable();                                              /* the local APICs take the interrupts */
+    if (!lapic_init(&page_directory))
+    {
+        panic("No local APIC");
+    }
+    lapic_enable();
+    trace_mark("pic, lapic");
+    clock_init();                                               /* The timer is calibrated and clock_now_ns() runs */
+    idt_set_handler(INT_TIMER, &timer_interrupt);
+    trace_mark("clock_init");
+
+    sched_init();                                               /* kmain carries on as the first thread */
+    trace_mark("sched_init");
+    smp_init(&page_directory);                                  /* The other cpus park in their idle loops */
+    trace_mark("smp_init");
+
+    trace_dump();
+    klog("boot complete!");
+    log_flush();                                                /* Idle cpus write out whatever comes after */
+    if (exit_after_boot)
+    {
+        qemu_exit(QEMU_EXIT_SUCCESS);
+    }
+    sched_idle();                                               /* and becomes the idle thread */
+}
 
-    die("boot complete!");
+/* The timer interrupt, which preempts threads */
+static void timer_interrupt(registers_t *regs)
+{
+    UNUSED(regs);
+    lapic_eoi();                                                /* Before schedule() can switch away */
+    sched_tick();
 }
 
-/* Callback that finds the upper limit to physical memory */
-static void update_max_phy_addr(multiboot_memory_map_t *mmap)
+/* Returns the end of a memory map entry, cut off at MAX_PHYSICAL_ADDRESS */
+static phys_addr_t mmap_end(const bootinfo_mmap_t *mmap)
 {
-    if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE && mmap->addr + mmap->len > max_physical_address)
+    if (mmap->addr >= MAX_PHYSICAL_ADDRESS || mmap->len > MAX_PHYSICAL_ADDRESS - mmap->addr)
     {
-        max_physical_address = mmap->addr + mmap->len;
+        return MAX_PHYSICAL_ADDRESS;
     }
+    return mmap->addr + mmap->len;
 }
 
-/* Callback that applies the multiboot mmap to memmgr_phy */
-static void apply_mmap_to_memmgr(multiboot_memory_map_t *mmap)
+/* Callback that finds the upper limit to physical memory */
+static void update_max_phy_addr(const bootinfo_mmap_t *mmap)
 {
-    if (mmap->type != MULTIBOOT_MEMORY_AVAILABLE)
+    if (mmap->type == BOOTINFO_MEMORY_AVAILABLE && mmap->addr < MAX_PHYSICAL_ADDRESS
+        && mmap_end(mmap) > max_physical_address)
     {
-        memmgr_physical_set_range(&memmgr_phy, mmap->addr, idivc(mmap->len, PAGE_SIZE));
+        max_physical_address = mmap_end(mmap);
     }
 }
 
-/* Calls cb for every entry in the multiboot memory map */
-static void multiboot_walk_mmap(mmap_callback_t* cb)
+/* Callback that frees the whole frames of each available region in memmgr_phy */
+static void free_available_in_memmgr(const bootinfo_mmap_t *mmap)
 {
-    multiboot_info_t *mbt = &_b_multiboot_info;     /* I just wanted a shorthand */
-
-    multiboot_memory_map_t *mmap_phy = (multiboot_memory_map_t *)(uintptr_t)mbt->mmap_addr;
-    while ((uintptr_t)mmap_phy < mbt->mmap_length + mbt->mmap_addr)
+    if (mmap->type == BOOTINFO_MEMORY_AVAILABLE && mmap->addr < MAX_PHYSICAL_ADDRESS)
     {
-        multiboot_memory_map_t *mmap =
-            (multiboot_memory_map_t*)memmgr_virtual_phy_to_virt(&page_directory, (uintptr_t)mmap_phy);
-
-        if (mmap == (multiboot_memory_map_t *)(~0))
+        phys_addr_t first = (mmap->addr + PAGE_SIZE - 1) / PAGE_SIZE;
+        phys_addr_t last = mmap_end(mmap) / PAGE_SIZE;
+        if (last > first)
         {
-            /* TODO: Handle paging in missing frames */
-            die("Memory map not accessable");
+            memmgr_physical_clear_range(&memmgr_phy, first * PAGE_SIZE, last - first);
         }
+    }
+}
 
-        if (mmap->addr > UINTPTR_MAX || mmap->addr + mmap->len > UINTPTR_MAX)
+/* Callback that applies the memory map to memmgr_phy */
+static void apply_mmap_to_memmgr(const bootinfo_mmap_t *mmap)
+{
+    if (mmap->type != BOOTINFO_MEMORY_AVAILABLE && mmap->addr < MAX_PHYSICAL_ADDRESS)
+    {
+        phys_addr_t first = mmap->addr / PAGE_SIZE;             /* Any frame it touches is unusable */
+        phys_addr_t last = (mmap_end(mmap) + PAGE_SIZE - 1) / PAGE_SIZE;
+        memmgr_physical_set_range(&memmgr_phy, first * PAGE_SIZE, last - first);
+    }
+}
+
+#ifdef MEMMGR_BUDDY
+/* Callback that frees the unused frames of each available region into memmgr_buddy */
+static void seed_buddy_from_mmap(const bootinfo_mmap_t *mmap)
+{
+    if (mmap->type == BOOTINFO_MEMORY_AVAILABLE && mmap->addr < MAX_PHYSICAL_ADDRESS)
+    {
+        phys_addr_t first = (mmap->addr + PAGE_SIZE - 1) / PAGE_SIZE;  /* Only whole frames can be used */
+        phys_addr_t last = mmap_end(mmap) / PAGE_SIZE;
+        if (last > first)
         {
-            /* TODO: Handle > 4GB of memory with PAE or somesuch */
-            break;
+            memmgr_buddy_seed(&memmgr_buddy, &memmgr_phy, first * PAGE_SIZE, last - first);
         }
+    }
+}
+#endif
+
+/* Allocates the reverse map for the frames above the direct map, only the parts that get used are backed by frames */
+static void setup_rmap(void)
+{
+    phys_addr_t rmap_end = max_physical_address;
+    if (rmap_end > 0xFFFFF000u)
+    {
+        rmap_end = 0xFFFFF000u;                                 /* The reverse map only covers the first 4GB */
+    }
+
+    uintptr_t n_frames = idivc(rmap_end - DIRECT_MAP_SIZE, PAGE_SIZE);
+
+    uint32_t *rmap = vma_reserve(&page_directory, n_frames * sizeof(uint32_t), VMA_WRITABLE);
+    if (!rmap)
+    {
+        panic("Could not allocate the reverse map");
+    }
+
+    memmgr_virtual_set_rmap(&page_directory, rmap, n_frames);  /* Zero filled on first touch */
+}
+
+/* Allocates a descriptor for every frame, mapped all at once so that looking at one never faults */
+static void setup_frame_info(void)
+{
+    uintptr_t n_frames = memmgr_phy.n_frames;
+    if (n_frames > MEMMGR_FRAME_INFO_MAX_FRAMES)
+    {
+        n_frames = MEMMGR_FRAME_INFO_MAX_FRAMES;
+    }
+
+    uintptr_t n_pages = idivc(memmgr_frame_info_size(n_frames), PAGE_SIZE);
+    phys_addr_t infos_pa = memmgr_frame_cache_alloc_run(&frame_cache, n_pages, PAGE_SIZE);
+    if (infos_pa == MEMMGR_PHYSICAL_NONE)
+    {
+        panic("Could not allocate the frame descriptors");
+    }
+
+    memmgr_frame_info_t *infos = vma_map_physical(&page_directory, infos_pa, n_pages * PAGE_SIZE, VMA_WRITABLE);
+    if (!infos)
+    {
+        panic("No room for the frame descriptors");
+    }
+
+    memmgr_frame_info_init(infos, n_frames);
+    vma_init_cow();
+}
+
+/*
+ * Forks an address space with a written page, then writes to it on both
+ * sides. The first write must copy the shared frame, the second just make
+ * the page writable again. Interrupts are still disabled, so nothing else
+ * switches address space meanwhile.
+ */
+static void check_copy_on_write(void)
+{
+    volatile uint32_t *word = (volatile uint32_t *)COW_CHECK_ADDR;
+    page_directory_t *parent = aspace_create();
+    if (!parent || !vma_add(parent, (void*)word, PAGE_SIZE, VMA_WRITABLE | VMA_USER))
+    {
+        panic("Could not create an address space to check copy on write");
+    }
+    switch_page_directory(parent);
+    *word = 1;                                                  /* Faulted in, with a frame of its own */
 
-        cb(mmap);
+    page_directory_t *child = aspace_fork(parent);
+    if (!child)
+    {
+        panic("Could not fork an address space to check copy on write");
+    }
+    page_t *parent_page = get_page(COW_CHECK_ADDR, 0, parent);
+    page_t *child_page = get_page(COW_CHECK_ADDR, 0, child);
+    phys_addr_t shared = memmgr_virtual_page_addr(parent_page);
+    memmgr_frame_info_t *info = memmgr_frame_info(shared);
+    if (!info || info->shares != 1 || memmgr_virtual_page_addr(child_page) != shared
+        || parent_page->rw || !(parent_page->avail & VMA_PAGE_COW)
+        || child_page->rw || !(child_page->avail & VMA_PAGE_COW))
+    {
+        panic("Fork didn't share the page read only");
+    }
 
-        mmap_phy = (multiboot_memory_map_t*)((uintptr_t)mmap_phy + mmap->size + sizeof(uint32_t));
+    switch_page_directory(child);
+    *word = 2;                                                  /* Still shared, so the child gets a copy */
+    if (*word != 2 || info->shares != 0 || memmgr_virtual_page_addr(child_page) == shared
+        || !child_page->rw || (child_page->avail & VMA_PAGE_COW))
+    {
+        panic("Writing a shared page didn't copy it");
     }
+
+    switch_page_directory(parent);
+    if (*word != 1)
+    {
+        panic("Writing a copied page changed the original");
+    }
+    *word = 3;                                                  /* Nothing shares it now, so it is only made writable */
+    if (*word != 3 || memmgr_virtual_page_addr(parent_page) != shared
+        || !parent_page->rw || (parent_page->avail & VMA_PAGE_COW))
+    {
+        panic("Writing an unshared page copied it");
+    }
+
+    switch_page_directory(&page_directory);
+    aspace_destroy(child);
+    aspace_destroy(parent);
+}
+
+/* Gives get_page new page tables from the dumb allocator */
+static page_table_t *alloc_page_table(void *data)
+{
+    page_table_t *table = dumb_alloc((memmgr_dumb_t *)data, sizeof(page_table_t));
+    if (table)
+    {
+        memset(table, 0, sizeof(page_table_t));
+    }
+    return table;
 }
 
 static void unmap_bootstrap(void)
@@ -111,19 +399,20 @@ static void unmap_bootstrap(void)
     uintptr_t start = (uintptr_t)&_b_start;
     uintptr_t end = (uintptr_t)&_b_end;
 
-    for (uintptr_t ii = start; ii < end; ii+=PAGE_SIZE)
-    {
-        memmgr_virtual_unmap(&page_directory, (void*)ii);
-    }
+    tlb_gather_t gather;
+    memmgr_virtual_gather_init(&gather);
+    memmgr_virtual_unmap_range(&page_directory, (void*)start, idivc(end - start, PAGE_SIZE), &gather);
+    memmgr_virtual_gather_commit(&gather);
 }
 
-static void die(char *msg)
+void panic(char *msg)
 {
-    volatile uint8_t *video = (volatile uint8_t*)0xB8000;
-    while (*msg != 0)
+    __asm__ ("cli");
+    klog("panic: %s", msg);
+    log_flush_panic();
+    if (exit_after_boot)
     {
-        *video++ = *msg++;
-        *video++ = 0x07;
+        qemu_exit(QEMU_EXIT_PANIC);
     }
 
     for (;;)
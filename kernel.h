@@ -1,7 +1,18 @@
 #ifndef _KERNEL_H_
 #define _KERNEL_H_ 1
 
-extern multiboot_info_t _b_multiboot_info;
+#include <stdint.h>
+
+/* The magic number the bootloader passed in eax, and the physical address of its info in ebx */
+extern uint32_t _b_magic;
+extern uint32_t _b_mbd;
 extern void _b_print(char * str);
 
+/* The TSC when the bootstrap started and once it turned paging on, zero without a TSC */
+extern uint64_t _b_tsc_entry;
+extern uint64_t _b_tsc_paging;
+
+/* Prints msg and halts, for errors the kernel can't recover from */
+void panic(char *msg) __attribute__((noreturn));
+
 #endif
@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "cpu.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_vma.h"
+#include "idt.h"
+#include "lapic.h"
+
+/* Register offsets */
+#define LAPIC_ID (0x020)
+#define LAPIC_EOI (0x0B0)
+#define LAPIC_SVR (0x0F0)               /* Spurious interrupt vector register */
+#define LAPIC_ICR_LOW (0x300)           /* Interrupt command register, writing the low half sends */
+#define LAPIC_ICR_HIGH (0x310)
+#define LAPIC_LVT_TIMER (0x320)
+#define LAPIC_TIMER_INITIAL (0x380)
+#define LAPIC_TIMER_CURRENT (0x390)
+#define LAPIC_TIMER_DIVIDE_CONFIG (0x3E0)
+#define LAPIC_SIZE (0x400)
+
+/* Bits of MSR_APIC_BASE */
+#define APIC_BASE_ENABLE (0x800)
+#define APIC_BASE_ADDRESS (0xFFFFF000u)
+
+/* CPUID leaf 1 EDX says whether there is an APIC at all */
+#define CPUID_1_EDX_APIC (1u << 9)
+
+/* LAPIC_TIMER_DIVIDE_CONFIG value for dividing by LAPIC_TIMER_DIVIDE */
+#define DIVIDE_BY_16 (0x3)
+
+#define LAPIC_SVR_ENABLE (0x100)
+
+/* Bits of the interrupt command register */
+#define ICR_NMI (0x400)
+#define ICR_INIT (0x500)
+#define ICR_FIXED (0x000)
+#define ICR_STARTUP (0x600)
+#define ICR_PENDING (0x1000)            /* Delivery status, set until the interrupt has been sent */
+#define ICR_ASSERT (0x4000)
+#define ICR_DEST_SHIFT (24)             /* The destination APIC id is in the top byte of the high half */
+
+static volatile uint32_t *lapic = 0;
+
+/*
+ * Internal Function Declarations
+ */
+static void send_ipi(uint32_t apic_id, uint32_t command);
+static void spurious_interrupt(registers_t *regs);
+
+
+bool lapic_init(page_directory_t *page_directory)
+{
+    if (!(cpu_features_edx() & CPUID_1_EDX_APIC))
+    {
+        return false;
+    }
+
+    uint64_t base = cpu_read_msr(MSR_APIC_BASE);
+    if (!(base & APIC_BASE_ENABLE))
+    {
+        return false;                                           /* Turned off by the firmware */
+    }
+
+    lapic = vma_map_physical(page_directory, (phys_addr_t)(base & APIC_BASE_ADDRESS), LAPIC_SIZE, VMA_WRITABLE | VMA_UNCACHED);
+    if (!lapic)
+    {
+        return false;
+    }
+
+    idt_set_handler(LAPIC_SPURIOUS, &spurious_interrupt);
+    return true;
+}
+
+void lapic_enable(void)
+{
+    lapic[LAPIC_SVR / 4] = LAPIC_SVR_ENABLE | LAPIC_SPURIOUS;
+}
+
+uint32_t lapic_id(void)
+{
+    return lapic[LAPIC_ID / 4] >> 24;
+}
+
+void lapic_eoi(void)
+{
+    lapic[LAPIC_EOI / 4] = 0;
+}
+
+void lapic_send_init(uint32_t apic_id)
+{
+    send_ipi(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint8_t page)
+{
+    send_ipi(apic_id, ICR_STARTUP | page);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+    send_ipi(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void lapic_send_nmi(uint32_t apic_id)
+{
+    send_ipi(apic_id, ICR_NMI | ICR_ASSERT);
+}
+
+void lapic_timer_setup(uint8_t vector, uint32_t mode)
+{
+    lapic[LAPIC_TIMER_INITIAL / 4] = 0;                     /* Stop it while it changes */
+    lapic[LAPIC_TIMER_DIVIDE_CONFIG / 4] = DIVIDE_BY_16;
+    lapic[LAPIC_LVT_TIMER / 4] = mode | vector;
+}
+
+void lapic_timer_start(uint32_t count)
+{
+    lapic[LAPIC_TIMER_INITIAL / 4] = count;
+}
+
+uint32_t lapic_timer_count(void)
+{
+    return lapic[LAPIC_TIMER_CURRENT / 4];
+}
+
+/* Writes the interrupt command register, and waits for the interrupt to be sent */
+static void send_ipi(uint32_t apic_id, uint32_t command)
+{
+    uint32_t flags = cpu_irq_save();                        /* Nothing else can use the ICR halfway through */
+
+    lapic[LAPIC_ICR_HIGH / 4] = apic_id << ICR_DEST_SHIFT;
+    lapic[LAPIC_ICR_LOW / 4] = command;
+    while (lapic[LAPIC_ICR_LOW / 4] & ICR_PENDING)
+    {
+        __asm__ volatile ("pause");
+    }
+
+    cpu_irq_restore(flags);
+}
+
+/* Spurious interrupts don't get an EOI */
+static void spurious_interrupt(registers_t *regs)
+{
+    UNUSED(regs);
+}
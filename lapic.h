@@ -0,0 +1,55 @@
+#ifndef _LAPIC_H_
+#define _LAPIC_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memmgr_virtual.h"
+
+/* Vector of the local APIC's spurious interrupts, its low four bits have to be set on old cpus */
+#define LAPIC_SPURIOUS (0xFF)
+
+/* Modes for lapic_timer_setup */
+#define LAPIC_TIMER_ONESHOT (0x00000)   /* Counts lapic_timer_start's count down once */
+#define LAPIC_TIMER_DEADLINE (0x40000)  /* Fires when the TSC reaches MSR_TSC_DEADLINE */
+#define LAPIC_TIMER_MASKED (0x10000)    /* Counts without raising the interrupt */
+
+/* The timer counts at the APIC's clock divided by this */
+#define LAPIC_TIMER_DIVIDE (16)
+
+/*
+ * Maps the local APIC registers into page_directory, from where
+ * MSR_APIC_BASE says they are. Every cpu's are at the same address.
+ * Returns false if the cpu has no APIC or they can't be mapped.
+ */
+bool lapic_init(page_directory_t *page_directory);
+
+/* Turns on the calling cpu's local APIC */
+void lapic_enable(void);
+
+/* Returns the calling cpu's local APIC id */
+uint32_t lapic_id(void);
+
+/* Signals the end of an interrupt the local APIC delivered */
+void lapic_eoi(void);
+
+/* Sends an INIT interprocessor interrupt, which resets the cpu to wait for a startup */
+void lapic_send_init(uint32_t apic_id);
+
+/* Sends a startup interprocessor interrupt, the cpu starts in real mode at page * 4k */
+void lapic_send_startup(uint32_t apic_id, uint8_t page);
+
+/* Sends vector to the cpu with apic_id */
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+/* Sends a non maskable interrupt, which arrives even when the cpu has interrupts disabled */
+void lapic_send_nmi(uint32_t apic_id);
+
+/* Points the calling cpu's timer at vector, in one of the LAPIC_TIMER modes, stopped */
+void lapic_timer_setup(uint8_t vector, uint32_t mode);
+
+/* Starts the one shot timer counting down from count, or stops it if count is 0 */
+void lapic_timer_start(uint32_t count);
+
+/* Returns what the one shot timer has left to count */
+uint32_t lapic_timer_count(void);
+#endif
@@ -1,13 +1,14 @@
 extern kmain
 
 global kinit
+global boot_stack_top
 
 STACKSIZE equ 0x1000
 
 section .text
 
 kinit:
-    mov     esp, stack + STACKSIZE          ; Create a new stack in the higher half
+    mov     esp, boot_stack_top             ; Create a new stack in the higher half
 
 set_gdt:
     lgdt    [GDTR]                          ; Load the new GDT
@@ -39,3 +40,4 @@ section .bss
 
 align 4
 stack: resb STACKSIZE      ; Reserve a new stack that resides above KERNEL_BASE
+boot_stack_top:            ; The boot cpu's stack, percpu_init puts it in the TSS
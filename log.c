@@ -0,0 +1,193 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "format.h"
+#include "clock.h"
+#include "serial.h"
+#include "console.h"
+#include "log.h"
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+/* Room for the time in front of a message, and the newline after it */
+#define LOG_PREFIX_MAX (24u)
+
+/* What each message starts with in its ring, the text follows it without a null */
+struct log_header
+{
+    uint64_t ns;                        /* clock_now_ns() when it was logged */
+    uint32_t length;
+};
+typedef struct log_header log_header_t;
+
+static log_ring_t rings[MAX_CPUS];
+
+/* Held by whoever is writing messages out, which also keeps the screen and COM1 to one cpu */
+static spinlock_t drain_lock = SPINLOCK_INIT;
+
+/*
+ * Internal Function Declarations
+ */
+static bool drain_one(void);
+static void ring_write(log_ring_t *ring, uint32_t pos, const void *src, uint32_t size);
+static void ring_read(log_ring_t *ring, uint32_t pos, void *dst, uint32_t size);
+static void write_out(const char *line);
+
+
+void klog(const char *fmt, ...)
+{
+    char line[LOG_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    uint32_t length = format_string_va(line, sizeof(line), fmt, args);
+    va_end(args);
+
+    while (length > 0 && line[length - 1] == '\n')
+    {
+        length--;                                           /* Every message gets a line of its own anyway */
+    }
+
+    log_header_t header = { clock_now_ns(), length };
+    uint32_t size = sizeof(header) + length;
+
+    uint32_t flags = cpu_irq_save();                        /* An interrupt logging in the middle would corrupt the ring */
+    log_ring_t *ring = &rings[cpu_id()];
+    uint32_t head = ring->head;
+    if (LOG_RING_SIZE - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) < size)
+    {
+        ring->dropped++;
+    }
+    else
+    {
+        ring_write(ring, head, &header, sizeof(header));
+        ring_write(ring, head + sizeof(header), line, length);
+        __atomic_store_n(&ring->head, head + size, __ATOMIC_RELEASE);  /* The drain can have it now */
+    }
+    cpu_irq_restore(flags);
+}
+
+bool log_pending(void)
+{
+    if (drain_lock)
+    {
+        return false;
+    }
+
+    for (uint32_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        if (rings[ii].head != rings[ii].tail || rings[ii].dropped != rings[ii].reported)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool log_drain_one(void)
+{
+    if (!spin_trylock(&drain_lock))
+    {
+        return false;
+    }
+    bool drained = drain_one();
+    spin_unlock(&drain_lock);
+    return drained;
+}
+
+void log_flush(void)
+{
+    if (!spin_trylock(&drain_lock))
+    {
+        return;                                             /* Whoever has it writes ours out too */
+    }
+    while (drain_one());
+    spin_unlock(&drain_lock);
+}
+
+void log_flush_panic(void)
+{
+    /* Other cpus may still be logging, so stop once every ring could have been emptied */
+    for (uint32_t ii = 0; ii < MAX_CPUS * LOG_RING_SIZE / sizeof(log_header_t) && drain_one(); ii++);
+}
+
+/* Writes out the oldest message across every ring, or the count of any that were dropped. Returns false if there were none */
+static bool drain_one(void)
+{
+    char line[LOG_PREFIX_MAX + LOG_LINE_MAX];
+    log_ring_t *oldest = 0;
+    log_header_t header = { 0, 0 };
+
+    for (uint32_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        log_ring_t *ring = &rings[ii];
+
+        uint32_t dropped = ring->dropped;
+        if (dropped != ring->reported)
+        {
+            format_string(line, sizeof(line), "log: %u messages from cpu %u dropped\n", dropped - ring->reported, ii);
+            ring->reported = dropped;
+            write_out(line);
+            return true;
+        }
+
+        if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+        {
+            continue;
+        }
+
+        log_header_t next;
+        ring_read(ring, ring->tail, &next, sizeof(next));
+        if (!oldest || next.ns < header.ns)
+        {
+            oldest = ring;
+            header = next;
+        }
+    }
+
+    if (!oldest)
+    {
+        return false;
+    }
+
+    uint64_t seconds = udiv64(header.ns, NSEC_PER_SEC);
+    uint32_t micros = (uint32_t)udiv64(header.ns - seconds * NSEC_PER_SEC, NSEC_PER_USEC);
+    uint32_t prefix = format_string(line, LOG_PREFIX_MAX, "[%5llu.%06u] ", seconds, micros);
+
+    uint32_t tail = oldest->tail;
+    ring_read(oldest, tail + sizeof(header), &line[prefix], header.length);
+    __atomic_store_n(&oldest->tail, tail + sizeof(header) + header.length, __ATOMIC_RELEASE);  /* Its cpu can reuse the space */
+
+    line[prefix + header.length] = '\n';
+    line[prefix + header.length + 1] = 0;
+    write_out(line);
+    return true;
+}
+
+/* Copies size bytes into the ring at pos, wrapping around its end */
+static void ring_write(log_ring_t *ring, uint32_t pos, const void *src, uint32_t size)
+{
+    const char *bytes = src;
+    for (uint32_t ii = 0; ii < size; ii++)
+    {
+        ring->data[(pos + ii) & LOG_RING_MASK] = bytes[ii];
+    }
+}
+
+/* Copies size bytes out of the ring from pos, wrapping around its end */
+static void ring_read(log_ring_t *ring, uint32_t pos, void *dst, uint32_t size)
+{
+    char *bytes = dst;
+    for (uint32_t ii = 0; ii < size; ii++)
+    {
+        bytes[ii] = ring->data[(pos + ii) & LOG_RING_MASK];
+    }
+}
+
+static void write_out(const char *line)
+{
+    serial_write(line);
+    console_write(line);
+}
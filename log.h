@@ -0,0 +1,55 @@
+#ifndef _LOG_H_
+#define _LOG_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include "cpu.h"
+
+/* Bytes of log each cpu buffers, a power of two */
+#define LOG_RING_SIZE (8192u)
+
+/* Longest message, anything past it is cut off */
+#define LOG_LINE_MAX (160u)
+
+/*
+ * One cpu's messages waiting to be written out. Only that cpu adds to it,
+ * with interrupts disabled, and only whoever holds the drain lock takes
+ * from it, so neither side ever waits for the other. head and tail count
+ * bytes forever and are masked to index data.
+ */
+struct log_ring
+{
+    alignas(CACHE_LINE_SIZE) volatile uint32_t head;    /* Where the cpu adds the next message */
+    volatile uint32_t dropped;                          /* Messages that didn't fit */
+    alignas(CACHE_LINE_SIZE) volatile uint32_t tail;    /* Where the drain takes the next message from */
+    uint32_t reported;                                  /* How many of dropped the drain has said so about */
+    char data[LOG_RING_SIZE];
+};
+typedef struct log_ring log_ring_t;
+
+/*
+ * Formats a message printf style, see format_string, and adds it to the
+ * calling cpu's ring stamped with clock_now_ns(). It never waits for the
+ * serial port or another cpu, and the message is dropped if the ring is
+ * full. Each call is a line of its own. It needs percpu_init to have run,
+ * and mustn't be used from the NMI handler.
+ */
+void klog(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* Returns true if there are messages to write out and nobody is writing them */
+bool log_pending(void);
+
+/*
+ * Writes the oldest message across every cpu to COM1 and the screen.
+ * Returns false without waiting if another cpu is draining, or if there
+ * was nothing to write. Idle cpus call it a message at a time.
+ */
+bool log_drain_one(void);
+
+/* Writes every message out before returning, unless another cpu is already doing it */
+void log_flush(void);
+
+/* Writes every message out even if another cpu is meant to be, for panic */
+void log_flush_panic(void);
+#endif
@@ -0,0 +1,209 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "cpu.h"
+#include "mem.h"
+
+/* The small size loops mustn't be turned back into calls to memcpy and memset */
+#pragma GCC optimize ("no-tree-loop-distribute-patterns")
+
+/* For reading four bytes at a time from anywhere */
+typedef uint32_t __attribute__((may_alias, aligned(1))) mem_word_t;
+
+static bool erms = false;
+
+/*
+ * Internal Function Declarations
+ */
+static void copy_small(uint8_t *dst, const uint8_t *src, size_t n);
+static void set_small(uint8_t *dst, uint8_t c, size_t n);
+
+
+void mem_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(0, &eax, &ebx, &ecx, &edx);                       /* Returns the highest basic leaf */
+    if (eax < CPUID_7_FEATURES)
+    {
+        return;
+    }
+
+    cpu_cpuid(CPUID_7_FEATURES, &eax, &ebx, &ecx, &edx);
+    erms = (ebx & CPUID_7_EBX_ERMS) != 0;
+}
+
+bool mem_has_erms(void)
+{
+    return erms;
+}
+
+void *mem_copy_movsd(void *restrict dst, const void *restrict src, size_t n)
+{
+    if (n < MEM_SMALL)
+    {
+        copy_small(dst, src, n);
+        return dst;
+    }
+
+    /* Bytes up to a word boundary in dst, since movsd is slow with unaligned stores */
+    uint8_t *to = dst;
+    const uint8_t *from = src;
+    size_t head = -(uintptr_t)to & 3;
+    copy_small(to, from, head);
+    to += head;
+    from += head;
+    n -= head;
+
+    size_t words = n / 4;
+    __asm__ volatile ("rep movsd" : "+D" (to), "+S" (from), "+c" (words) : : "memory");
+    copy_small(to, from, n % 4);                                /* A second rep would start up again for 3 bytes */
+    return dst;
+}
+
+void *mem_copy_movsb(void *restrict dst, const void *restrict src, size_t n)
+{
+    if (n < MEM_SMALL)
+    {
+        copy_small(dst, src, n);
+        return dst;
+    }
+
+    void *to = dst;
+    __asm__ volatile ("rep movsb" : "+D" (to), "+S" (src), "+c" (n) : : "memory");
+    return dst;
+}
+
+void *mem_set_stosd(void *dst, int c, size_t n)
+{
+    if (n < MEM_SMALL)
+    {
+        set_small(dst, (uint8_t)c, n);
+        return dst;
+    }
+
+    uint8_t *to = dst;
+    size_t head = -(uintptr_t)to & 3;
+    set_small(to, (uint8_t)c, head);
+    to += head;
+    n -= head;
+
+    uint32_t value = (uint8_t)c * 0x01010101u;                  /* The byte in all four places */
+    size_t words = n / 4;
+    __asm__ volatile ("rep stosd" : "+D" (to), "+c" (words) : "a" (value) : "memory");
+    set_small(to, (uint8_t)c, n % 4);
+    return dst;
+}
+
+void *mem_set_stosb(void *dst, int c, size_t n)
+{
+    if (n < MEM_SMALL)
+    {
+        set_small(dst, (uint8_t)c, n);
+        return dst;
+    }
+
+    void *to = dst;
+    __asm__ volatile ("rep stosb" : "+D" (to), "+c" (n) : "a" (c) : "memory");
+    return dst;
+}
+
+void *mem_move(void *dst, const void *src, size_t n)
+{
+    uint8_t *to = dst;
+    const uint8_t *from = src;
+
+    if ((uintptr_t)to - (uintptr_t)from >= n)
+    {
+        /* dst is below src, or after the end of it, so a forward copy never reads what it wrote */
+        return erms ? mem_copy_movsb(dst, src, n) : mem_copy_movsd(dst, src, n);
+    }
+
+    /*
+     * Backwards from the end. rep movsb with the direction flag set doesn't
+     * get the fast string microcode, so this goes a word at a time.
+     */
+    while (n >= 4)
+    {
+        n -= 4;
+        *(mem_word_t *)(to + n) = *(const mem_word_t *)(from + n);
+    }
+    while (n--)
+    {
+        to[n] = from[n];
+    }
+    return dst;
+}
+
+int mem_compare(const void *a, const void *b, size_t n)
+{
+    const uint8_t *pa = a;
+    const uint8_t *pb = b;
+
+    while (n >= 4 && *(const mem_word_t *)pa == *(const mem_word_t *)pb)    /* Skip the equal words */
+    {
+        pa += 4;
+        pb += 4;
+        n -= 4;
+    }
+
+    for (; n > 0; n--, pa++, pb++)                              /* then find the first byte that differs */
+    {
+        if (*pa != *pb)
+        {
+            return (*pa < *pb) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+#ifndef HOSTED
+void *memcpy(void *restrict dst, const void *restrict src, size_t n)
+{
+    return erms ? mem_copy_movsb(dst, src, n) : mem_copy_movsd(dst, src, n);
+}
+
+void *memmove(void *dst, const void *src, size_t n)
+{
+    return mem_move(dst, src, n);
+}
+
+void *memset(void *dst, int c, size_t n)
+{
+    return erms ? mem_set_stosb(dst, c, n) : mem_set_stosd(dst, c, n);
+}
+
+int memcmp(const void *a, const void *b, size_t n)
+{
+    return mem_compare(a, b, n);
+}
+#endif
+
+static void copy_small(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    if (n >= 4)
+    {
+        /* Two overlapping words cover anything from 4 to 8 bytes, and the rest goes a word at a time */
+        for (; n > 8; n -= 4, dst += 4, src += 4)
+        {
+            *(mem_word_t *)dst = *(const mem_word_t *)src;
+        }
+        uint32_t head = *(const mem_word_t *)src;
+        uint32_t tail = *(const mem_word_t *)(src + n - 4);
+        *(mem_word_t *)dst = head;
+        *(mem_word_t *)(dst + n - 4) = tail;
+        return;
+    }
+
+    for (size_t ii = 0; ii < n; ii++)
+    {
+        dst[ii] = src[ii];
+    }
+}
+
+static void set_small(uint8_t *dst, uint8_t c, size_t n)
+{
+    for (size_t ii = 0; ii < n; ii++)
+    {
+        dst[ii] = c;
+    }
+}
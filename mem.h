@@ -0,0 +1,39 @@
+#ifndef _MEM_H_
+#define _MEM_H_ 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Below this many bytes a plain loop is quicker than starting up a rep instruction */
+#define MEM_SMALL (16)
+
+/*
+ * The kernel's memcpy, memmove, memset and memcmp, which GCC also calls by
+ * itself for things like copying large structures. memcpy and memset use
+ * rep movsb and rep stosb on cpus with ERMS (enhanced rep movsb), and rep
+ * movsd and rep stosd otherwise. The host build (HOSTED) leaves these to
+ * the C library and only has the mem_ functions, for the tests and
+ * benchmarks.
+ */
+void *memcpy(void *restrict dst, const void *restrict src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
+int memcmp(const void *a, const void *b, size_t n);
+
+/* Picks between the variants below from CPUID, once on the boot cpu. Until then the movsd ones are used */
+void mem_init(void);
+
+/* Returns true if memcpy and memset use rep movsb and rep stosb */
+bool mem_has_erms(void);
+
+/* The variants memcpy and memset choose from */
+void *mem_copy_movsd(void *restrict dst, const void *restrict src, size_t n);
+void *mem_copy_movsb(void *restrict dst, const void *restrict src, size_t n);
+void *mem_set_stosd(void *dst, int c, size_t n);
+void *mem_set_stosb(void *dst, int c, size_t n);
+
+/* memmove and memcmp, which don't have variants */
+void *mem_move(void *dst, const void *src, size_t n);
+int mem_compare(const void *a, const void *b, size_t n);
+#endif
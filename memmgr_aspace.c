@@ -0,0 +1,194 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include "util.h"
+#include "mem.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "kernel.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_dumb.h"
+#include "memmgr_slab.h"
+#include "memmgr_vma.h"
+#include "memmgr_aspace.h"
+
+#ifdef MEMMGR_PAE
+/* Directory pages of a space's own, the fourth is the kernel's */
+#define USER_DIRECTORY_PAGES (3)
+
+/* Most address spaces there can be at once, a page directory pointer table each */
+#define ASPACE_MAX (1024)
+
+/*
+ * A page directory pointer table has to be 32 byte aligned and below 4GB,
+ * so they are kept in the kernel image, where both are true.
+ */
+struct pdpt
+{
+    alignas(32) uint64_t entries[4];
+    struct pdpt *next_free;
+};
+typedef struct pdpt pdpt_t;
+
+static pdpt_t pdpts[ASPACE_MAX];
+static pdpt_t *free_pdpts = 0;
+static spinlock_t pdpt_lock;
+#else
+#define USER_DIRECTORY_PAGES (1)
+#endif
+
+static page_directory_t *kernel_space = 0;
+static memmgr_dumb_t *aspace_dumb = 0;
+
+/*
+ * Internal Function Declarations
+ */
+static page_table_t *alloc_table(void *data);
+#ifdef MEMMGR_PAE
+static pdpt_t *take_pdpt(void);
+static void give_pdpt(pdpt_t *pdpt);
+#endif
+
+
+void aspace_init(page_directory_t *kernel, memmgr_dumb_t *memmgr_dumb)
+{
+    kernel_space = kernel;
+    aspace_dumb = memmgr_dumb;
+
+#ifdef MEMMGR_PAE
+    pdpt_lock = SPINLOCK_INIT;
+    for (uintptr_t ii = 0; ii < ASPACE_MAX; ii++)
+    {
+        give_pdpt(&pdpts[ii]);
+    }
+#endif
+}
+
+page_directory_t *aspace_create(void)
+{
+    page_directory_t *space = kmalloc(sizeof(page_directory_t));
+    pde_t *entries = dumb_alloc(aspace_dumb, USER_DIRECTORY_PAGES * PAGE_SIZE);
+    if (!space || !entries)
+    {
+        if (entries)
+        {
+            dumb_free(aspace_dumb, entries, USER_DIRECTORY_PAGES * PAGE_SIZE);
+        }
+        kfree(space);
+        return 0;
+    }
+
+#ifdef MEMMGR_PAE
+    pdpt_t *pdpt = take_pdpt();
+    if (!pdpt)
+    {
+        dumb_free(aspace_dumb, entries, USER_DIRECTORY_PAGES * PAGE_SIZE);
+        kfree(space);
+        return 0;
+    }
+#endif
+
+    /* The kernel half of tables[] is never looked at, the kernel's is used instead */
+    for (uintptr_t ii = 0; ii < KERNEL_DIRECTORY_FIRST; ii++)
+    {
+        space->tables[ii] = 0;
+        entries[ii] = 0;
+    }
+
+#ifdef MEMMGR_PAE
+    for (uintptr_t ii = 0; ii < USER_DIRECTORY_PAGES; ii++)
+    {
+        pdpt->entries[ii] = memmgr_virtual_virt_to_phy(kernel_space, (uint8_t *)entries + ii * PAGE_SIZE) | PDE_PRESENT;
+    }
+    pdpt->entries[3] = memmgr_virtual_virt_to_phy(kernel_space, kernel_space->tablesPhysical + KERNEL_DIRECTORY_FIRST) | PDE_PRESENT;
+    space->physicalAddr = memmgr_virtual_virt_to_phy(kernel_space, pdpt);
+#else
+    for (uintptr_t ii = KERNEL_DIRECTORY_FIRST; ii < TABLES_PER_DIRECTORY; ii++)
+    {
+        entries[ii] = kernel_space->tablesPhysical[ii];     /* The tables themselves are shared */
+    }
+    space->physicalAddr = memmgr_virtual_virt_to_phy(kernel_space, entries);
+#endif
+
+    space->tablesPhysical = entries;
+    space->rmap = 0;                                        /* Only the kernel's is used */
+    space->rmap_n_frames = 0;
+    space->vmas = 0;
+    space->kernel_generation = 0;                           /* Copied again on the first switch if it changed since */
+    memmgr_virtual_set_table_alloc(space, &alloc_table, aspace_dumb);
+    return space;
+}
+
+page_directory_t *aspace_fork(page_directory_t *parent)
+{
+    page_directory_t *child = aspace_create();
+    if (child && !vma_copy(parent, child))
+    {
+        aspace_destroy(child);                              /* Drops whatever it did share */
+        return 0;
+    }
+    return child;
+}
+
+void aspace_destroy(page_directory_t *space)
+{
+    while (space->vmas)
+    {
+        vma_release(space, (void*)space->vmas->start);
+    }
+
+    /* Large pages have no table, the kernel half's tables are the kernel's */
+    for (uintptr_t ii = 0; ii < KERNEL_DIRECTORY_FIRST; ii++)
+    {
+        if (space->tables[ii])
+        {
+            dumb_free(aspace_dumb, space->tables[ii], sizeof(page_table_t));
+        }
+    }
+
+#ifdef MEMMGR_PAE
+    give_pdpt((pdpt_t *)(space->physicalAddr + (uintptr_t)&KERNEL_BASE));  /* In the kernel image */
+#endif
+    dumb_free(aspace_dumb, space->tablesPhysical, USER_DIRECTORY_PAGES * PAGE_SIZE);
+    kfree(space);
+}
+
+/* Gives get_page new user page tables from the dumb allocator, for aspace_destroy to free */
+static page_table_t *alloc_table(void *data)
+{
+    page_table_t *table = dumb_alloc((memmgr_dumb_t *)data, sizeof(page_table_t));
+    if (table)
+    {
+        memset(table, 0, sizeof(page_table_t));
+    }
+    return table;
+}
+
+#ifdef MEMMGR_PAE
+/* Returns an unused page directory pointer table, or null if there are none left */
+static pdpt_t *take_pdpt(void)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&pdpt_lock);
+    pdpt_t *pdpt = free_pdpts;
+    if (pdpt)
+    {
+        free_pdpts = pdpt->next_free;
+    }
+    spin_unlock(&pdpt_lock);
+    cpu_irq_restore(irq);
+    return pdpt;
+}
+
+static void give_pdpt(pdpt_t *pdpt)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&pdpt_lock);
+    pdpt->next_free = free_pdpts;
+    free_pdpts = pdpt;
+    spin_unlock(&pdpt_lock);
+    cpu_irq_restore(irq);
+}
+#endif
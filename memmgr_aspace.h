@@ -0,0 +1,38 @@
+#ifndef _MEMMGR_ASPACE_H_
+#define _MEMMGR_ASPACE_H_ 1
+
+#include <stdint.h>
+#include "memmgr_virtual.h"
+
+/*
+ * Address spaces are page directories with a user half of their own, below
+ * KERNEL_BASE, and the kernel's kernel half. With PAE the kernel's last page
+ * directory is shared by reference through the page directory pointer
+ * table, so nothing is copied. Without PAE both halves are in one page, so
+ * the kernel's entries are copied when the space is created, and any page
+ * table the kernel makes afterwards is copied over the first time it faults,
+ * see memmgr_virtual_sync_kernel.
+ *
+ * switch_page_directory loads one. Kernel pages are global, so they stay in
+ * the TLB across the switch.
+ */
+
+/* Creates address spaces sharing kernel's kernel half, taking their pages from memmgr_dumb. kmalloc must be ready */
+void aspace_init(page_directory_t *kernel, memmgr_dumb_t *memmgr_dumb);
+
+/* Returns a new address space with nothing in its user half, or null if out of memory */
+page_directory_t *aspace_create(void);
+
+/*
+ * Returns a new address space with the same memory areas as parent, whose
+ * pages are shared copy on write, see vma_copy. Null if out of memory.
+ */
+page_directory_t *aspace_fork(page_directory_t *parent);
+
+/*
+ * Releases the space's memory areas, with the frames faulted into them
+ * that nothing else shares, then its page tables and itself. No cpu may be
+ * using it, nor switch to it again.
+ */
+void aspace_destroy(page_directory_t *space);
+#endif
@@ -0,0 +1,171 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "memmgr_physical.h"
+#include "memmgr_buddy.h"
+
+/* Address of block n in the bitmap of its order */
+#define BLOCK_ADDR(n) ((phys_addr_t)(n) * PAGE_SIZE)
+
+/*
+ * Internal Function Declarations
+ */
+static uintptr_t order_of(uintptr_t count);
+static void release_block(memmgr_buddy_t *self, uintptr_t frame, uintptr_t order);
+static void free_block(memmgr_buddy_t *self, uintptr_t frame, uintptr_t order);
+static void free_range(memmgr_buddy_t *self, uintptr_t frame, uintptr_t count);
+
+
+void memmgr_buddy_init(memmgr_buddy_t *self, phys_addr_t highest_addr)
+{
+    self->n_frames = (highest_addr + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    for (uintptr_t ii = 0; ii <= MEMMGR_BUDDY_MAX_ORDER; ii++)
+    {
+        uintptr_t n_blocks = self->n_frames >> ii;              /* A partial block at the end is never used */
+        memmgr_physical_init(&self->orders[ii], BLOCK_ADDR(n_blocks));
+        self->n_free[ii] = 0;
+    }
+}
+
+uintptr_t memmgr_buddy_size(memmgr_buddy_t *self)
+{
+    uintptr_t size = 0;
+    for (uintptr_t ii = 0; ii <= MEMMGR_BUDDY_MAX_ORDER; ii++)
+    {
+        size += memmgr_physical_size(&self->orders[ii]);
+    }
+    return size;
+}
+
+void memmgr_buddy_set_bitmaps(memmgr_buddy_t *self, uint32_t *bitmaps)
+{
+    for (uintptr_t ii = 0; ii <= MEMMGR_BUDDY_MAX_ORDER; ii++)
+    {
+        memmgr_physical_t *order = &self->orders[ii];
+
+        memmgr_physical_set_frames(order, bitmaps);
+        memmgr_physical_set_range(order, 0, order->n_frames);   /* Nothing is free until seeded */
+
+        bitmaps += memmgr_physical_size(order) / sizeof(uint32_t);
+    }
+}
+
+void memmgr_buddy_seed(memmgr_buddy_t *self, memmgr_physical_t *bitmap, phys_addr_t start_addr, uintptr_t count)
+{
+    while (count > 0)
+    {
+        uintptr_t run = 0;
+        phys_addr_t addr = memmgr_physical_free_run(bitmap, start_addr, count, &run);
+        if (addr == MEMMGR_PHYSICAL_NONE)
+        {
+            return;                                             /* Nothing else free in the range */
+        }
+
+        free_range(self, addr / PAGE_SIZE, run);
+
+        uintptr_t consumed = (addr - start_addr) / PAGE_SIZE + run;
+        start_addr += (phys_addr_t)consumed * PAGE_SIZE;
+        count -= consumed;
+    }
+}
+
+phys_addr_t memmgr_buddy_alloc(memmgr_buddy_t *self, uintptr_t count, uintptr_t align)
+{
+    uintptr_t order = order_of(count);
+    uintptr_t search = order_of(align / PAGE_SIZE);             /* Blocks are aligned to their size */
+    if (search < order)
+    {
+        search = order;
+    }
+
+    /* Find the smallest order with a free block */
+    while (search <= MEMMGR_BUDDY_MAX_ORDER && self->n_free[search] == 0)
+    {
+        search++;
+    }
+
+    if (search > MEMMGR_BUDDY_MAX_ORDER)
+    {
+        return MEMMGR_PHYSICAL_NONE;
+    }
+
+    uintptr_t block = memmgr_physical_alloc(&self->orders[search], 1, 0) / PAGE_SIZE;
+    self->n_free[search]--;
+
+    /* Split the block, handing the upper halves back */
+    uintptr_t frame = block << search;
+    while (search > order)
+    {
+        search--;
+        release_block(self, frame + ((uintptr_t)1 << search), search);
+    }
+
+    return (phys_addr_t)frame * PAGE_SIZE;
+}
+
+void memmgr_buddy_free(memmgr_buddy_t *self, phys_addr_t addr, uintptr_t count)
+{
+    free_block(self, addr / PAGE_SIZE, order_of(count));
+}
+
+
+/* Returns the smallest order whose blocks hold count frames */
+static uintptr_t order_of(uintptr_t count)
+{
+    uintptr_t order = 0;
+    while (((uintptr_t)1 << order) < count)
+    {
+        order++;
+    }
+    return order;
+}
+
+/* Marks a block as free without trying to merge it */
+static void release_block(memmgr_buddy_t *self, uintptr_t frame, uintptr_t order)
+{
+    memmgr_physical_free(&self->orders[order], BLOCK_ADDR(frame >> order), 1);
+    self->n_free[order]++;
+}
+
+/* Frees a block, merging it with its buddy for as long as the buddy is free too */
+static void free_block(memmgr_buddy_t *self, uintptr_t frame, uintptr_t order)
+{
+    while (order < MEMMGR_BUDDY_MAX_ORDER)
+    {
+        memmgr_physical_t *bitmap = &self->orders[order];
+        uintptr_t buddy = (frame >> order) ^ 1;
+
+        if (memmgr_physical_test(bitmap, BLOCK_ADDR(buddy)))
+        {
+            break;                                              /* Buddy is in use, or doesn't exist */
+        }
+
+        memmgr_physical_set_range(bitmap, BLOCK_ADDR(buddy), 1);    /* Take the buddy off the free list */
+        self->n_free[order]--;
+
+        frame &= ~(((uintptr_t)2 << order) - 1);                /* The merged block starts at the lower half */
+        order++;
+    }
+
+    release_block(self, frame, order);
+}
+
+/* Frees count frames starting at frame, as the largest aligned blocks that fit */
+static void free_range(memmgr_buddy_t *self, uintptr_t frame, uintptr_t count)
+{
+    while (count > 0)
+    {
+        uintptr_t order = 0;
+        while (order < MEMMGR_BUDDY_MAX_ORDER
+               && (frame & (((uintptr_t)2 << order) - 1)) == 0
+               && ((uintptr_t)2 << order) <= count)
+        {
+            order++;
+        }
+
+        free_block(self, frame, order);
+        frame += (uintptr_t)1 << order;
+        count -= (uintptr_t)1 << order;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef _MEMMGR_BUDDY_H_
+#define _MEMMGR_BUDDY_H_ 1
+
+#include <stdint.h>
+#include "memmgr_physical.h"
+
+/* Largest block handed out is 2^MEMMGR_BUDDY_MAX_ORDER frames (4MB) */
+#define MEMMGR_BUDDY_MAX_ORDER (10)
+
+/*
+ * Buddy allocator for physical frames.  Rather than free lists, which would
+ * need the free frames themselves to be mapped, each order keeps a
+ * memmgr_physical_t whose "frames" are the blocks of that order.  A block is
+ * free when its bit is clear, and the summary bitmap finds one quickly.
+ */
+struct memmgr_buddy
+{
+    memmgr_physical_t orders[MEMMGR_BUDDY_MAX_ORDER + 1];   /* Free blocks of each order */
+    uintptr_t n_free[MEMMGR_BUDDY_MAX_ORDER + 1];           /* Number of free blocks of each order */
+    uintptr_t n_frames;
+};
+typedef struct memmgr_buddy memmgr_buddy_t;
+
+void memmgr_buddy_init(memmgr_buddy_t *self, phys_addr_t highest_addr);
+
+/* Returns the number of bytes required for the bitmaps of every order */
+uintptr_t memmgr_buddy_size(memmgr_buddy_t *self);
+
+/* Set the position of the bitmaps and initialize them with no free blocks */
+void memmgr_buddy_set_bitmaps(memmgr_buddy_t *self, uint32_t *bitmaps);
+
+/* Frees every frame among the count frames from start_addr that bitmap says is not in use */
+void memmgr_buddy_seed(memmgr_buddy_t *self, memmgr_physical_t *bitmap, phys_addr_t start_addr, uintptr_t count);
+
+/*
+ * Allocates a block big enough for count frames, aligned to align bytes, and
+ * returns its physical address, or MEMMGR_PHYSICAL_NONE.
+ */
+phys_addr_t memmgr_buddy_alloc(memmgr_buddy_t *self, uintptr_t count, uintptr_t align);
+
+/* Frees a block returned by memmgr_buddy_alloc for count frames, merging it with its buddies */
+void memmgr_buddy_free(memmgr_buddy_t *self, phys_addr_t addr, uintptr_t count);
+#endif
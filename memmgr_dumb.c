@@ -1,60 +1,132 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include "cpu.h"
 #include "memmgr_physical.h"
 #include "memmgr_virtual.h"
+#include "memmgr_frame.h"
+#include "memmgr_frame_cache.h"
 #include "memmgr_dumb.h"
 #include "util.h"
 
-static uintptr_t advance_free_page(memmgr_dumb_t *memmgr_dumb, uintptr_t n_pages);
-static uintptr_t get_frame(memmgr_dumb_t *memmgr_dumb);
-static void map_frame_to_page(memmgr_dumb_t *memmgr_dumb, uintptr_t page);
+static uintptr_t advance_free_page(memmgr_dumb_t *memmgr_dumb, uintptr_t n_pages, uintptr_t align);
+static phys_addr_t get_frame(memmgr_dumb_t *memmgr_dumb);
+static bool map_frame_to_page(memmgr_dumb_t *memmgr_dumb, uintptr_t page);
+static void free_locked(memmgr_dumb_t *memmgr_dumb, void *addr, uintptr_t size);
 
 /* Very stupid allocator for allocating structures used in the smarter allocators */
 
 void dumb_init(memmgr_dumb_t *memmgr_dumb, page_directory_t *page_directory)
 {
     memmgr_dumb->page_directory = page_directory;
+    memmgr_dumb->frame_cache = 0;
+    memmgr_dumb->frame_used = 0;
+    memmgr_dumb->allocated_frames = 0;
+    memmgr_dumb->lock = SPINLOCK_INIT;
 
     /* Find the first free page after the kernel */
     memmgr_dumb->next_free_page = (uintptr_t)&KERNEL_BASE / PAGE_SIZE;
-    advance_free_page(memmgr_dumb, 1);
+    advance_free_page(memmgr_dumb, 1, 1);
 
     /* Find the first free frame after the end of the kernel */
     memmgr_dumb->next_free_frame = idivc((uintptr_t)&_end_pa, PAGE_SIZE);
 }
 
+void dumb_set_frame_used(memmgr_dumb_t *memmgr_dumb, dumb_frame_used_cb *frame_used)
+{
+    memmgr_dumb->frame_used = frame_used;
+}
+
+void dumb_set_frames(memmgr_dumb_t *memmgr_dumb, memmgr_frame_cache_t *frame_cache)
+{
+    memmgr_dumb->frame_cache = frame_cache;
+}
+
 void *dumb_alloc(memmgr_dumb_t *memmgr_dumb, uintptr_t size)
+{
+    return dumb_alloc_aligned(memmgr_dumb, size, PAGE_SIZE);
+}
+
+void *dumb_alloc_aligned(memmgr_dumb_t *memmgr_dumb, uintptr_t size, uintptr_t align)
 {
     uintptr_t n_pages = idivc(size, PAGE_SIZE);
-    uintptr_t free_page = advance_free_page(memmgr_dumb, n_pages);
+    uintptr_t align_pages = (align > PAGE_SIZE) ? align / PAGE_SIZE : 1;
+    void *result = (void*)0;
 
-    if (free_page == -1u)
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&memmgr_dumb->lock);
+
+    uintptr_t free_page = advance_free_page(memmgr_dumb, n_pages, align_pages);
+    if (free_page != -1u)
     {
-        /* Couldn't allocate that much memory! */
-        return (void*)0;
+        result = (void*)(free_page * PAGE_SIZE);
+
+        for (uintptr_t ii = 0; ii < n_pages; ii++)
+        {
+            if (!map_frame_to_page(memmgr_dumb, free_page + ii))
+            {
+                /* Out of physical memory, give back what we did get */
+                free_locked(memmgr_dumb, result, ii * PAGE_SIZE);
+                result = (void*)0;
+                break;
+            }
+        }
     }
 
-    uintptr_t page_num = free_page;
-    for (uintptr_t ii = 0; ii < n_pages; ii++)
+    spin_unlock(&memmgr_dumb->lock);
+    cpu_irq_restore(flags);
+
+    /* The pages weren't present before, and the TLB never caches those, so there's nothing to flush */
+
+    return result;
+}
+
+void dumb_free(memmgr_dumb_t *memmgr_dumb, void *addr, uintptr_t size)
+{
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&memmgr_dumb->lock);
+    free_locked(memmgr_dumb, addr, size);
+    spin_unlock(&memmgr_dumb->lock);
+    cpu_irq_restore(flags);
+}
+
+/* dumb_free, with the lock held */
+static void free_locked(memmgr_dumb_t *memmgr_dumb, void *addr, uintptr_t size)
+{
+    uintptr_t first_page = (uintptr_t)addr / PAGE_SIZE;
+    uintptr_t n_pages = idivc(size, PAGE_SIZE);
+    page_directory_t *pg_dir = memmgr_dumb->page_directory;
+
+    /* The TLB has to forget the pages before their frames can be reused */
+    tlb_gather_t gather;
+    memmgr_virtual_gather_init(&gather);
+    memmgr_virtual_unmap_range(pg_dir, addr, n_pages, &gather);
+    memmgr_virtual_gather_commit(&gather);
+
+    for (uintptr_t page = first_page; page < first_page + n_pages; page++)
     {
-        map_frame_to_page(memmgr_dumb, page_num);
-        page_num += 1;
+        page_t *pg = &pg_dir->tables[page / PAGES_PER_TABLE]->pages[page % PAGES_PER_TABLE];
+        memmgr_frame_cache_free(memmgr_dumb->frame_cache, memmgr_virtual_page_addr(pg));
+        memmgr_dumb->allocated_frames--;
     }
 
-    /* TODO: Only invalidate the needed entries */
-    memmgr_virtual_flush_tlb();
-
-    return (void*)(free_page * PAGE_SIZE);
+    if (n_pages > 0 && first_page < memmgr_dumb->next_free_page)
+    {
+        memmgr_dumb->next_free_page = first_page;                /* Search from the hole next time */
+    }
 }
 
 /* Finds a free frame and maps it to the specified page number */
-static void map_frame_to_page(memmgr_dumb_t *memmgr_dumb, uintptr_t page)
+static bool map_frame_to_page(memmgr_dumb_t *memmgr_dumb, uintptr_t page)
 {
-    uintptr_t o_dir = page / 1024;                              /* Offset into page directory */
-    uintptr_t o_tbl = page % 1024;                              /* Offset into page table */
+    uintptr_t o_dir = page / PAGES_PER_TABLE;                   /* Offset into page directory */
+    uintptr_t o_tbl = page % PAGES_PER_TABLE;                   /* Offset into page table */
 
     /* Find and take a free frame */
-    uintptr_t frame_addr = get_frame(memmgr_dumb);
+    phys_addr_t frame_addr = get_frame(memmgr_dumb);
+    if (frame_addr == MEMMGR_PHYSICAL_NONE)
+    {
+        return false;
+    }
 
     /* Create the mapping! */
     page_directory_t *pg_dir = memmgr_dumb->page_directory;
@@ -62,19 +134,41 @@ static void map_frame_to_page(memmgr_dumb_t *memmgr_dumb, uintptr_t page)
     page_t *pg = &pg_tbl->pages[o_tbl];
 
     memmgr_virtual_map_page(pg, frame_addr, true, true);
+    memmgr_virtual_rmap_add(pg_dir, frame_addr, (void*)(page * PAGE_SIZE));
+    return true;
 }
 
 /* Finds a frame, marks it used, and returns its physical address */
-static uintptr_t get_frame(memmgr_dumb_t *memmgr_dumb)
+static phys_addr_t get_frame(memmgr_dumb_t *memmgr_dumb)
 {
-    uintptr_t frame_addr = memmgr_dumb->next_free_frame * PAGE_SIZE;
-    memmgr_dumb->next_free_frame++;
+    phys_addr_t frame_addr;
+
+    if (memmgr_dumb->frame_cache)
+    {
+        frame_addr = memmgr_frame_cache_alloc(memmgr_dumb->frame_cache);
+        if (frame_addr == MEMMGR_PHYSICAL_NONE)
+        {
+            return MEMMGR_PHYSICAL_NONE;
+        }
+    }
+    else
+    {
+        /* Too early for the frame allocator, take the frames just after the kernel */
+        while (memmgr_dumb->frame_used
+               && memmgr_dumb->frame_used((phys_addr_t)memmgr_dumb->next_free_frame * PAGE_SIZE))
+        {
+            memmgr_dumb->next_free_frame++;
+        }
+        frame_addr = (phys_addr_t)memmgr_dumb->next_free_frame * PAGE_SIZE;
+        memmgr_dumb->next_free_frame++;
+    }
+
     memmgr_dumb->allocated_frames++;
     return frame_addr;
 }
 
-/* Finds a block of contiguous virtual memory with at least n_pages of free pages */
-static uintptr_t advance_free_page(memmgr_dumb_t *memmgr_dumb, uintptr_t n_pages)
+/* Finds a block of contiguous virtual memory with at least n_pages of free pages, starting on a multiple of align pages */
+static uintptr_t advance_free_page(memmgr_dumb_t *memmgr_dumb, uintptr_t n_pages, uintptr_t align)
 {
     uintptr_t position = memmgr_dumb->next_free_page;
     page_directory_t *pg_dir = memmgr_dumb->page_directory;
@@ -87,15 +181,20 @@ static uintptr_t advance_free_page(memmgr_dumb_t *memmgr_dumb, uintptr_t n_pages
 
     do
     {
-        uintptr_t o_dir = position / 1024;                      /* Offset into page directory */
-        uintptr_t o_tbl = position % 1024;                      /* Offset into page table */
+        uintptr_t o_dir = position / PAGES_PER_TABLE;           /* Offset into page directory */
+        uintptr_t o_tbl = position % PAGES_PER_TABLE;           /* Offset into page table */
         uintptr_t advance = 1;                                  /* How much to advance the search */
 
-        if ((pg_dir->tablesPhysical[o_dir]&1) == 0)             /* Test for present bit */
+        if (count == 0 && position % align != 0)                /* Blocks have to start aligned */
+        {
+            advance = align - position % align;                 /* so skip to the next boundary */
+        }
+        else if ((pg_dir->tablesPhysical[o_dir]&1) == 0         /* Test for present bit, */
+                 || (pg_dir->tablesPhysical[o_dir]&PDE_LARGE))  /* and for large pages with no table */
         {
             count = 0;                                          /* Since we don't want to write new */
             start = -1;                                         /* page tables, reset, and */
-            advance = 1024;                                     /* skip to the next entry */
+            advance = PAGES_PER_TABLE - o_tbl;                  /* skip to the next entry */
         }
         else if (pg_dir->tables[o_dir]->pages[o_tbl].present == 0)
         {
@@ -120,7 +219,7 @@ static uintptr_t advance_free_page(memmgr_dumb_t *memmgr_dumb, uintptr_t n_pages
 
         position += advance;
     }
-    while (position > (uintptr_t)&KERNEL_BASE / PAGE_SIZE);     /* uint will wrap according to spec */
+    while (position < DUMB_END / PAGE_SIZE);                    /* Stop below the direct map */
 
     if (result == -1u)
     {
@@ -1,15 +1,43 @@
 #ifndef _MEMMGR_DUMB_H_
 #define _MEMMGR_DUMB_H_ 1
 
+#include "spinlock.h"
+
+/* Returns true if the frame at frame_addr holds something already, so it can't be taken */
+typedef bool (dumb_frame_used_cb)(phys_addr_t frame_addr);
+
+/*
+ * The dumb allocator only uses pages below this. The page tables above it
+ * belong to the direct map, the areas vma_reserve hands out and bootinfo's
+ * window, and the pages missing from those aren't free, they are filled in
+ * on demand.
+ */
+#define DUMB_END (DIRECT_MAP_BASE)
+
 struct memmgr_dumb
 {
     page_directory_t *page_directory;
+    memmgr_frame_cache_t *frame_cache;              /* Where frames come from, once it is ready */
+    dumb_frame_used_cb *frame_used;                 /* Frames after the kernel to skip, until then */
     uintptr_t next_free_frame;
     uintptr_t next_free_page;
     uintptr_t allocated_frames;
+    spinlock_t lock;                                /* Every cpu shares it, and so do slab and the page tables */
 };
 typedef struct memmgr_dumb memmgr_dumb_t;
 
 void dumb_init(memmgr_dumb_t *memmgr_dumb, page_directory_t *page_directory);
 void *dumb_alloc(memmgr_dumb_t *memmgr_dumb, uintptr_t size);
+
+/* Like dumb_alloc, but the returned address is a multiple of align */
+void *dumb_alloc_aligned(memmgr_dumb_t *memmgr_dumb, uintptr_t size, uintptr_t align);
+
+/* Unmaps pages returned by dumb_alloc and hands their frames back, only once dumb_set_frames has been called */
+void dumb_free(memmgr_dumb_t *memmgr_dumb, void *addr, uintptr_t size);
+
+/* Skip the frames after the kernel frame_used says are in use, like what the bootloader left there */
+void dumb_set_frame_used(memmgr_dumb_t *memmgr_dumb, dumb_frame_used_cb *frame_used);
+
+/* Take frames from frame_cache from now on, instead of just after the kernel */
+void dumb_set_frames(memmgr_dumb_t *memmgr_dumb, memmgr_frame_cache_t *frame_cache);
 #endif
@@ -0,0 +1,38 @@
+#ifndef _MEMMGR_FRAME_H_
+#define _MEMMGR_FRAME_H_ 1
+
+#include <stdint.h>
+#include "memmgr_physical.h"
+#include "memmgr_buddy.h"
+
+/*
+ * The allocator that everything else takes physical frames from.  Building
+ * with MEMMGR_BUDDY defined (make FRAME_ALLOCATOR=buddy) selects the buddy
+ * allocator, otherwise frames come straight from the frame bitmap.
+ */
+#ifdef MEMMGR_BUDDY
+typedef memmgr_buddy_t memmgr_frame_t;
+#else
+typedef memmgr_physical_t memmgr_frame_t;
+#endif
+
+/* Allocates count contiguous frames aligned to align bytes, or returns MEMMGR_PHYSICAL_NONE */
+static inline phys_addr_t memmgr_frame_alloc(memmgr_frame_t *self, uintptr_t count, uintptr_t align)
+{
+#ifdef MEMMGR_BUDDY
+    return memmgr_buddy_alloc(self, count, align);
+#else
+    return memmgr_physical_alloc(self, count, align);
+#endif
+}
+
+/* Frees count frames previously returned by memmgr_frame_alloc */
+static inline void memmgr_frame_free(memmgr_frame_t *self, phys_addr_t addr, uintptr_t count)
+{
+#ifdef MEMMGR_BUDDY
+    memmgr_buddy_free(self, addr, count);
+#else
+    memmgr_physical_free(self, addr, count);
+#endif
+}
+#endif
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "memmgr_frame.h"
+#include "memmgr_frame_cache.h"
+
+/*
+ * Internal Function Declarations
+ */
+static phys_addr_t alloc(memmgr_frame_cache_t *self, bool reclaim);
+static void refill(memmgr_frame_cache_t *self, memmgr_frame_magazine_t *mag);
+static void drain(memmgr_frame_cache_t *self, memmgr_frame_magazine_t *mag, uintptr_t count);
+
+
+void memmgr_frame_cache_init(memmgr_frame_cache_t *self, memmgr_frame_t *memmgr_frames, uintptr_t depth)
+{
+    if (depth > MEMMGR_FRAME_CACHE_MAX_DEPTH)
+    {
+        depth = MEMMGR_FRAME_CACHE_MAX_DEPTH;
+    }
+
+    self->memmgr_frames = memmgr_frames;
+    self->lock = SPINLOCK_INIT;
+    self->depth = depth;
+    self->batch = (depth > 1) ? depth / 2 : depth;
+    self->reclaim = 0;
+
+    for (uintptr_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        memmgr_frame_magazine_t *mag = &self->cpus[ii];
+        mag->count = 0;
+        mag->stats = (memmgr_frame_cache_stats_t){ 0 };
+    }
+}
+
+void memmgr_frame_cache_set_reclaim(memmgr_frame_cache_t *self, memmgr_frame_reclaim_cb *reclaim)
+{
+    self->reclaim = reclaim;
+}
+
+phys_addr_t memmgr_frame_cache_alloc(memmgr_frame_cache_t *self)
+{
+    return alloc(self, true);
+}
+
+phys_addr_t memmgr_frame_cache_alloc_free(memmgr_frame_cache_t *self)
+{
+    return alloc(self, false);
+}
+
+void memmgr_frame_cache_free(memmgr_frame_cache_t *self, phys_addr_t addr)
+{
+    uint32_t flags = cpu_irq_save();                            /* Stay on this CPU */
+    memmgr_frame_magazine_t *mag = &self->cpus[cpu_id()];
+
+    if (mag->count < self->depth)
+    {
+        mag->stats.free_hits++;
+    }
+    else
+    {
+        mag->stats.free_misses++;
+        drain(self, mag, self->batch);
+    }
+
+    if (mag->count < self->depth)
+    {
+        mag->frames[mag->count++] = addr;
+    }
+    else
+    {
+        /* A cache with no depth, straight back to the global allocator */
+        spin_lock(&self->lock);
+        memmgr_frame_free(self->memmgr_frames, addr, 1);
+        spin_unlock(&self->lock);
+    }
+
+    cpu_irq_restore(flags);
+}
+
+phys_addr_t memmgr_frame_cache_alloc_run(memmgr_frame_cache_t *self, uintptr_t count, uintptr_t align)
+{
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&self->lock);
+    phys_addr_t frame_addr = memmgr_frame_alloc(self->memmgr_frames, count, align);
+    spin_unlock(&self->lock);
+    cpu_irq_restore(flags);
+    return frame_addr;
+}
+
+void memmgr_frame_cache_free_run(memmgr_frame_cache_t *self, phys_addr_t addr, uintptr_t count)
+{
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&self->lock);
+    memmgr_frame_free(self->memmgr_frames, addr, count);
+    spin_unlock(&self->lock);
+    cpu_irq_restore(flags);
+}
+
+void memmgr_frame_cache_drain_all(memmgr_frame_cache_t *self)
+{
+    uint32_t flags = cpu_irq_save();
+    for (uintptr_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        drain(self, &self->cpus[ii], self->cpus[ii].count);
+    }
+    cpu_irq_restore(flags);
+}
+
+void memmgr_frame_cache_stats(memmgr_frame_cache_t *self, memmgr_frame_cache_stats_t *stats)
+{
+    *stats = (memmgr_frame_cache_stats_t){ 0 };
+    for (uintptr_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        memmgr_frame_cache_stats_t *cpu = &self->cpus[ii].stats;
+        stats->alloc_hits += cpu->alloc_hits;
+        stats->alloc_misses += cpu->alloc_misses;
+        stats->free_hits += cpu->free_hits;
+        stats->free_misses += cpu->free_misses;
+        stats->refills += cpu->refills;
+        stats->drains += cpu->drains;
+    }
+}
+
+/* Takes a frame from this CPU's magazine, refilling it first if it is empty */
+static phys_addr_t alloc(memmgr_frame_cache_t *self, bool reclaim)
+{
+    uint32_t flags = cpu_irq_save();                            /* Stay on this CPU */
+    memmgr_frame_magazine_t *mag = &self->cpus[cpu_id()];
+    phys_addr_t frame_addr = MEMMGR_PHYSICAL_NONE;
+
+    if (mag->count > 0)
+    {
+        mag->stats.alloc_hits++;
+    }
+    else
+    {
+        mag->stats.alloc_misses++;
+        refill(self, mag);
+    }
+
+    if (mag->count > 0)
+    {
+        frame_addr = mag->frames[--mag->count];
+    }
+    else if (reclaim && self->reclaim)
+    {
+        frame_addr = self->reclaim();                           /* Nothing free, but maybe held on to */
+    }
+
+    cpu_irq_restore(flags);
+    return frame_addr;
+}
+
+/* Takes a batch of frames from the global allocator into an empty magazine */
+static void refill(memmgr_frame_cache_t *self, memmgr_frame_magazine_t *mag)
+{
+    spin_lock(&self->lock);
+    while (mag->count < self->batch)
+    {
+        phys_addr_t frame_addr = memmgr_frame_alloc(self->memmgr_frames, 1, 0);
+        if (frame_addr == MEMMGR_PHYSICAL_NONE)
+        {
+            break;                                              /* Out of memory, make do with what we got */
+        }
+        mag->frames[mag->count++] = frame_addr;
+    }
+    spin_unlock(&self->lock);
+
+    mag->stats.refills++;
+}
+
+/* Gives count frames from a magazine back to the global allocator */
+static void drain(memmgr_frame_cache_t *self, memmgr_frame_magazine_t *mag, uintptr_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    spin_lock(&self->lock);
+    for (uintptr_t ii = 0; ii < count; ii++)
+    {
+        memmgr_frame_free(self->memmgr_frames, mag->frames[--mag->count], 1);
+    }
+    spin_unlock(&self->lock);
+
+    mag->stats.drains++;
+}
@@ -0,0 +1,85 @@
+#ifndef _MEMMGR_FRAME_CACHE_H_
+#define _MEMMGR_FRAME_CACHE_H_ 1
+
+#include <stdint.h>
+#include <stdalign.h>
+#include "cpu.h"
+#include "spinlock.h"
+#include "memmgr_frame.h"
+
+/* Most frames a CPU can keep in its cache */
+#define MEMMGR_FRAME_CACHE_MAX_DEPTH (64)
+
+/* Counters for a CPU's cache, or for all of them added together */
+struct memmgr_frame_cache_stats
+{
+    uint32_t alloc_hits;        /* Allocations served from the cache */
+    uint32_t alloc_misses;      /* Allocations that found the cache empty */
+    uint32_t free_hits;         /* Frees that went into the cache */
+    uint32_t free_misses;       /* Frees that found the cache full */
+    uint32_t refills;           /* Batches taken from the global allocator */
+    uint32_t drains;            /* Batches given back to the global allocator */
+};
+typedef struct memmgr_frame_cache_stats memmgr_frame_cache_stats_t;
+
+/*
+ * Gives back a frame held somewhere other than the global allocator, for
+ * when it has run out, or returns MEMMGR_PHYSICAL_NONE. Called with
+ * interrupts disabled.
+ */
+typedef phys_addr_t (memmgr_frame_reclaim_cb)(void);
+
+/* A CPU's stack of free frames, only ever touched by that CPU */
+struct memmgr_frame_magazine
+{
+    alignas(CACHE_LINE_SIZE) uintptr_t count;
+    phys_addr_t frames[MEMMGR_FRAME_CACHE_MAX_DEPTH];
+    memmgr_frame_cache_stats_t stats;
+};
+typedef struct memmgr_frame_magazine memmgr_frame_magazine_t;
+
+/*
+ * Per-CPU caches of free frames in front of the global frame allocator.
+ * Single frame allocations and frees only touch the current CPU's magazine,
+ * which is refilled or drained by half its depth at a time under the global
+ * lock.  Everything else that wants frames from the global allocator must go
+ * through here as well, so that it is done under the same lock.
+ */
+struct memmgr_frame_cache
+{
+    memmgr_frame_t *memmgr_frames;                  /* The global allocator */
+    spinlock_t lock;                                /* Protects memmgr_frames */
+    uintptr_t depth;                                /* Frames each magazine can hold */
+    uintptr_t batch;                                /* Frames moved per refill or drain */
+    memmgr_frame_reclaim_cb *reclaim;               /* Where to look once the global allocator is empty */
+    memmgr_frame_magazine_t cpus[MAX_CPUS];
+};
+typedef struct memmgr_frame_cache memmgr_frame_cache_t;
+
+/* Sets up empty caches of up to depth frames per CPU in front of memmgr_frames */
+void memmgr_frame_cache_init(memmgr_frame_cache_t *self, memmgr_frame_t *memmgr_frames, uintptr_t depth);
+
+/* Sets what memmgr_frame_cache_alloc falls back to once there are no free frames */
+void memmgr_frame_cache_set_reclaim(memmgr_frame_cache_t *self, memmgr_frame_reclaim_cb *reclaim);
+
+/* Allocates a single frame, returns its physical address or MEMMGR_PHYSICAL_NONE */
+phys_addr_t memmgr_frame_cache_alloc(memmgr_frame_cache_t *self);
+
+/* Same as memmgr_frame_cache_alloc, but only takes free frames, never reclaimed ones */
+phys_addr_t memmgr_frame_cache_alloc_free(memmgr_frame_cache_t *self);
+
+/* Frees a single frame */
+void memmgr_frame_cache_free(memmgr_frame_cache_t *self, phys_addr_t addr);
+
+/* Allocates contiguous frames directly from the global allocator, see memmgr_frame_alloc */
+phys_addr_t memmgr_frame_cache_alloc_run(memmgr_frame_cache_t *self, uintptr_t count, uintptr_t align);
+
+/* Frees contiguous frames directly to the global allocator */
+void memmgr_frame_cache_free_run(memmgr_frame_cache_t *self, phys_addr_t addr, uintptr_t count);
+
+/* Returns every cached frame to the global allocator, the other CPUs must not be using their caches */
+void memmgr_frame_cache_drain_all(memmgr_frame_cache_t *self);
+
+/* Adds up the counters of every CPU's cache into stats */
+void memmgr_frame_cache_stats(memmgr_frame_cache_t *self, memmgr_frame_cache_stats_t *stats);
+#endif
@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include "util.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_info.h"
+
+static memmgr_frame_info_t *frame_infos = 0;
+static uintptr_t n_frame_infos = 0;
+
+_Static_assert(sizeof(memmgr_frame_info_t) == 16, "four descriptors to a cache line");
+
+uintptr_t memmgr_frame_info_size(uintptr_t n_frames)
+{
+    return n_frames * sizeof(memmgr_frame_info_t);
+}
+
+void memmgr_frame_info_init(memmgr_frame_info_t *infos, uintptr_t n_frames)
+{
+    for (uintptr_t ii = 0; ii < n_frames; ii++)
+    {
+        infos[ii].shares = 0;
+        infos[ii].flags = 0;
+        infos[ii].owner = 0;
+        infos[ii].lru_prev = MEMMGR_FRAME_NONE;
+        infos[ii].lru_next = MEMMGR_FRAME_NONE;
+    }
+
+    frame_infos = infos;
+    n_frame_infos = n_frames;
+}
+
+memmgr_frame_info_t *memmgr_frame_info(phys_addr_t addr)
+{
+    phys_addr_t frame = addr / PAGE_SIZE;
+    return (frame < n_frame_infos) ? &frame_infos[frame] : 0;
+}
@@ -0,0 +1,40 @@
+#ifndef _MEMMGR_FRAME_INFO_H_
+#define _MEMMGR_FRAME_INFO_H_ 1
+
+#include <stdint.h>
+#include "memmgr_virtual.h"
+
+/* Flags for a frame */
+#define MEMMGR_FRAME_ZEROED (0x1)       /* Holds nothing but zeros */
+
+/* Frame number for the end of an LRU list */
+#define MEMMGR_FRAME_NONE (0xFFFFFFFFu)
+
+/* Frames above the first 4GB, which only PAE can reach, have no descriptor */
+#define MEMMGR_FRAME_INFO_MAX_FRAMES (0x100000u)
+
+/*
+ * What the kernel knows about a frame besides whether it is free, one for
+ * every frame in an array indexed by frame number. The fields looked at on
+ * every fault come first, so that four descriptors share a cache line and
+ * the ones a fault needs are in the same 8 bytes.
+ */
+struct memmgr_frame_info
+{
+    uint16_t shares;                    /* Other mappings besides the first, for copy on write */
+    uint16_t flags;
+    struct page_directory *owner;       /* The address space it was faulted into, or null */
+    uint32_t lru_prev;                  /* Frame numbers of its neighbours on an LRU list, or MEMMGR_FRAME_NONE */
+    uint32_t lru_next;
+};
+typedef struct memmgr_frame_info memmgr_frame_info_t;
+
+/* Bytes of descriptors for n_frames frames */
+uintptr_t memmgr_frame_info_size(uintptr_t n_frames);
+
+/* Starts using infos, memmgr_frame_info_size(n_frames) bytes, as the descriptors of the first n_frames frames */
+void memmgr_frame_info_init(memmgr_frame_info_t *infos, uintptr_t n_frames);
+
+/* Returns the descriptor of the frame containing addr, or null if it has none */
+memmgr_frame_info_t *memmgr_frame_info(phys_addr_t addr);
+#endif
@@ -1,39 +1,75 @@
 #include <stdint.h>
+#include <stdbool.h>
 #include "util.h"
+#include "mem.h"
 #include "memmgr_virtual.h"
 #include "memmgr_physical.h"
 
-#define INDEX_FROM_BIT(a) (a/(8*4))
-#define OFFSET_FROM_BIT(a) (a%(8*4))
+#define BITS_PER_WORD (32)
+#define FULL_WORD (0xFFFFFFFFu)
+#define NO_FRAME ((uintptr_t)~0)
+
+#define INDEX_FROM_BIT(a) ((a)/BITS_PER_WORD)
+#define OFFSET_FROM_BIT(a) ((a)%BITS_PER_WORD)
 
 
 /*
  * Internal Function Declarations
  */
-static void set_frame(memmgr_physical_t *self, uintptr_t frame_addr);
-static void clear_frame(memmgr_physical_t *self, uintptr_t frame_addr);
-static uint32_t test_frame(memmgr_physical_t *self, uintptr_t frame_addr);
-static uint32_t first_frame(memmgr_physical_t *self);
+static void set_frame(memmgr_physical_t *self, phys_addr_t frame_addr);
+
+static void set_bits(memmgr_physical_t *self, uintptr_t level, uintptr_t first, uintptr_t last);
+static void clear_bits(memmgr_physical_t *self, uintptr_t level, uintptr_t first, uintptr_t last);
+static uintptr_t find_free(memmgr_physical_t *self, uintptr_t frame);
+static uintptr_t find_used(memmgr_physical_t *self, uintptr_t frame, uintptr_t last);
+static uintptr_t find_run(memmgr_physical_t *self, uintptr_t frame, uintptr_t count, uintptr_t align);
 
 
-void memmgr_physical_init(memmgr_physical_t *self, uintptr_t highest_addr)
+void memmgr_physical_init(memmgr_physical_t *self, phys_addr_t highest_addr)
 {
-    self->n_frames = idivc(highest_addr, PAGE_SIZE);
+    self->n_frames = (highest_addr + PAGE_SIZE - 1) / PAGE_SIZE;   /* idivc would truncate a PAE address */
+
+    /* Add summary levels until a single word describes the whole level below */
+    uintptr_t n_bits = self->n_frames;
+    self->n_levels = 0;
+    do
+    {
+        n_bits = idivc(n_bits, BITS_PER_WORD);
+        self->n_words[self->n_levels++] = n_bits;
+    }
+    while (n_bits > 1 && self->n_levels < MEMMGR_PHYSICAL_LEVELS);
 }
 
 uintptr_t memmgr_physical_size(memmgr_physical_t *self)
 {
-    return idivc(self->n_frames, sizeof(uint32_t)) * sizeof(uint32_t);
+    uintptr_t n_words = 0;
+    for (uintptr_t ii = 0; ii < self->n_levels; ii++)
+    {
+        n_words += self->n_words[ii];
+    }
+    return n_words * sizeof(uint32_t);
 }
 
 void memmgr_physical_set_frames(memmgr_physical_t *self, uint32_t *frames)
 {
-    self->frames = frames;
+    uintptr_t n_bits = self->n_frames;
+    self->next_fit = 0;
 
-    /* Zero the memory */
-    for (uintptr_t ii = 0; ii < idivc(self->n_frames, sizeof(uint32_t)); ii++)
+    for (uintptr_t ii = 0; ii < self->n_levels; ii++)
     {
-        frames[ii] = 0;
+        uintptr_t n_words = self->n_words[ii];
+        self->levels[ii] = frames;
+
+        memset(frames, 0, n_words * sizeof(*frames));
+
+        /* Bits past the end of the level don't exist, so they are never free */
+        if (OFFSET_FROM_BIT(n_bits) != 0)
+        {
+            frames[n_words - 1] = FULL_WORD << OFFSET_FROM_BIT(n_bits);
+        }
+
+        frames += n_words;
+        n_bits = n_words;
     }
 }
 
@@ -44,89 +80,285 @@ static int set_page_cb(void* data, uintptr_t dir_offset, uintptr_t page_offset,
     UNUSED(page_offset);
     memmgr_physical_t *self = (memmgr_physical_t*)data;
 
-    uintptr_t frame_addr = page->frame * PAGE_SIZE;
-    set_frame(self, frame_addr);
+    set_frame(self, memmgr_virtual_page_addr(page));
     return 0;
 }
 
+/* Callback to skip the direct map, which maps every frame whether it is used or not */
+static int skip_direct_map_cb(void* data, uintptr_t dir_offset, page_table_t* table)
+{
+    UNUSED(data);
+    UNUSED(table);
+
+    uintptr_t first_dir = DIRECT_MAP_BASE / TABLE_SPAN;
+    if (dir_offset >= first_dir && dir_offset < first_dir + DIRECT_MAP_TABLES)
+    {
+        return PG_DIR_WALK_SKIP;
+    }
+    return PG_DIR_WALK_CONTINUE;
+}
+
 void memmgr_set_from_page_directory(memmgr_physical_t *self, page_directory_t* page_directory)
 {
-    page_directory_walk(page_directory, 0, set_page_cb, self);
+    page_directory_walk(page_directory, skip_direct_map_cb, set_page_cb, self);
 }
 
-void memmgr_physical_set_range(memmgr_physical_t *self, uintptr_t start_addr, uintptr_t count)
+void memmgr_physical_set_range(memmgr_physical_t *self, phys_addr_t start_addr, uintptr_t count)
 {
-    /* TODO: Optimise this to set 32 bits at a time instead of 1 bit at a time */
-    for (uint32_t ii = 0; ii < count; ii++)
+    if (start_addr / PAGE_SIZE >= self->n_frames)
     {
-        uint32_t frame_addr = start_addr + (ii * PAGE_SIZE);
-        set_frame(self, frame_addr);
+        return; // Past the end of the array, ignored
     }
+
+    uintptr_t first = start_addr / PAGE_SIZE;
+    uintptr_t last = (count > self->n_frames - first) ? self->n_frames : first + count;
+    set_bits(self, 0, first, last);
 }
 
+void memmgr_physical_clear_range(memmgr_physical_t *self, phys_addr_t start_addr, uintptr_t count)
+{
+    if (start_addr / PAGE_SIZE >= self->n_frames)
+    {
+        return; // Past the end of the array, ignored
+    }
 
-/*
- * Bitset Implementation Taken from: http://www.jamesmolloy.co.uk/tutorial_html/6.-Paging.html
- */
+    uintptr_t first = start_addr / PAGE_SIZE;
+    uintptr_t last = (count > self->n_frames - first) ? self->n_frames : first + count;
+    clear_bits(self, 0, first, last);
+}
 
-// Static function to set a bit in the frames bitset
-static void set_frame(memmgr_physical_t *self, uintptr_t frame_addr)
+phys_addr_t memmgr_physical_alloc(memmgr_physical_t *self, uintptr_t count, uintptr_t align)
 {
-    if (frame_addr > self->n_frames * PAGE_SIZE)
+    uintptr_t align_frames = (align > PAGE_SIZE) ? align / PAGE_SIZE : 1;
+
+    if (count == 0)
     {
-        return; // Past the end of the array, ignored
+        return MEMMGR_PHYSICAL_NONE;
     }
 
-    uintptr_t frame = frame_addr/PAGE_SIZE;
-    uintptr_t idx = INDEX_FROM_BIT(frame);
-    uintptr_t off = OFFSET_FROM_BIT(frame);
-    self->frames[idx] |= (0x1 << off);
+    uintptr_t frame = find_run(self, self->next_fit, count, align_frames);
+    if (frame == NO_FRAME && self->next_fit != 0)
+    {
+        frame = find_run(self, 0, count, align_frames);         /* Wrap around to the start */
+    }
+
+    if (frame == NO_FRAME)
+    {
+        return MEMMGR_PHYSICAL_NONE;
+    }
+
+    set_bits(self, 0, frame, frame + count);
+    self->next_fit = frame + count;
+    return (phys_addr_t)frame * PAGE_SIZE;
+}
+
+void memmgr_physical_free(memmgr_physical_t *self, phys_addr_t addr, uintptr_t count)
+{
+    memmgr_physical_clear_range(self, addr, count);
 }
 
-// Static function to clear a bit in the frames bitset
-static void clear_frame(memmgr_physical_t *self, uintptr_t frame_addr)
+phys_addr_t memmgr_physical_free_run(memmgr_physical_t *self, phys_addr_t start_addr, uintptr_t count, uintptr_t *run_count)
 {
-    if (frame_addr > self->n_frames * PAGE_SIZE)
+    if (start_addr / PAGE_SIZE >= self->n_frames)
     {
-        return; // Past the end of the array, ignored
+        return MEMMGR_PHYSICAL_NONE;
     }
-    uintptr_t frame = frame_addr/PAGE_SIZE;
-    uintptr_t idx = INDEX_FROM_BIT(frame);
-    uintptr_t off = OFFSET_FROM_BIT(frame);
-    self->frames[idx] &= ~(0x1 << off);
+
+    uintptr_t first = start_addr / PAGE_SIZE;
+    uintptr_t last = (count > self->n_frames - first) ? self->n_frames : first + count;
+    uintptr_t frame = find_free(self, first);
+    if (frame == NO_FRAME || frame >= last)
+    {
+        return MEMMGR_PHYSICAL_NONE;
+    }
+
+    *run_count = find_used(self, frame, last) - frame;
+    return (phys_addr_t)frame * PAGE_SIZE;
 }
 
-// Static function to test if a bit is set.
-static uint32_t test_frame(memmgr_physical_t *self, uintptr_t frame_addr)
+bool memmgr_physical_test(memmgr_physical_t *self, phys_addr_t addr)
 {
-    if (frame_addr > self->n_frames * PAGE_SIZE)
+    if (addr / PAGE_SIZE >= self->n_frames)
     {
-        return 1; // Past the end of the array, assume its used
+        return true; // Past the end of the array, assume its used
     }
-    uintptr_t frame = frame_addr/PAGE_SIZE;
-    uintptr_t idx = INDEX_FROM_BIT(frame);
-    uintptr_t off = OFFSET_FROM_BIT(frame);
-    return (self->frames[idx] & (0x1 << off));
+
+    uintptr_t frame = addr / PAGE_SIZE;
+    return (self->levels[0][INDEX_FROM_BIT(frame)] & (0x1u << OFFSET_FROM_BIT(frame))) != 0;
 }
 
-// Static function to find the first free frame.
-static uint32_t first_frame(memmgr_physical_t *self)
+
+/*
+ * Hierarchical bitmap implementation, grown out of the bitset from:
+ * http://www.jamesmolloy.co.uk/tutorial_html/6.-Paging.html
+ */
+
+/* Returns a word with bits lo to hi (inclusive) set */
+static inline uint32_t range_mask(uintptr_t lo, uintptr_t hi)
 {
-    uintptr_t i, j;
-    for (i = 0; i < INDEX_FROM_BIT(self->n_frames); i++)
+    return (FULL_WORD << lo) & (FULL_WORD >> (BITS_PER_WORD - 1 - hi));
+}
+
+/* Sets bits [first, last) in a level, and marks any words that fill up in the levels above */
+static void set_bits(memmgr_physical_t *self, uintptr_t level, uintptr_t first, uintptr_t last)
+{
+    while (first < last && level < self->n_levels)
     {
-        if (self->frames[i] != 0xFFFFFFFF) // nothing free, exit early.
+        uint32_t *words = self->levels[level];
+        uintptr_t first_word = INDEX_FROM_BIT(first);
+        uintptr_t last_word = INDEX_FROM_BIT(last - 1);
+
+        if (first_word == last_word)
         {
-            // at least one bit is free here.
-            for (j = 0; j < 32; j++)
+            words[first_word] |= range_mask(OFFSET_FROM_BIT(first), OFFSET_FROM_BIT(last - 1));
+        }
+        else
+        {
+            words[first_word] |= range_mask(OFFSET_FROM_BIT(first), BITS_PER_WORD - 1);
+            for (uintptr_t ii = first_word + 1; ii < last_word; ii++)
             {
-                uintptr_t toTest = 0x1 << j;
-                if ( !(self->frames[i]&toTest) )
-                {
-                    return i*4*8+j;
-                }
+                words[ii] = FULL_WORD;                          /* Whole words at a time */
             }
+            words[last_word] |= range_mask(0, OFFSET_FROM_BIT(last - 1));
         }
+
+        /* Every word in between is now full, only the ends might not be */
+        first = first_word + (words[first_word] != FULL_WORD);
+        last = last_word + (words[last_word] == FULL_WORD);
+        level++;
     }
-    return 0; /* TODO: Don't really know what to do here */
+}
+
+/* Clears bits [first, last) in a level, and the summary bits for those words in the levels above */
+static void clear_bits(memmgr_physical_t *self, uintptr_t level, uintptr_t first, uintptr_t last)
+{
+    while (first < last && level < self->n_levels)
+    {
+        uint32_t *words = self->levels[level];
+        uintptr_t first_word = INDEX_FROM_BIT(first);
+        uintptr_t last_word = INDEX_FROM_BIT(last - 1);
+
+        if (first_word == last_word)
+        {
+            words[first_word] &= ~range_mask(OFFSET_FROM_BIT(first), OFFSET_FROM_BIT(last - 1));
+        }
+        else
+        {
+            words[first_word] &= ~range_mask(OFFSET_FROM_BIT(first), BITS_PER_WORD - 1);
+            for (uintptr_t ii = first_word + 1; ii < last_word; ii++)
+            {
+                words[ii] = 0;                                  /* Whole words at a time */
+            }
+            words[last_word] &= ~range_mask(0, OFFSET_FROM_BIT(last - 1));
+        }
+
+        /* Every word touched now has a free bit, so none of them are full */
+        first = first_word;
+        last = last_word + 1;
+        level++;
+    }
+}
+
+/* Returns the first free frame at or after frame, or NO_FRAME if there isn't one */
+static uintptr_t find_free(memmgr_physical_t *self, uintptr_t frame)
+{
+    uintptr_t level = 0;
+    uintptr_t bit = frame;
+
+    if (self->n_frames == 0)
+    {
+        return NO_FRAME;
+    }
+
+    /* Climb until a word with a free bit at or after the position turns up */
+    for (;;)
+    {
+        uintptr_t idx = INDEX_FROM_BIT(bit);
+        if (idx >= self->n_words[level])
+        {
+            return NO_FRAME;                                    /* Ran off the end */
+        }
+
+        uint32_t free = ~self->levels[level][idx] & (FULL_WORD << OFFSET_FROM_BIT(bit));
+        if (free != 0)
+        {
+            bit = idx * BITS_PER_WORD + __builtin_ctz(free);
+            break;
+        }
+
+        if (level + 1 < self->n_levels)
+        {
+            bit = idx + 1;                                      /* Look at the next word's summary */
+            level++;
+        }
+        else
+        {
+            bit = (idx + 1) * BITS_PER_WORD;                    /* Top level, try the next word */
+        }
+    }
+
+    /* Descend, every summary bit that is clear has a free bit below it */
+    while (level > 0)
+    {
+        level--;
+        bit = bit * BITS_PER_WORD + __builtin_ctz(~self->levels[level][bit]);
+    }
+
+    return bit;
+}
+
+/* Returns the first used frame in [frame, last), or last if they are all free */
+static uintptr_t find_used(memmgr_physical_t *self, uintptr_t frame, uintptr_t last)
+{
+    while (frame < last)
+    {
+        uintptr_t idx = INDEX_FROM_BIT(frame);
+        uint32_t used = self->levels[0][idx] & (FULL_WORD << OFFSET_FROM_BIT(frame));
+        if (used != 0)
+        {
+            frame = idx * BITS_PER_WORD + __builtin_ctz(used);
+            return (frame < last) ? frame : last;
+        }
+        frame = (idx + 1) * BITS_PER_WORD;                      /* Whole words at a time */
+    }
+    return last;
+}
+
+/* Returns the first run of count free frames at or after frame starting on a multiple of align */
+static uintptr_t find_run(memmgr_physical_t *self, uintptr_t frame, uintptr_t count, uintptr_t align)
+{
+    for (;;)
+    {
+        frame = find_free(self, frame);
+        if (frame == NO_FRAME)
+        {
+            return NO_FRAME;
+        }
+
+        frame = (frame + align - 1) & ~(align - 1);             /* Round up to the alignment */
+        if (frame >= self->n_frames || count > self->n_frames - frame)
+        {
+            return NO_FRAME;                                    /* Not enough room left */
+        }
+
+        uintptr_t used = find_used(self, frame, frame + count);
+        if (used == frame + count)
+        {
+            return frame;                                       /* The whole run is free */
+        }
+
+        frame = used + 1;                                       /* Try again after the obstruction */
+    }
+}
+
+// Static function to set a bit in the frames bitset
+static void set_frame(memmgr_physical_t *self, phys_addr_t frame_addr)
+{
+    if (frame_addr/PAGE_SIZE >= self->n_frames)
+    {
+        return; // Past the end of the array, ignored
+    }
+
+    uintptr_t frame = frame_addr/PAGE_SIZE;
+    set_bits(self, 0, frame, frame + 1);
 }
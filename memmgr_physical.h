@@ -2,20 +2,43 @@
 #define _MEMMGR_PHYSICAL_H_ 1
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "memmgr_virtual.h"
 
 #define PAGE_SIZE (0x1000)
 #define INITIAL_FRAMES (4096)
 
+/*
+ * Enough levels to summarise every frame below MAX_PHYSICAL_ADDRESS down to
+ * a single word: 32^4 frames is 4GB worth of 4k frames, 32^5 covers PAE.
+ */
+#ifdef MEMMGR_PAE
+#define MEMMGR_PHYSICAL_LEVELS (5)
+#else
+#define MEMMGR_PHYSICAL_LEVELS (4)
+#endif
+
+/* Returned by memmgr_physical_alloc when there isn't a suitable run of free frames */
+#define MEMMGR_PHYSICAL_NONE ((phys_addr_t)~0)
+
+/*
+ * The frame bitmap is kept as a hierarchy of bitmaps.  levels[0] has one bit
+ * per frame, set if the frame is in use.  Each bit in levels[n] summarises a
+ * word in levels[n-1], and is set only when every bit in that word is set.
+ * Finding a free frame only ever has to look at one word per level.
+ */
 struct memmgr_physical
 {
-    uint32_t *frames;
-    uintptr_t n_frames;
+    uint32_t *levels[MEMMGR_PHYSICAL_LEVELS];   /* The bitmaps, levels[0] has one bit per frame */
+    uintptr_t n_words[MEMMGR_PHYSICAL_LEVELS];  /* Number of 32 bit words in each level */
+    uintptr_t n_levels;                         /* Number of levels actually in use */
+    uintptr_t n_frames;                         /* Frame numbers fit in 32 bits, even with PAE */
+    uintptr_t next_fit;                         /* Frame where the next allocation starts searching */
 };
 typedef struct memmgr_physical memmgr_physical_t;
 
 
-void memmgr_physical_init(memmgr_physical_t *self, uintptr_t highest_addr);
+void memmgr_physical_init(memmgr_physical_t *self, phys_addr_t highest_addr);
 
 /* Returns the number of bytes required to handle a map upto highest_addr */
 uintptr_t memmgr_physical_size(memmgr_physical_t *self);
@@ -27,7 +50,32 @@ void memmgr_physical_set_frames(memmgr_physical_t *self, uint32_t *frames);
 void memmgr_set_from_page_directory(memmgr_physical_t *self, page_directory_t* page_directory);
 
 /* Marks a range of frames as in use */
-void memmgr_physical_set_range(memmgr_physical_t *self, uintptr_t start_addr, uintptr_t count);
+void memmgr_physical_set_range(memmgr_physical_t *self, phys_addr_t start_addr, uintptr_t count);
+
+/* Marks a range of frames as free */
+void memmgr_physical_clear_range(memmgr_physical_t *self, phys_addr_t start_addr, uintptr_t count);
+
+/*
+ * Finds count contiguous free frames starting at a multiple of align bytes
+ * (a power of two, anything up to PAGE_SIZE means no alignment), marks them
+ * as in use, and returns the physical address of the first one. Searching
+ * resumes where the last allocation left off. Returns MEMMGR_PHYSICAL_NONE
+ * if no such run exists.
+ */
+phys_addr_t memmgr_physical_alloc(memmgr_physical_t *self, uintptr_t count, uintptr_t align);
+
+/* Frees count frames starting at addr, previously returned by memmgr_physical_alloc */
+void memmgr_physical_free(memmgr_physical_t *self, phys_addr_t addr, uintptr_t count);
+
+/*
+ * Finds the first run of free frames among the count frames from start_addr.
+ * Returns the address of the run and stores its length in run_count, or
+ * returns MEMMGR_PHYSICAL_NONE if every frame is in use.
+ */
+phys_addr_t memmgr_physical_free_run(memmgr_physical_t *self, phys_addr_t start_addr, uintptr_t count, uintptr_t *run_count);
+
+/* Returns true if the frame containing addr is in use */
+bool memmgr_physical_test(memmgr_physical_t *self, phys_addr_t addr);
 
 /*
  * Symbols provided by the linker
@@ -0,0 +1,319 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_dumb.h"
+#include "memmgr_slab.h"
+
+#define N_KMALLOC_CACHES (8)            /* 16 bytes to 2k */
+
+/*
+ * The header at the start of every slab.  Allocations too big for a cache
+ * get one too, with no cache and in_use counting their pages instead.
+ */
+struct slab
+{
+    slab_cache_t *cache;
+    struct slab *next;
+    struct slab *prev;
+    void *free;                         /* First free object */
+    uintptr_t in_use;                   /* Number of objects handed out */
+};
+
+/* Where slabs get their pages from, it does its own locking */
+static memmgr_dumb_t *backend;
+
+/* Cache for the slab_cache_t structures made by slab_cache_create */
+static slab_cache_t cache_cache;
+
+/* The kmalloc size classes */
+static slab_cache_t kmalloc_caches[N_KMALLOC_CACHES];
+static const char *kmalloc_names[N_KMALLOC_CACHES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+/* Every cache, newest first */
+static slab_cache_t *caches;
+static spinlock_t caches_lock;
+
+/*
+ * Internal Function Declarations
+ */
+static void cache_setup(slab_cache_t *cache, const char *name, uintptr_t size, uintptr_t align, slab_ctor_t *ctor);
+static struct slab *slab_grow(slab_cache_t *cache);
+static void slab_release(struct slab *slab);
+static struct slab **slab_list(slab_cache_t *cache, struct slab *slab);
+static void list_remove(struct slab **head, struct slab *slab);
+static void list_push(struct slab **head, struct slab *slab);
+
+
+void slab_init(memmgr_dumb_t *memmgr_dumb)
+{
+    backend = memmgr_dumb;
+    caches = 0;
+    caches_lock = SPINLOCK_INIT;
+
+    cache_setup(&cache_cache, "slab_cache", sizeof(slab_cache_t), CACHE_LINE_SIZE, 0);
+
+    uintptr_t size = KMALLOC_MIN_SIZE;
+    for (uintptr_t ii = 0; ii < N_KMALLOC_CACHES; ii++)
+    {
+        uintptr_t align = (size < CACHE_LINE_SIZE) ? size : CACHE_LINE_SIZE;
+        cache_setup(&kmalloc_caches[ii], kmalloc_names[ii], size, align, 0);
+        size *= 2;
+    }
+}
+
+slab_cache_t *slab_cache_create(const char *name, uintptr_t size, uintptr_t align, slab_ctor_t *ctor)
+{
+    slab_cache_t *cache = slab_cache_alloc(&cache_cache);
+    if (cache)
+    {
+        cache_setup(cache, name, size, align, ctor);
+    }
+    return cache;
+}
+
+void *slab_cache_alloc(slab_cache_t *cache)
+{
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&cache->lock);
+
+    struct slab *slab = cache->partial ? cache->partial : cache->empty;
+    if (!slab)
+    {
+        slab = slab_grow(cache);
+    }
+
+    void *obj = 0;
+    if (slab)
+    {
+        struct slab **old_list = slab_list(cache, slab);
+
+        obj = slab->free;
+        slab->free = *(void**)((uint8_t*)obj + cache->free_offset);
+        slab->in_use++;
+
+        struct slab **new_list = slab_list(cache, slab);
+        if (new_list != old_list)
+        {
+            list_remove(old_list, slab);
+            list_push(new_list, slab);
+        }
+    }
+
+    spin_unlock(&cache->lock);
+    cpu_irq_restore(flags);
+    return obj;
+}
+
+void slab_cache_free(slab_cache_t *cache, void *obj)
+{
+    struct slab *slab = (struct slab *)((uintptr_t)obj & ~(uintptr_t)(SLAB_SIZE - 1));
+
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&cache->lock);
+
+    struct slab **old_list = slab_list(cache, slab);
+
+    *(void**)((uint8_t*)obj + cache->free_offset) = slab->free;
+    slab->free = obj;
+    slab->in_use--;
+
+    struct slab **new_list = slab_list(cache, slab);
+    if (new_list != old_list)
+    {
+        list_remove(old_list, slab);
+        if (new_list == &cache->empty && cache->empty)
+        {
+            slab_release(slab);                          /* Already have a spare, give the pages back */
+        }
+        else
+        {
+            list_push(new_list, slab);
+        }
+    }
+
+    spin_unlock(&cache->lock);
+    cpu_irq_restore(flags);
+}
+
+void *kmalloc(uintptr_t size)
+{
+    uintptr_t class_size = KMALLOC_MIN_SIZE;
+    for (uintptr_t ii = 0; ii < N_KMALLOC_CACHES; ii++)
+    {
+        if (size <= class_size)
+        {
+            return slab_cache_alloc(&kmalloc_caches[ii]);
+        }
+        class_size *= 2;
+    }
+
+    /* Too big for any cache, so use whole pages with a header in front */
+    uintptr_t n_pages = idivc(size + CACHE_LINE_SIZE, PAGE_SIZE);
+
+    struct slab *slab = dumb_alloc_aligned(backend, n_pages * PAGE_SIZE, SLAB_SIZE);
+
+    if (!slab)
+    {
+        return 0;
+    }
+
+    slab->cache = 0;
+    slab->in_use = n_pages;
+    return (uint8_t*)slab + CACHE_LINE_SIZE;
+}
+
+void kfree(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+
+    struct slab *slab = (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (slab->cache)
+    {
+        slab_cache_free(slab->cache, ptr);
+        return;
+    }
+
+    dumb_free(backend, slab, slab->in_use * PAGE_SIZE);
+}
+
+/* Works out the layout of a cache's slabs */
+static void cache_setup(slab_cache_t *cache, const char *name, uintptr_t size, uintptr_t align, slab_ctor_t *ctor)
+{
+    if (align < sizeof(void*))
+    {
+        align = sizeof(void*);
+    }
+
+    uintptr_t obj_size = idivc(size, sizeof(void*)) * sizeof(void*);
+    if (obj_size == 0)
+    {
+        obj_size = sizeof(void*);
+    }
+
+    /* A constructed object has to keep its contents while free, so the link goes after it */
+    cache->free_offset = 0;
+    if (ctor)
+    {
+        cache->free_offset = obj_size;
+        obj_size += sizeof(void*);
+    }
+
+    /* The header takes at least a cache line so that the objects after it start on one */
+    uintptr_t header_align = (align > CACHE_LINE_SIZE) ? align : CACHE_LINE_SIZE;
+
+    cache->name = name;
+    cache->obj_size = idivc(obj_size, align) * align;
+    cache->first_obj = idivc(sizeof(struct slab), header_align) * header_align;
+    cache->objs_per_slab = (SLAB_SIZE - cache->first_obj) / cache->obj_size;
+    cache->ctor = ctor;
+    cache->partial = 0;
+    cache->full = 0;
+    cache->empty = 0;
+    cache->lock = SPINLOCK_INIT;
+
+    uint32_t flags = cpu_irq_save();
+    spin_lock(&caches_lock);
+    cache->next = caches;
+    caches = cache;
+    spin_unlock(&caches_lock);
+    cpu_irq_restore(flags);
+}
+
+/* Gets a new slab from the backend and threads the freelist through it, called with the cache locked */
+static struct slab *slab_grow(slab_cache_t *cache)
+{
+    if (cache->objs_per_slab == 0)
+    {
+        return 0;                                               /* Objects don't fit in a slab */
+    }
+
+    struct slab *slab = dumb_alloc_aligned(backend, SLAB_SIZE, SLAB_SIZE);
+
+    if (!slab)
+    {
+        return 0;
+    }
+
+    slab->cache = cache;
+    slab->free = 0;
+    slab->in_use = 0;
+
+    /* Build the freelist backwards so objects are handed out in address order */
+    uint8_t *base = (uint8_t*)slab + cache->first_obj;
+    for (uintptr_t ii = cache->objs_per_slab; ii > 0; ii--)
+    {
+        uint8_t *obj = base + (ii - 1) * cache->obj_size;
+        if (cache->ctor)
+        {
+            cache->ctor(obj);
+        }
+        *(void**)(obj + cache->free_offset) = slab->free;
+        slab->free = obj;
+    }
+
+    list_push(&cache->empty, slab);
+    return slab;
+}
+
+/* Hands an unlinked, empty slab's pages back to the backend, called with the cache locked */
+static void slab_release(struct slab *slab)
+{
+    dumb_free(backend, slab, SLAB_SIZE);
+}
+
+/* Returns the list a slab belongs on given how many of its objects are in use */
+static struct slab **slab_list(slab_cache_t *cache, struct slab *slab)
+{
+    if (slab->in_use == 0)
+    {
+        return &cache->empty;
+    }
+    else if (slab->in_use == cache->objs_per_slab)
+    {
+        return &cache->full;
+    }
+    else
+    {
+        return &cache->partial;
+    }
+}
+
+static void list_remove(struct slab **head, struct slab *slab)
+{
+    if (slab->prev)
+    {
+        slab->prev->next = slab->next;
+    }
+    else
+    {
+        *head = slab->next;
+    }
+
+    if (slab->next)
+    {
+        slab->next->prev = slab->prev;
+    }
+}
+
+static void list_push(struct slab **head, struct slab *slab)
+{
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head)
+    {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
@@ -0,0 +1,60 @@
+#ifndef _MEMMGR_SLAB_H_
+#define _MEMMGR_SLAB_H_ 1
+
+#include <stdint.h>
+#include "spinlock.h"
+#include "memmgr_physical.h"
+
+/* Every slab is this big, and aligned to its size so an object can find its slab */
+#define SLAB_SIZE (4 * PAGE_SIZE)
+
+/* Smallest and largest kmalloc size classes, powers of two in between */
+#define KMALLOC_MIN_SIZE (16)
+#define KMALLOC_MAX_SIZE (2048)
+
+/* Called on each object when a slab is created, objects are freed back in their constructed state */
+typedef void (slab_ctor_t)(void *obj);
+
+struct slab;
+
+struct slab_cache
+{
+    const char *name;
+    uintptr_t obj_size;                 /* Distance between objects in a slab */
+    uintptr_t free_offset;              /* Where a free object keeps its freelist link */
+    uintptr_t first_obj;                /* Offset of the first object from the start of the slab */
+    uintptr_t objs_per_slab;
+    slab_ctor_t *ctor;
+    struct slab *partial;               /* Slabs with some objects in use */
+    struct slab *full;                  /* Slabs with every object in use */
+    struct slab *empty;                 /* Slabs with no objects in use, at most one is kept */
+    spinlock_t lock;
+    struct slab_cache *next;            /* The next cache that was created */
+};
+typedef struct slab_cache slab_cache_t;
+
+/* Sets up the kmalloc caches, taking pages from memmgr_dumb once it has a frame cache */
+void slab_init(memmgr_dumb_t *memmgr_dumb);
+
+/*
+ * Creates a cache of objects of size bytes, each aligned to align bytes
+ * (rounded up to a pointer). ctor may be null.
+ */
+slab_cache_t *slab_cache_create(const char *name, uintptr_t size, uintptr_t align, slab_ctor_t *ctor);
+
+/* Takes an object from a cache, or returns null if no memory is left */
+void *slab_cache_alloc(slab_cache_t *cache);
+
+/* Returns an object to the cache it came from */
+void slab_cache_free(slab_cache_t *cache, void *obj);
+
+/*
+ * Allocates size bytes from the smallest size class that fits, or whole
+ * pages if it's bigger than KMALLOC_MAX_SIZE. Objects of 64 bytes or more
+ * start on a cache line.
+ */
+void *kmalloc(uintptr_t size);
+
+/* Frees memory returned by kmalloc */
+void kfree(void *ptr);
+#endif
@@ -2,96 +2,401 @@
 #include <stdalign.h>
 #include <stdbool.h>
 #include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
 #include "memmgr_physical.h"
 #include "memmgr_virtual.h"
 
 /*
  * Externs
  */
-extern uint32_t _b_page_directory;
+extern pde_t _b_page_directory[];
+#ifdef MEMMGR_PAE
+extern uint8_t _b_pdpt;                 /* The page directory pointer table the bootstrap loaded into CR3 */
+#endif
+
+/* The kernel's page directory, whose page tables every address space shares */
+static page_directory_t *kernel_directory = 0;
+
+#ifndef MEMMGR_PAE
+/* Bumped whenever a kernel half entry of the kernel directory changes, and what copies them */
+static uint32_t kernel_generation = 0;
+static spinlock_t kernel_copy_lock = SPINLOCK_INIT;
+#endif
+
+/* The page directory in each cpu's CR3 */
+static page_directory_t *current_directories[MAX_CPUS];
+
+/* A page for each cpu, where memmgr_virtual_kmap maps frames above the direct map */
+static uint8_t *kmap_windows = 0;
+
+/* Whether CR4.PGE was turned on, and global pages need a stronger flush */
+static bool pge_enabled = false;
+
+/* Whether large pages can be used, CR4.PSE for 4MB pages or always for PAE's 2MB pages */
+static bool pse_enabled = false;
+
+/* Tells the other cpus about a committed batch, once they are running */
+static tlb_shootdown_cb *tlb_shootdown = 0;
+
+#ifdef MEMMGR_PAE
+/* Whether EFER.NXE was turned on, and data pages can be made not executable */
+static bool nx_enabled = false;
+#endif
 
 /*
  * Internal Function
  */
+static page_directory_t *table_owner(page_directory_t *page_directory, uintptr_t o_dir);
+static void kernel_entries_changed(page_directory_t *page_directory, uintptr_t o_dir);
+static void enable_large_pages(void);
+static void enable_global_pages(page_directory_t *page_directory);
+#ifdef MEMMGR_PAE
+static void enable_nx(void);
+#endif
 
-void memmgr_virtual_bootstrap(page_directory_t *page_directory, page_table_t *page_table769)
+void memmgr_virtual_bootstrap(page_directory_t *page_directory, page_table_t *remap_table)
 {
-    page_directory->tablesPhysical = &_b_page_directory;
-    page_directory->physicalAddr = (uintptr_t)&_b_page_directory;
+    uintptr_t remap_dir = BOOTSTRAP_REMAP_BASE / TABLE_SPAN;   /* Directory entry for remap_table */
+
+    page_directory->tablesPhysical = _b_page_directory;
+#ifdef MEMMGR_PAE
+    page_directory->physicalAddr = (uintptr_t)&_b_pdpt;
+#else
+    page_directory->physicalAddr = (uintptr_t)_b_page_directory;
+#endif
+    page_directory->rmap = 0;
+    page_directory->rmap_n_frames = 0;
+    page_directory->table_alloc = 0;
+    page_directory->table_alloc_data = 0;
+    page_directory->vmas = 0;
+    page_directory->kernel_generation = 0;
+    kernel_directory = page_directory;
+    for (uint32_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        current_directories[ii] = page_directory;          /* The other cpus start in it too */
+    }
 
     /* Remap the structures created by the bootstrap after the kernel */
-    int tableIdx = 0;
-    memmgr_virtual_map_page(&page_table769->pages[tableIdx++],
-                            (uintptr_t)&_b_page_directory,
-                            true, true);                    /* Map the page directory */
-    for (int ii = 0; ii < 1024; ii++)                       /* Map all present pages */
-    {
-        uintptr_t addrPhy = page_directory->tablesPhysical[ii];
-        if ((addrPhy & 1) > 0)                              /* Check if present bit is set */
+    uintptr_t tableIdx = 0;
+    for (uintptr_t ii = 0; ii < DIRECTORY_PAGES; ii++)      /* Map the page directory */
+    {
+        memmgr_virtual_map_page(&remap_table->pages[tableIdx++],
+                                (uintptr_t)_b_page_directory + ii * PAGE_SIZE,
+                                true, true);
+    }
+    for (uintptr_t ii = 0; ii < TABLES_PER_DIRECTORY; ii++) /* Map all present pages */
+    {
+        pde_t addrPhy = page_directory->tablesPhysical[ii];
+        if ((addrPhy & PDE_PRESENT) && !(addrPhy & PDE_LARGE))  /* Present, and an actual table */
         {
-            addrPhy &= 0xFFFFF000;                          /* Convert entry to physical address */
+            addrPhy &= ~(pde_t)0xFFF;                       /* Convert entry to physical address */
 
-            uintptr_t addrVirt = (769u*1024u*PAGE_SIZE);    /* Address of first byte in table 769 */
+            uintptr_t addrVirt = BOOTSTRAP_REMAP_BASE;      /* Address of first byte in remap_table */
             addrVirt += PAGE_SIZE * tableIdx;               /* Add the offset of the current page */
 
-            memmgr_virtual_map_page(&page_table769->pages[tableIdx++], addrPhy, true, true);
+            memmgr_virtual_map_page(&remap_table->pages[tableIdx++], addrPhy, true, true);
 
             page_directory->tables[ii] = (page_table_t*)addrVirt;
         }
     }
 
     /* Save the virtual address into the page_directory structure */
-    page_directory->tables[769] = page_table769;
+    page_directory->tables[remap_dir] = remap_table;
 
     /* Save the directory entry into the page directory */
-    uintptr_t directoryEntry = (uintptr_t)page_table769;    /* The virtual address of the new table */
+    pde_t directoryEntry = (uintptr_t)remap_table;          /* The virtual address of the new table */
     directoryEntry -= (uintptr_t)&KERNEL_BASE;              /* Convert it to a physical address */
-    directoryEntry &= 0xFFFFF000;                           /* 20 most significant bits are used */
+    directoryEntry &= ~(pde_t)0xFFF;                        /* The low 12 bits are flags */
     directoryEntry |= 0x1;                                  /* Bit-0: The present bit */
-    page_directory->tablesPhysical[769] = directoryEntry;
+    page_directory->tablesPhysical[remap_dir] = directoryEntry;
 
     /* Update the tlb */
     memmgr_virtual_flush_tlb();
 
     /* Update the page directory pointer */
-    page_directory->tablesPhysical = (uint32_t*)(769u * 1024u * PAGE_SIZE);
+    page_directory->tablesPhysical = (pde_t*)BOOTSTRAP_REMAP_BASE;
+
+    enable_large_pages();
+    enable_global_pages(page_directory);
+#ifdef MEMMGR_PAE
+    enable_nx();
+#endif
 }
 
-/* Clears the mapping for a virtual address */
-void memmgr_virtual_unmap(page_directory_t* page_directory, void* addr)
+/*
+ * Returns the directory that keeps track of the page table for directory
+ * entry o_dir: the kernel's for the kernel half, otherwise the one given.
+ */
+static page_directory_t *table_owner(page_directory_t *page_directory, uintptr_t o_dir)
+{
+    if (kernel_directory && o_dir >= KERNEL_DIRECTORY_FIRST)
+    {
+        return kernel_directory;
+    }
+    return page_directory;
+}
+
+/* Bumps the kernel generation after a kernel half entry of the kernel directory changed */
+static void kernel_entries_changed(page_directory_t *page_directory, uintptr_t o_dir)
+{
+#ifdef MEMMGR_PAE
+    UNUSED(page_directory);
+    UNUSED(o_dir);                                                  /* The kernel half is shared, not copied */
+#else
+    if (page_directory == kernel_directory && o_dir >= KERNEL_DIRECTORY_FIRST)
+    {
+        __atomic_add_fetch(&kernel_generation, 1, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+/* Enables large pages if the cpu has them, the bootstrap may have already */
+static void enable_large_pages(void)
+{
+#ifdef MEMMGR_PAE
+    pse_enabled = true;                                     /* PAE directories can always map 2MB pages */
+#else
+    if (!(cpu_features_edx() & CPUID_1_EDX_PSE))
+    {
+        return;
+    }
+
+    cpu_write_cr4(cpu_read_cr4() | CR4_PSE);
+    pse_enabled = true;
+#endif
+}
+
+/* Marks the kernel image global and enables global pages, if the cpu has them */
+static void enable_global_pages(page_directory_t *page_directory)
+{
+    if (!(cpu_features_edx() & CPUID_1_EDX_PGE))
+    {
+        return;
+    }
+
+    /* The bootstrap mapped the kernel image in the entries before remap_table */
+    for (uintptr_t dir = (uintptr_t)&KERNEL_BASE / TABLE_SPAN; dir < BOOTSTRAP_REMAP_BASE / TABLE_SPAN; dir++)
+    {
+        pde_t entry = page_directory->tablesPhysical[dir];
+        if (!(entry & PDE_PRESENT))
+        {
+            continue;
+        }
+
+        if (entry & PDE_LARGE)
+        {
+            page_directory->tablesPhysical[dir] |= PDE_GLOBAL;  /* The bootstrap used a large page */
+            continue;
+        }
+
+        page_table_t *kernel_table = page_directory->tables[dir];
+        for (uintptr_t ii = 0; ii < PAGES_PER_TABLE; ii++)
+        {
+            if (kernel_table->pages[ii].present)
+            {
+                kernel_table->pages[ii].global = 1;             /* Mapped by the bootstrap */
+            }
+        }
+    }
+
+    cpu_write_cr4(cpu_read_cr4() | CR4_PGE);
+    pge_enabled = true;
+}
+
+#ifdef MEMMGR_PAE
+/* Lets pages be marked not executable, if the cpu has the NX bit */
+static void enable_nx(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(CPUID_EXT_BASE, &eax, &ebx, &ecx, &edx);
+    if (eax < CPUID_EXT_FEATURES)
+    {
+        return;                                                 /* No extended feature flags */
+    }
+
+    cpu_cpuid(CPUID_EXT_FEATURES, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EXT_EDX_NX))
+    {
+        return;
+    }
+
+    cpu_write_msr(MSR_EFER, cpu_read_msr(MSR_EFER) | EFER_NXE);
+    nx_enabled = true;
+}
+#endif
+
+/* Clears the mapping for a page number, returns true if it was present */
+static bool clear_mapping(page_directory_t* page_directory, uintptr_t page)
 {
-    uintptr_t page = (uintptr_t)addr / PAGE_SIZE;           /* Convert address to page number */
-    uintptr_t o_dir = page / 1024;                          /* Offset into page directory */
-    uintptr_t o_tbl = page % 1024;                          /* Offset into page table */
+    uintptr_t o_dir = page / PAGES_PER_TABLE;               /* Offset into page directory */
+    uintptr_t o_tbl = page % PAGES_PER_TABLE;               /* Offset into page table */
 
+    page_directory = table_owner(page_directory, o_dir);
     if (!(page_directory->tablesPhysical[o_dir] & 1))       /* Check the present bit on page table */
     {
-        return;                                             /* No page table, so address can't be mapped */
+        return false;                                       /* No page table, so address can't be mapped */
+    }
+
+    if (page_directory->tablesPhysical[o_dir] & PDE_LARGE)
+    {
+        page_directory->tablesPhysical[o_dir] = 0;          /* The whole large page goes */
+        kernel_entries_changed(page_directory, o_dir);
+        return true;
     }
 
     page_table_t *table = page_directory->tables[o_dir];    /* Get the page table */
+    if (!table->pages[o_tbl].present)
+    {
+        return false;
+    }
+
+    phys_addr_t frame_addr = memmgr_virtual_page_addr(&table->pages[o_tbl]);
+    phys_addr_t rmap_idx = (frame_addr - DIRECT_MAP_SIZE) / PAGE_SIZE;    /* Forget the reverse mapping */
+    if (frame_addr >= DIRECT_MAP_SIZE && rmap_idx < page_directory->rmap_n_frames
+        && page_directory->rmap[rmap_idx] == page)
+    {
+        page_directory->rmap[rmap_idx] = 0;
+    }
+
     table->pages[o_tbl].present = 0;                        /* Clear the present bit */
-    memmgr_virtual_flush_addr(addr);                        /* Update the TLB */
+    return true;
+}
+
+/* Clears the mapping for a virtual address */
+void memmgr_virtual_unmap(page_directory_t* page_directory, void* addr)
+{
+    if (clear_mapping(page_directory, (uintptr_t)addr / PAGE_SIZE))
+    {
+        memmgr_virtual_flush_addr(addr);                    /* Update the TLB */
+    }
 }
 
+/* Clears the mappings for a range of pages, leaving the TLB to the gather */
+void memmgr_virtual_unmap_range(page_directory_t* page_directory, void* addr, uintptr_t n_pages, tlb_gather_t *gather)
+{
+    uintptr_t first = (uintptr_t)addr / PAGE_SIZE;
+    for (uintptr_t page = first; page < first + n_pages; page++)
+    {
+        if (clear_mapping(page_directory, page))
+        {
+            memmgr_virtual_gather_add(gather, (void*)(page * PAGE_SIZE), 1);
+        }
+    }
+}
+
+void memmgr_virtual_gather_init(tlb_gather_t *gather)
+{
+    gather->start = ~0;
+    gather->end = 0;
+    gather->global = false;
+}
+
+void memmgr_virtual_gather_add(tlb_gather_t *gather, void *addr, uintptr_t n_pages)
+{
+    uintptr_t first = (uintptr_t)addr / PAGE_SIZE;
+
+    if (first < gather->start)
+    {
+        gather->start = first;
+    }
+    if (first + n_pages > gather->end)
+    {
+        gather->end = first + n_pages;
+    }
+    if ((uintptr_t)addr >= (uintptr_t)&KERNEL_BASE)
+    {
+        gather->global = true;                              /* Kernel pages are global */
+    }
+}
+
+void memmgr_virtual_gather_commit(tlb_gather_t *gather)
+{
+    if (gather->start >= gather->end)
+    {
+        return;                                             /* Nothing changed */
+    }
+
+    memmgr_virtual_gather_flush(gather);
+    if (tlb_shootdown)
+    {
+        tlb_shootdown(gather);                              /* One shootdown for the whole batch */
+    }
+
+    memmgr_virtual_gather_init(gather);
+}
+
+void memmgr_virtual_gather_flush(const tlb_gather_t *gather)
+{
+    /*
+     * The span between the lowest and highest page is flushed, which is
+     * cheaper than tracking every page for the batches that happen in
+     * practice: contiguous allocations and frees.
+     */
+    if (gather->end - gather->start <= TLB_FLUSH_CEILING)
+    {
+        for (uintptr_t page = gather->start; page < gather->end; page++)
+        {
+            memmgr_virtual_flush_addr((void*)(page * PAGE_SIZE));
+        }
+    }
+    else if (gather->global)
+    {
+        memmgr_virtual_flush_tlb_global();
+    }
+    else
+    {
+        memmgr_virtual_flush_tlb();
+    }
+}
+
+void memmgr_virtual_set_shootdown(tlb_shootdown_cb *shootdown)
+{
+    tlb_shootdown = shootdown;
+}
 
 /* Walk a page directory calling table_cb for each present table, and page_cb for each present page */
 void page_directory_walk(page_directory_t* page_directory, pg_dir_table_cb* table_cb, pg_dir_page_cb* page_cb, void *data)
 {
-    for (int ii = 0; ii < 1024; ii++)
+    for (uintptr_t ii = 0; ii < TABLES_PER_DIRECTORY; ii++)
     {
-        if ((page_directory->tablesPhysical[ii] & 1) > 0)           /* Check the present bit */
+        page_directory_t *dir = table_owner(page_directory, ii);
+        pde_t entry = dir->tablesPhysical[ii];
+        if ((entry & PDE_PRESENT) > 0)                              /* Check the present bit */
         {
-            if (table_cb && table_cb(data, ii, page_directory->tables[ii]))
+            int action = table_cb ? table_cb(data, ii, dir->tables[ii]) : PG_DIR_WALK_CONTINUE;
+            if (action == PG_DIR_WALK_STOP)
             {
                 return;
             }
+            else if (action == PG_DIR_WALK_SKIP)
+            {
+                continue;
+            }
+
+            if (page_cb && (entry & PDE_LARGE))
+            {
+                /* Describe each 4k piece of the large page */
+                page_t page = { 0 };
+                page.present = 1;
+                page.rw = (entry & PDE_WRITABLE) ? 1 : 0;
+                page.user = (entry & PDE_USER) ? 1 : 0;
+                page.global = (entry & PDE_GLOBAL) ? 1 : 0;
 
-            if (page_cb)
+                for (uintptr_t jj = 0; jj < PAGES_PER_TABLE; jj++)
+                {
+                    memmgr_virtual_set_page_addr(&page, (entry & LARGE_PAGE_MASK) + jj * PAGE_SIZE);
+                    if (page_cb(data, ii, jj, &page))
+                    {
+                        return;
+                    }
+                }
+            }
+            else if (page_cb)
             {
-                for (int jj = 0; jj < 1024; jj++)
+                for (uintptr_t jj = 0; jj < PAGES_PER_TABLE; jj++)
                 {
-                    page_t *page = &page_directory->tables[ii]->pages[jj];
+                    page_t *page = &dir->tables[ii]->pages[jj];
                     if (page->present && page_cb(data, ii, jj, page))
                     {
                         return;
@@ -102,37 +407,287 @@ void page_directory_walk(page_directory_t* page_directory, pg_dir_table_cb* tabl
     }
 }
 
-/* Callback for finding a virtual address for a given physical address */
-static int phy_to_virt_page_cb(void* data, uintptr_t dir_offset, uintptr_t page_offset, page_t* page)
+page_directory_t *memmgr_virtual_current(void)
+{
+    return current_directories[cpu_id()];
+}
+
+page_directory_t *memmgr_virtual_kernel(void)
+{
+    return kernel_directory;
+}
+
+bool memmgr_virtual_sync_kernel(page_directory_t *page_directory, uintptr_t addr)
+{
+#ifdef MEMMGR_PAE
+    UNUSED(page_directory);
+    UNUSED(addr);
+    return false;                                                   /* The kernel half isn't a copy */
+#else
+    uintptr_t o_dir = addr / TABLE_SPAN;
+    if (o_dir < KERNEL_DIRECTORY_FIRST || page_directory == kernel_directory)
+    {
+        return false;
+    }
+
+    pde_t entry = kernel_directory->tablesPhysical[o_dir];
+    if (!(entry & PDE_PRESENT) || page_directory->tablesPhysical[o_dir] == entry)
+    {
+        return false;                                               /* A real fault */
+    }
+
+    page_directory->tablesPhysical[o_dir] = entry;                  /* Not present before, nothing to flush */
+    return true;
+#endif
+}
+
+void switch_page_directory(page_directory_t *new)
+{
+#ifndef MEMMGR_PAE
+    /* Even with new already loaded, the stack being switched to may be in a table it hasn't got */
+    if (new != kernel_directory && new->kernel_generation != __atomic_load_n(&kernel_generation, __ATOMIC_ACQUIRE))
+    {
+        spin_lock(&kernel_copy_lock);                               /* Copies of older entries can't land after newer ones */
+        uint32_t generation = __atomic_load_n(&kernel_generation, __ATOMIC_ACQUIRE);
+        for (uintptr_t ii = KERNEL_DIRECTORY_FIRST; ii < TABLES_PER_DIRECTORY; ii++)
+        {
+            new->tablesPhysical[ii] = kernel_directory->tablesPhysical[ii];
+        }
+        new->kernel_generation = generation;
+        spin_unlock(&kernel_copy_lock);
+    }
+#endif
+
+    uint32_t cpu = cpu_id();
+    if (current_directories[cpu] == new)
+    {
+        return;                                                     /* Keep the TLB */
+    }
+
+    current_directories[cpu] = new;
+    cpu_write_cr3(new->physicalAddr);                               /* Only flushes pages that aren't global */
+}
+
+void memmgr_virtual_set_kmap_windows(void *windows)
+{
+    kmap_windows = windows;
+}
+
+void *memmgr_virtual_kmap(phys_addr_t frame_addr)
+{
+    if (frame_addr < DIRECT_MAP_SIZE)
+    {
+        return PHY_TO_DIRECT(frame_addr);
+    }
+
+    uint8_t *window = kmap_windows + cpu_id() * PAGE_SIZE;
+    memmgr_virtual_map_page(get_page((uintptr_t)window, 0, kernel_directory), frame_addr, true, true);
+    memmgr_virtual_flush_addr(window);                              /* Only this cpu ever uses it */
+    return window;
+}
+
+void memmgr_virtual_set_table_alloc(page_directory_t *page_directory, pg_table_alloc_cb *table_alloc, void *data)
+{
+    page_directory->table_alloc = table_alloc;
+    page_directory->table_alloc_data = data;
+}
+
+page_t *get_page(uintptr_t address, int make, page_directory_t *dir)
+{
+    uintptr_t page = address / PAGE_SIZE;                           /* Convert address to page number */
+    uintptr_t o_dir = page / PAGES_PER_TABLE;                       /* Offset into page directory */
+    uintptr_t o_tbl = page % PAGES_PER_TABLE;                       /* Offset into page table */
+
+    dir = table_owner(dir, o_dir);
+    pde_t entry = dir->tablesPhysical[o_dir];
+    if (entry & PDE_LARGE)
+    {
+        return 0;                                                   /* No page_t to hand out */
+    }
+
+    if (!(entry & PDE_PRESENT))
+    {
+        if (!make || !dir->table_alloc)
+        {
+            return 0;
+        }
+
+        page_table_t *table = dir->table_alloc(dir->table_alloc_data);
+        if (!table)
+        {
+            return 0;
+        }
+
+        entry = memmgr_virtual_virt_to_phy(dir, table);
+        entry |= PDE_PRESENT | PDE_WRITABLE;                        /* The pages decide what is allowed */
+        entry |= (address < (uintptr_t)&KERNEL_BASE) ? PDE_USER : 0;
+
+        dir->tables[o_dir] = table;
+        dir->tablesPhysical[o_dir] = entry;
+        kernel_entries_changed(dir, o_dir);
+    }
+
+    return &dir->tables[o_dir]->pages[o_tbl];
+}
+
+bool memmgr_virtual_large_pages(void)
+{
+    return pse_enabled;
+}
+
+bool memmgr_virtual_nx(void)
+{
+#ifdef MEMMGR_PAE
+    return nx_enabled;
+#else
+    return false;
+#endif
+}
+
+bool memmgr_virtual_map_large(page_directory_t *page_directory, void *virt, phys_addr_t phys, uintptr_t n_pages, bool is_kernel, bool is_writable)
+{
+    uintptr_t first_dir = (uintptr_t)virt / LARGE_PAGE_SIZE;
+
+    page_directory = table_owner(page_directory, first_dir);
+    if (!pse_enabled || (uintptr_t)virt % LARGE_PAGE_SIZE != 0 || phys % LARGE_PAGE_SIZE != 0
+        || n_pages > TABLES_PER_DIRECTORY - first_dir)
+    {
+        return false;
+    }
+
+    for (uintptr_t ii = 0; ii < n_pages; ii++)
+    {
+        if (page_directory->tablesPhysical[first_dir + ii] & PDE_PRESENT)
+        {
+            return false;                                           /* Don't clobber existing mappings */
+        }
+    }
+
+    for (uintptr_t ii = 0; ii < n_pages; ii++)
+    {
+        pde_t entry = phys + ii * LARGE_PAGE_SIZE;
+        entry |= PDE_PRESENT | PDE_LARGE;
+        entry |= (is_writable) ? PDE_WRITABLE : 0;
+        entry |= (is_kernel) ? PDE_GLOBAL : PDE_USER;               /* Kernel pages are the same in every address space */
+#ifdef MEMMGR_PAE
+        entry |= (nx_enabled) ? PDE_NX : 0;
+#endif
+
+        page_directory->tables[first_dir + ii] = 0;
+        page_directory->tablesPhysical[first_dir + ii] = entry;
+    }
+    kernel_entries_changed(page_directory, first_dir);
+
+    return true;
+}
+
+void memmgr_virtual_direct_map(page_directory_t *page_directory, page_table_t *tables)
 {
-    uintptr_t **args = (uintptr_t**)data;
-    uintptr_t addr = *args[0];
-    uintptr_t *result = args[1];
+    uintptr_t first_dir = DIRECT_MAP_BASE / TABLE_SPAN;             /* First directory entry of the direct map */
 
-    if (page->present && page->frame == addr)
+    if (memmgr_virtual_map_large(page_directory, (void*)DIRECT_MAP_BASE, 0, DIRECT_MAP_TABLES, true, true))
     {
-        *result = dir_offset*1024u*PAGE_SIZE + page_offset*PAGE_SIZE;
-        return 1;                                                   /* Break early */
+        return;                                                     /* No page tables needed */
     }
 
-    return 0;                                                       /* Continue executing */
+    for (uintptr_t ii = 0; ii < DIRECT_MAP_TABLES; ii++)
+    {
+        page_table_t *table = &tables[ii];
+        for (uintptr_t jj = 0; jj < PAGES_PER_TABLE; jj++)
+        {
+            memmgr_virtual_map_page(&table->pages[jj], (ii * PAGES_PER_TABLE + jj) * PAGE_SIZE, true, true);
+        }
+
+        pde_t directoryEntry = memmgr_virtual_virt_to_phy(page_directory, table);
+        directoryEntry |= 0x3;                                      /* Present and writable */
+
+        page_directory->tables[first_dir + ii] = table;
+        page_directory->tablesPhysical[first_dir + ii] = directoryEntry;
+    }
+    kernel_entries_changed(page_directory, first_dir);
+}
+
+void memmgr_virtual_add_table(page_directory_t *page_directory, void *virt, page_table_t *table)
+{
+    uintptr_t o_dir = (uintptr_t)virt / TABLE_SPAN;                 /* Offset into page directory */
+
+    pde_t entry = (uintptr_t)table - (uintptr_t)&KERNEL_BASE;       /* The kernel image is mapped at KERNEL_BASE */
+    entry |= PDE_PRESENT | PDE_WRITABLE;                            /* The pages decide what is allowed */
+
+    page_directory->tables[o_dir] = table;
+    page_directory->tablesPhysical[o_dir] = entry;
+    kernel_entries_changed(page_directory, o_dir);
+}
+
+void memmgr_virtual_set_rmap(page_directory_t *page_directory, uint32_t *rmap, uintptr_t n_frames)
+{
+    page_directory->rmap = rmap;
+    page_directory->rmap_n_frames = n_frames;
+}
+
+void memmgr_virtual_rmap_add(page_directory_t *page_directory, phys_addr_t frame_addr, void *virt)
+{
+    if (frame_addr < DIRECT_MAP_SIZE)
+    {
+        return;                                                     /* The direct map covers it */
+    }
+
+    phys_addr_t rmap_idx = (frame_addr - DIRECT_MAP_SIZE) / PAGE_SIZE;
+    page_directory = table_owner(page_directory, KERNEL_DIRECTORY_FIRST);  /* Only the kernel maps frames by address */
+    if (rmap_idx < page_directory->rmap_n_frames)
+    {
+        page_directory->rmap[rmap_idx] = (uintptr_t)virt / PAGE_SIZE;
+    }
 }
 
 /*
- * Returns the lowest virtual address that corresponds to the physical
- * address, or ~0x0 if no mapping exists.
+ * Returns a virtual address that corresponds to the physical address, or
+ * ~0x0 if no mapping is known.
  */
-void *memmgr_virtual_phy_to_virt(page_directory_t* page_directory, uintptr_t addr)
+void *memmgr_virtual_phy_to_virt(page_directory_t* page_directory, phys_addr_t addr)
 {
+    if (addr < DIRECT_MAP_SIZE)
+    {
+        return PHY_TO_DIRECT(addr);
+    }
+
     uintptr_t offset = addr % PAGE_SIZE;                            /* Offset from page start */
-    addr /= PAGE_SIZE;                                              /* Only need 20 most sig. bits */
+    phys_addr_t rmap_idx = (addr - DIRECT_MAP_SIZE) / PAGE_SIZE;
+    page_directory = table_owner(page_directory, KERNEL_DIRECTORY_FIRST);
 
-    uintptr_t result = ~0;                                          /* Storage for the callback */
-    uintptr_t *args[] = {&addr, &result};                           /* Arguments for the callback */
-    page_directory_walk(page_directory, 0, &phy_to_virt_page_cb, &args);
+    if (rmap_idx >= page_directory->rmap_n_frames || page_directory->rmap[rmap_idx] == 0)
+    {
+        return (void*)~0;
+    }
 
-    result += offset;
-    return (void*)result;
+    return (void*)(page_directory->rmap[rmap_idx] * PAGE_SIZE + offset);
+}
+
+phys_addr_t memmgr_virtual_virt_to_phy(page_directory_t* page_directory, void *addr)
+{
+    uintptr_t page = (uintptr_t)addr / PAGE_SIZE;                   /* Convert address to page number */
+    uintptr_t o_dir = page / PAGES_PER_TABLE;                       /* Offset into page directory */
+    uintptr_t o_tbl = page % PAGES_PER_TABLE;                       /* Offset into page table */
+
+    page_directory = table_owner(page_directory, o_dir);
+    pde_t entry = page_directory->tablesPhysical[o_dir];
+    if (!(entry & PDE_PRESENT))                                     /* Check the present bit on page table */
+    {
+        return ~0;
+    }
+
+    if (entry & PDE_LARGE)
+    {
+        return (entry & LARGE_PAGE_MASK) + (uintptr_t)addr % LARGE_PAGE_SIZE;
+    }
+
+    page_t *pg = &page_directory->tables[o_dir]->pages[o_tbl];
+    if (!pg->present)
+    {
+        return ~0;
+    }
+
+    return memmgr_virtual_page_addr(pg) + (uintptr_t)addr % PAGE_SIZE;
 }
 
 #if (0)
@@ -150,28 +705,38 @@ static uint32_t memmgr_virtual_map_region(page_table_t* page_table, int table_id
 }
 #endif
 
-void memmgr_virtual_map_page(page_t *page, uintptr_t frame, bool is_kernel, bool is_writable)
+void memmgr_virtual_map_page(page_t *page, phys_addr_t frame, bool is_kernel, bool is_writable)
 {
+    *page = (page_t){ 0 };                                          /* Don't inherit stale bits */
     page->present = 1;
     page->rw = (is_writable) ? 1 : 0;
     page->user = (is_kernel) ? 0 : 1;
-    page->frame = frame / PAGE_SIZE;
+    page->global = (is_kernel) ? 1 : 0;                             /* Kernel pages are the same in every address space */
+    memmgr_virtual_set_page_addr(page, frame);
+#ifdef MEMMGR_PAE
+    page->nx = (nx_enabled) ? 1 : 0;
+#endif
 }
 
 void memmgr_virtual_flush_tlb(void)
 {
-    __asm__ volatile (
-        "mov eax, cr3;"
-        "mov cr3, eax;"
-    );
+    cpu_flush_tlb();
+}
+
+void memmgr_virtual_flush_tlb_global(void)
+{
+    if (!pge_enabled)
+    {
+        memmgr_virtual_flush_tlb();                                 /* Nothing is global */
+        return;
+    }
+
+    uint32_t cr4 = cpu_read_cr4();
+    cpu_write_cr4(cr4 & ~CR4_PGE);                                  /* Toggling PGE flushes everything */
+    cpu_write_cr4(cr4);
 }
 
 void memmgr_virtual_flush_addr(void* addr)
 {
-    __asm__ volatile (
-        "invlpg [%0]"
-        : /* No output values */
-        : "r" ((uintptr_t)addr)
-        : "memory"
-    );
+    cpu_invlpg((uintptr_t)addr);
 }
@@ -4,57 +4,279 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdalign.h>
-#include "registers.h"
+
+/*
+ * With MEMMGR_PAE the kernel uses PAE paging: 64 bit entries, 512 to a
+ * table, and a page directory pointer table in front of four page
+ * directories.  The four directories are allocated side by side, so they
+ * are treated as a single directory of TABLES_PER_DIRECTORY entries.
+ */
+#ifdef MEMMGR_PAE
+typedef uint64_t phys_addr_t;           /* A physical address, which can be above 4GB */
+typedef uint64_t pde_t;                 /* A page directory entry */
+
+#define PAGES_PER_TABLE (512u)
+#define TABLES_PER_DIRECTORY (2048u)
+#define DIRECTORY_PAGES (4u)            /* Pages taken up by the page directories */
+
+/* Size of the pages mapped by PDE_LARGE entries, and the frame bits of such an entry */
+#define LARGE_PAGE_SIZE (0x200000u)
+#define LARGE_PAGE_MASK (0x000FFFFFFFE00000ull)
+
+/* Physical memory above this is ignored, 36 bits is what 32 bit PAE processors address */
+#define MAX_PHYSICAL_ADDRESS (0x1000000000ull)
+#else
+typedef uintptr_t phys_addr_t;
+typedef uint32_t pde_t;
+
+#define PAGES_PER_TABLE (1024u)
+#define TABLES_PER_DIRECTORY (1024u)
+#define DIRECTORY_PAGES (1u)
+
+#define LARGE_PAGE_SIZE (0x400000u)
+#define LARGE_PAGE_MASK (0xFFC00000u)
+
+/* The last frame is given up, so that the limit fits in a phys_addr_t */
+#define MAX_PHYSICAL_ADDRESS (0xFFFFF000u)
+#endif
+
+/* Bytes of virtual memory covered by one page directory entry */
+#define TABLE_SPAN (PAGES_PER_TABLE * 0x1000u)
+
+/*
+ * The first directory entry of the kernel half, from KERNEL_BASE up. Every
+ * address space has the same kernel half, and its page tables are only
+ * kept track of in the kernel's directory.
+ */
+#define KERNEL_DIRECTORY_FIRST (0xC0000000u / TABLE_SPAN)
+
+/* Bits in a page directory entry */
+#define PDE_PRESENT (0x1)
+#define PDE_WRITABLE (0x2)
+#define PDE_USER (0x4)
+#define PDE_LARGE (0x80)                /* Maps a large page itself, rather than pointing at a page table */
+#define PDE_GLOBAL (0x100)              /* Only for PDE_LARGE entries */
+#ifdef MEMMGR_PAE
+#define PDE_NX (0x8000000000000000ull)  /* Not executable, once EFER.NXE is enabled */
+#endif
+
+/*
+ * The page table after the kernel image, which the structures the bootstrap
+ * built are remapped into.
+ */
+#define BOOTSTRAP_REMAP_BASE (0xC0400000u)
+
+/*
+ * The page table in the top 4MB, which bootinfo.c maps what the bootloader
+ * left in memory into, read only.
+ */
+#define BOOTINFO_BASE (0xFFC00000u)
+
+/*
+ * Physical memory from 0 up to DIRECT_MAP_SIZE is permanently mapped at
+ * DIRECT_MAP_BASE, 256MB above KERNEL_BASE, so that translating a physical
+ * address in that range is just an addition.
+ */
+#define DIRECT_MAP_BASE (0xD0000000u)
+#define DIRECT_MAP_SIZE (0x20000000u)
+#define DIRECT_MAP_TABLES (DIRECT_MAP_SIZE / TABLE_SPAN)
+
+/* Returns the direct mapped virtual address of a physical address below DIRECT_MAP_SIZE */
+#define PHY_TO_DIRECT(addr) ((void*)((uintptr_t)(addr) + DIRECT_MAP_BASE))
 
 struct page
 {
     uint32_t present    : 1;   // Page present in memory
     uint32_t rw         : 1;   // Read-only if clear, readwrite if set
     uint32_t user       : 1;   // Supervisor level only if clear
+    uint32_t pwt        : 1;   // Write-through caching if set
+    uint32_t pcd        : 1;   // Caching disabled if set
     uint32_t accessed   : 1;   // Has the page been accessed since last refresh?
     uint32_t dirty      : 1;   // Has the page been written to since last refresh?
-    uint32_t unused     : 7;   // Amalgamation of unused and reserved bits
+    uint32_t pat        : 1;   // Page attribute table index
+    uint32_t global     : 1;   // Survives CR3 reloads, once CR4.PGE is enabled
+    uint32_t avail      : 3;   // Free for the kernel to use
     uint32_t frame      : 20;  // Frame address (shifted right 12 bits)
+#ifdef MEMMGR_PAE
+    uint32_t frame_high : 20;  // Frame address bits 32 and up
+    uint32_t reserved   : 11;
+    uint32_t nx         : 1;   // Not executable, once EFER.NXE is enabled
+#endif
 };
 typedef struct page page_t;
 
+/* Returns the physical address of the frame a page maps */
+static inline phys_addr_t memmgr_virtual_page_addr(const page_t *page)
+{
+#ifdef MEMMGR_PAE
+    return ((phys_addr_t)page->frame_high << 32) | ((phys_addr_t)page->frame << 12);
+#else
+    return (phys_addr_t)page->frame << 12;
+#endif
+}
+
+/* Points a page at the frame at addr */
+static inline void memmgr_virtual_set_page_addr(page_t *page, phys_addr_t addr)
+{
+    page->frame = (addr >> 12) & 0xFFFFF;
+#ifdef MEMMGR_PAE
+    page->frame_high = (addr >> 32) & 0xFFFFF;
+#endif
+}
+
 struct page_table
 {
-   page_t pages[1024];
+   page_t pages[PAGES_PER_TABLE];
 };
 typedef struct page_table page_table_t;
 
+struct vma;
+struct page_directory;
+
+/* Returns a zeroed, page aligned page table for get_page to add to a directory, or null */
+typedef page_table_t *(pg_table_alloc_cb)(void *data);
+
 typedef struct page_directory
 {
     /**
-       Array of pointers to pagetables.
+       Array of pointers to pagetables. Null for entries that map a
+       large page directly (PDE_LARGE).
     **/
-    page_table_t *tables[1024];
+    page_table_t *tables[TABLES_PER_DIRECTORY];
     /**
        Array of pointers to the pagetables above, but gives their *physical*
        location, for loading into the CR3 register.
     **/
-    uint32_t *tablesPhysical;
+    pde_t *tablesPhysical;
     /**
        The physical address of tablesPhysical. This comes into play
        when we get our kernel heap allocated and the directory
-       may be in a different location in virtual memory.
+       may be in a different location in virtual memory. With PAE
+       it is the page directory pointer table in front of it instead.
     **/
     uintptr_t physicalAddr;
+    /**
+       Reverse map for frames above the direct map, holding the virtual page
+       number each frame is mapped at by the kernel, or 0 if it isn't.
+       rmap[0] describes the frame at DIRECT_MAP_SIZE.
+    **/
+    uint32_t *rmap;
+    uintptr_t rmap_n_frames;
+    /**
+       Where get_page gets new page tables from.
+    **/
+    pg_table_alloc_cb *table_alloc;
+    void *table_alloc_data;
+    /**
+       The memory areas page faults are resolved against, sorted by
+       address. See memmgr_vma.h.
+    **/
+    struct vma *vmas;
+    /**
+       Without PAE, the kernel generation the kernel half of tablesPhysical
+       was last copied at, see switch_page_directory.
+    **/
+    uint32_t kernel_generation;
 } page_directory_t;
 
 /**
   Sets up the environment, page directories etc and
   enables paging.
 **/
-void memmgr_virtual_bootstrap(page_directory_t *page_directory, page_table_t *page_table769);
+void memmgr_virtual_bootstrap(page_directory_t *page_directory, page_table_t *remap_table);
+
+/**
+ * Returns the page directory the cpu is using
+ */
+page_directory_t *memmgr_virtual_current(void);
+
+/**
+ * Returns the kernel's page directory, the one memmgr_virtual_bootstrap set
+ * up. The functions here look kernel half addresses up in it whichever
+ * directory they are given.
+ */
+page_directory_t *memmgr_virtual_kernel(void);
+
+/**
+ * Without PAE a directory's kernel half is a copy of the kernel's entries,
+ * so a page table the kernel makes afterwards is missing from it until the
+ * next switch_page_directory. If that is why addr faulted in
+ * page_directory, copies the entry over and returns true. Kernel directory entries are only ever added, so an entry that is
+ * there is never stale. Always false with PAE, where the kernel half is
+ * shared by reference.
+ */
+bool memmgr_virtual_sync_kernel(page_directory_t *page_directory, uintptr_t addr);
+
+/**
+ * Sets where get_page takes new page tables from
+ */
+void memmgr_virtual_set_table_alloc(page_directory_t *page_directory, pg_table_alloc_cb *table_alloc, void *data);
+
+/**
+ * Returns true if large pages (4MB, or 2MB with PAE) can be used
+ */
+bool memmgr_virtual_large_pages(void);
+
+/**
+ * Returns true if EFER.NXE was turned on, and pages are being mapped not
+ * executable. Other cpus have to turn it on too before they use them.
+ */
+bool memmgr_virtual_nx(void);
+
+/**
+ * Maps n_pages large pages of physically contiguous memory starting at phys
+ * to virt, both of which must be LARGE_PAGE_SIZE aligned, without using page
+ * tables. Returns false without mapping anything if large pages aren't
+ * supported, the addresses aren't aligned, or part of the range is already
+ * mapped. Like memmgr_virtual_map_page, the pages aren't executable if NX
+ * is available.
+ */
+bool memmgr_virtual_map_large(page_directory_t *page_directory, void *virt, phys_addr_t phys, uintptr_t n_pages, bool is_kernel, bool is_writable);
 
 /**
- * Returns the lowest virtual address that maps to the specified physical address.
- * If no such mapping can be found, it returns ~0. This function is woefully
- * inefficient, so avoid using it, especially once the page directory gets large.
+ * Maps the first DIRECT_MAP_SIZE bytes of physical memory at DIRECT_MAP_BASE.
+ * Large pages are used if possible, otherwise tables must point at
+ * DIRECT_MAP_TABLES page aligned page tables to do it with.
  */
-void *memmgr_virtual_phy_to_virt(page_directory_t* page_directory, uintptr_t addr);
+void memmgr_virtual_direct_map(page_directory_t *page_directory, page_table_t *tables);
+
+/**
+ * Puts table, which must be in the kernel image, into the directory to map
+ * the TABLE_SPAN bytes from virt. Its pages start out however they are.
+ */
+void memmgr_virtual_add_table(page_directory_t *page_directory, void *virt, page_table_t *table);
+
+/**
+ * Gives the page directory a reverse map for the n_frames frames above the
+ * direct map. rmap must hold n_frames entries, all of them zero.
+ */
+void memmgr_virtual_set_rmap(page_directory_t *page_directory, uint32_t *rmap, uintptr_t n_frames);
+
+/**
+ * Records that the frame at frame_addr is mapped at virt, if it is covered
+ * by the reverse map. memmgr_virtual_unmap removes the record again.
+ */
+void memmgr_virtual_rmap_add(page_directory_t *page_directory, phys_addr_t frame_addr, void *virt);
+
+/**
+ * Returns a virtual address that maps to the specified physical address: the
+ * direct map for low memory, or whatever the reverse map recorded above it.
+ * If no such mapping can be found, it returns ~0. Constant time.
+ */
+void *memmgr_virtual_phy_to_virt(page_directory_t* page_directory, phys_addr_t addr);
+
+/**
+ * Returns the physical address a virtual address maps to, or ~0 if it
+ * isn't mapped.
+ */
+phys_addr_t memmgr_virtual_virt_to_phy(page_directory_t* page_directory, void *addr);
+
+/**
+ * Values the callbacks return to page_directory_walk
+ */
+#define PG_DIR_WALK_CONTINUE (0)
+#define PG_DIR_WALK_STOP (1)
+#define PG_DIR_WALK_SKIP (2)        /* From table_cb, don't visit the pages in this table */
 
 /**
  * Callback signature for page_directory_walk
@@ -69,45 +291,126 @@ typedef int (pg_dir_page_cb)(void* data, uintptr_t dir_offset, uintptr_t page_of
 /**
  * Walks a page directory, calling table_cb for each present page table, and
  * page_cb for each present page.  Fairly expensive, so should be avoided
- * where possible.
+ * where possible.  A large page is passed to table_cb with a null table, then
+ * to page_cb as PAGES_PER_TABLE pages through a temporary page_t.
  */
 void page_directory_walk(page_directory_t* page_directory, pg_dir_table_cb* table_cb, pg_dir_page_cb* page_cb, void *data);
 
 /**
- * Removes the mapping for a specified virtual address
+ * Removes the mapping for a specified virtual address. If it is in a large
+ * page, the whole large page is unmapped.
  */
 void memmgr_virtual_unmap(page_directory_t* page_directory, void* addr);
 
 /**
- * Writes the proper values for a page_t
+ * Writes the proper values for a page_t. With PAE and a processor that has
+ * the NX bit, the page is not executable; code is only ever mapped by the
+ * bootstrap.
+ */
+void memmgr_virtual_map_page(page_t *page, phys_addr_t frame, bool is_kernel, bool is_writable);
+
+/**
+ * Gives memmgr_virtual_kmap MAX_CPUS pages at windows to map frames at, one
+ * for each cpu. Their page tables must already be there.
  */
-void memmgr_virtual_map_page(page_t *page, uintptr_t frame, bool is_kernel, bool is_writable);
+void memmgr_virtual_set_kmap_windows(void *windows);
 
 /**
- * Flush the entire tlb
+ * Returns where the frame at frame_addr can be read and written: in the
+ * direct map if it is there, otherwise through this cpu's window, which is
+ * mapped to it. Interrupts must stay disabled for as long as the window is
+ * used, and the next call on the cpu takes it over.
+ */
+void *memmgr_virtual_kmap(phys_addr_t frame_addr);
+
+/**
+ * Flush the entire tlb, except for global pages
  */
 void memmgr_virtual_flush_tlb(void);
 
+/**
+ * Flush the entire tlb, including global pages
+ */
+void memmgr_virtual_flush_tlb_global(void);
+
 /**
  * Flush the TLB entry that is associated with addr
  */
 void memmgr_virtual_flush_addr(void* addr);
 
+/**
+ * Ranges bigger than this many pages are flushed with a full TLB flush
+ * rather than an invlpg for each page.
+ */
+#define TLB_FLUSH_CEILING (33)
+
+/**
+ * Collects the virtual pages whose mappings changed, so that the TLB can be
+ * brought up to date once for the whole batch.  Only changes to pages that
+ * were present need adding; the TLB never caches a non-present page.
+ */
+struct tlb_gather
+{
+    uintptr_t start;                    /* First page number changed */
+    uintptr_t end;                      /* One past the last page number changed */
+    bool global;                        /* Whether any of them were global kernel pages */
+};
+typedef struct tlb_gather tlb_gather_t;
+
+/**
+ * Starts an empty batch
+ */
+void memmgr_virtual_gather_init(tlb_gather_t *gather);
+
+/**
+ * Adds n_pages pages starting at addr to the batch
+ */
+void memmgr_virtual_gather_add(tlb_gather_t *gather, void *addr, uintptr_t n_pages);
+
+/**
+ * Invalidates everything in the batch, one page at a time or with a full
+ * flush depending on its size, and empties it again. The other cpus are
+ * told to do the same through the shootdown callback, if one is set.
+ */
+void memmgr_virtual_gather_commit(tlb_gather_t *gather);
+
+/**
+ * Invalidates everything in the batch on this cpu only, for the other cpus
+ * to call when they are told about a batch.
+ */
+void memmgr_virtual_gather_flush(const tlb_gather_t *gather);
+
+/**
+ * Makes the other cpus invalidate a batch, and returns once they have
+ */
+typedef void (tlb_shootdown_cb)(const tlb_gather_t *gather);
+
+/**
+ * Sets what memmgr_virtual_gather_commit calls once other cpus are running
+ */
+void memmgr_virtual_set_shootdown(tlb_shootdown_cb *shootdown);
+
+/**
+ * Removes the mappings for n_pages pages from addr, adding them to gather
+ * instead of invalidating each one straight away.
+ */
+void memmgr_virtual_unmap_range(page_directory_t* page_directory, void* addr, uintptr_t n_pages, tlb_gather_t *gather);
+
 /**
   Causes the specified page directory to be loaded into the
-  CR3 register.
+  CR3 register, unless it already is. Global pages, the kernel's,
+  stay in the TLB. Interrupts must be disabled.
+  Without PAE the kernel half is copied again first if the kernel's
+  entries changed since it last was, so the stacks the scheduler is
+  switching between are always mapped; a page fault can't be taken on one.
 **/
 void switch_page_directory(page_directory_t *new);
 
 /**
   Retrieves a pointer to the page required.
   If make == 1, if the page-table in which this page should
-  reside isn't created, create it!
-**/
-page_t *get_page(uint32_t address, int make, page_directory_t *dir);
-
-/**
-  Handler for page faults.
+  reside isn't created, create it! Returns null if there is no
+  table and it can't be made, or the address is in a large page.
 **/
-void page_fault(registers_t regs);
+page_t *get_page(uintptr_t address, int make, page_directory_t *dir);
 #endif
@@ -0,0 +1,551 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "mem.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "kernel.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_frame_info.h"
+#include "memmgr_zero_pool.h"
+#include "memmgr_dumb.h"
+#include "memmgr_slab.h"
+#include "memmgr_vma.h"
+#include "idt.h"
+
+/* Where page faults get frames from */
+static memmgr_frame_cache_t *vma_frames;
+
+/* Protects every page directory's list of areas */
+static spinlock_t vma_lock;
+
+/*
+ * Serializes making page tables for new areas. It is separate from vma_lock
+ * because making a table can take dumb_alloc's lock, and a fault while that
+ * is held (on the reverse map) takes vma_lock.
+ */
+static spinlock_t table_lock;
+
+/*
+ * Internal Function Declarations
+ */
+static vma_t *find_locked(page_directory_t *page_directory, uintptr_t addr);
+static bool make_tables(page_directory_t *page_directory, uintptr_t first, uintptr_t last);
+static uintptr_t find_gap_locked(page_directory_t *page_directory, uintptr_t n_bytes);
+static bool link_locked(page_directory_t *page_directory, vma_t *vma);
+static void set_owner(phys_addr_t frame_addr, page_directory_t *page_directory);
+static bool frame_put(phys_addr_t frame_addr);
+static void copy_on_write(page_directory_t *page_directory, vma_t *vma, uintptr_t addr);
+
+
+void vma_init(memmgr_frame_cache_t *frame_cache)
+{
+    vma_frames = frame_cache;
+    vma_lock = SPINLOCK_INIT;
+    table_lock = SPINLOCK_INIT;
+    idt_set_handler(INT_PAGE_FAULT, &page_fault);
+
+    /* Never faulted in, each cpu maps whatever it needs into its page with interrupts disabled */
+    void *windows = vma_reserve(memmgr_virtual_kernel(), MAX_CPUS * PAGE_SIZE, VMA_WRITABLE | VMA_PHYSICAL);
+    if (!windows)
+    {
+        panic("No room for the kmap windows");
+    }
+    memmgr_virtual_set_kmap_windows(windows);
+}
+
+void vma_init_cow(void)
+{
+    cpu_write_cr0(cpu_read_cr0() | CR0_WP);
+}
+
+bool vma_add(page_directory_t *page_directory, void *start, uintptr_t size, uint32_t flags)
+{
+    uintptr_t first = (uintptr_t)start;
+    uintptr_t last = first + idivc(size, PAGE_SIZE) * PAGE_SIZE;
+
+    if (first % PAGE_SIZE != 0 || last <= first)
+    {
+        return false;
+    }
+
+    vma_t *vma = kmalloc(sizeof(vma_t));
+    if (!vma)
+    {
+        return false;
+    }
+    vma->start = first;
+    vma->end = last;
+    vma->flags = flags;
+
+    bool ok = make_tables(page_directory, first, last);        /* A page fault can't allocate them */
+
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&vma_lock);
+    ok = ok && link_locked(page_directory, vma);
+    spin_unlock(&vma_lock);
+    cpu_irq_restore(irq);
+
+    if (!ok)
+    {
+        kfree(vma);
+    }
+    return ok;
+}
+
+void *vma_reserve(page_directory_t *page_directory, uintptr_t size, uint32_t flags)
+{
+    uintptr_t n_bytes = idivc(size, PAGE_SIZE) * PAGE_SIZE;
+    if (n_bytes == 0)
+    {
+        return 0;
+    }
+
+    vma_t *vma = kmalloc(sizeof(vma_t));
+    if (!vma)
+    {
+        return 0;
+    }
+    vma->end = 0;
+    vma->flags = flags;
+
+    /*
+     * The page tables can't be made with vma_lock held, so they are made for
+     * the gap the last search found, and the area is only linked if the next
+     * search, under the same hold that links it, finds the same gap.
+     */
+    uintptr_t tables_at = 0;                                    /* Never a candidate, VMA_KERNEL_START is above it */
+    for (;;)
+    {
+        uint32_t irq = cpu_irq_save();
+        spin_lock(&vma_lock);
+
+        uintptr_t candidate = find_gap_locked(page_directory, n_bytes);
+        bool fits = candidate <= VMA_KERNEL_END && n_bytes <= VMA_KERNEL_END - candidate;
+        if (fits && candidate == tables_at)
+        {
+            vma->start = candidate;
+            vma->end = candidate + n_bytes;
+            link_locked(page_directory, vma);                   /* Can't overlap, the gap was found under this hold */
+        }
+
+        spin_unlock(&vma_lock);
+        cpu_irq_restore(irq);
+
+        if (vma->end != 0)
+        {
+            return (void*)vma->start;
+        }
+        if (!fits || !make_tables(page_directory, candidate, candidate + n_bytes))
+        {
+            kfree(vma);
+            return 0;
+        }
+        tables_at = candidate;
+    }
+}
+
+void *vma_map_physical(page_directory_t *page_directory, phys_addr_t phys, uintptr_t size, uint32_t flags)
+{
+    phys_addr_t first = phys & ~(phys_addr_t)(PAGE_SIZE - 1);
+    uintptr_t offset = phys - first;
+    uintptr_t n_pages = idivc(offset + size, PAGE_SIZE);
+
+    uint8_t *start = vma_reserve(page_directory, n_pages * PAGE_SIZE, flags | VMA_PHYSICAL);
+    if (!start)
+    {
+        return 0;
+    }
+
+    /* Nobody else knows about the area yet, so nothing can fault on it before it is mapped */
+    for (uintptr_t ii = 0; ii < n_pages; ii++)
+    {
+        page_t *page = get_page((uintptr_t)start + ii * PAGE_SIZE, 0, page_directory);
+        memmgr_virtual_map_page(page, first + ii * PAGE_SIZE, !(flags & VMA_USER), flags & VMA_WRITABLE);
+        if (flags & VMA_UNCACHED)
+        {
+            page->pcd = 1;
+            page->pwt = 1;
+        }
+    }
+
+    return start + offset;
+}
+
+void vma_release(page_directory_t *page_directory, void *start)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&vma_lock);
+
+    vma_t **link = &page_directory->vmas;
+    while (*link && (*link)->start != (uintptr_t)start)
+    {
+        link = &(*link)->next;
+    }
+
+    vma_t *vma = *link;
+    if (vma)
+    {
+        *link = vma->next;
+    }
+
+    spin_unlock(&vma_lock);
+    cpu_irq_restore(irq);
+
+    if (!vma)
+    {
+        return;
+    }
+
+    /* The TLB has to forget the pages before their frames can be reused */
+    uintptr_t n_pages = (vma->end - vma->start) / PAGE_SIZE;
+    tlb_gather_t gather;
+    memmgr_virtual_gather_init(&gather);
+    memmgr_virtual_unmap_range(page_directory, start, n_pages, &gather);
+    memmgr_virtual_gather_commit(&gather);
+
+    /*
+     * Unmapping only clears the present bit, so the frame is still there for
+     * the pages that were touched. Pages that never were are all zero, and
+     * frame 0 is never handed out.
+     */
+    for (uintptr_t addr = vma->start; addr < vma->end; addr += PAGE_SIZE)
+    {
+        page_t *page = get_page(addr, 0, page_directory);
+        phys_addr_t frame_addr = memmgr_virtual_page_addr(page);
+        if (frame_addr != 0 && !(vma->flags & VMA_PHYSICAL) && frame_put(frame_addr))
+        {
+            memmgr_frame_cache_free(vma_frames, frame_addr);
+        }
+        *page = (page_t){ 0 };
+    }
+
+    kfree(vma);
+}
+
+bool vma_copy(page_directory_t *from, page_directory_t *to)
+{
+    tlb_gather_t gather;                                        /* The pages from can no longer write */
+    memmgr_virtual_gather_init(&gather);
+    bool ok = true;
+
+    for (uintptr_t next = 0; ok; )
+    {
+        /* The next area up, copied so vma_add can run without vma_lock */
+        uint32_t irq = cpu_irq_save();
+        spin_lock(&vma_lock);
+        vma_t *vma = from->vmas;
+        while (vma && vma->start < next)
+        {
+            vma = vma->next;
+        }
+        vma_t area = vma ? *vma : (vma_t){ 0 };
+        spin_unlock(&vma_lock);
+        cpu_irq_restore(irq);
+
+        if (!vma)
+        {
+            break;
+        }
+        next = area.end;
+        if (!vma_add(to, (void*)area.start, area.end - area.start, area.flags))
+        {
+            ok = false;
+            break;
+        }
+
+        irq = cpu_irq_save();
+        spin_lock(&vma_lock);
+        if (find_locked(from, area.start) == vma && vma->end == area.end)  /* Not released in the meantime */
+        {
+            for (uintptr_t addr = area.start; ok && addr < area.end; addr += PAGE_SIZE)
+            {
+                page_t *page = get_page(addr, 0, from);
+                if (!page->present)
+                {
+                    continue;                                   /* Never touched, it faults in on its own */
+                }
+
+                if (!(area.flags & VMA_PHYSICAL))
+                {
+                    memmgr_frame_info_t *info = memmgr_frame_info(memmgr_virtual_page_addr(page));
+                    if (!info || info->shares == UINT16_MAX)
+                    {
+                        ok = false;
+                        break;
+                    }
+                    __atomic_add_fetch(&info->shares, 1, __ATOMIC_RELAXED);
+
+                    if (page->rw)
+                    {
+                        page->rw = 0;
+                        page->avail |= VMA_PAGE_COW;
+                        memmgr_virtual_gather_add(&gather, (void*)addr, 1);
+                    }
+                }
+
+                *get_page(addr, 0, to) = *page;
+            }
+        }
+        spin_unlock(&vma_lock);
+        cpu_irq_restore(irq);
+    }
+
+    memmgr_virtual_gather_commit(&gather);
+    return ok;
+}
+
+vma_t *vma_find(page_directory_t *page_directory, void *addr)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&vma_lock);
+    vma_t *vma = find_locked(page_directory, (uintptr_t)addr);
+    spin_unlock(&vma_lock);
+    cpu_irq_restore(irq);
+    return vma;
+}
+
+void page_fault(registers_t *regs)
+{
+    uintptr_t addr = cpu_read_cr2();                            /* Read it before anything else can fault */
+    if (memmgr_virtual_sync_kernel(memmgr_virtual_current(), addr))
+    {
+        return;                                                 /* A kernel page table newer than the address space */
+    }
+
+    /* Kernel areas are only in the kernel's list, whichever address space is loaded */
+    page_directory_t *page_directory = (addr >= (uintptr_t)&KERNEL_BASE) ? memmgr_virtual_kernel() : memmgr_virtual_current();
+
+    vma_t *vma = vma_find(page_directory, (void*)addr);
+    if (!vma)
+    {
+        panic("Page fault outside of any memory area");
+    }
+    if (vma->flags & VMA_PHYSICAL)
+    {
+        panic("Page fault in mapped physical memory");
+    }
+    if ((regs->err_code & PF_WRITE) && !(vma->flags & VMA_WRITABLE))
+    {
+        panic("Page fault writing to a read only memory area");
+    }
+    if ((regs->err_code & PF_USER) && !(vma->flags & VMA_USER))
+    {
+        panic("Page fault from user mode in a kernel memory area");
+    }
+    if (regs->err_code & PF_PRESENT)
+    {
+        if (!(regs->err_code & PF_WRITE))
+        {
+            panic("Page fault on a present page");
+        }
+        copy_on_write(page_directory, vma, addr);
+        return;
+    }
+
+    phys_addr_t frame_addr = zero_pool_alloc(ZERO_POOL_ZEROED);    /* Usually zeroed by the idle loop already */
+    if (frame_addr == MEMMGR_PHYSICAL_NONE)
+    {
+        panic("Out of memory in a page fault");
+    }
+
+    /*
+     * Another cpu may have faulted on the same page first, so whether it is
+     * still missing is checked under vma_lock, and only one frame is mapped.
+     */
+    page_t *page = get_page(addr, 0, page_directory);
+
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&vma_lock);
+    bool raced = page->present;
+    if (!raced)
+    {
+        memmgr_virtual_map_page(page, frame_addr, !(vma->flags & VMA_USER), vma->flags & VMA_WRITABLE);
+        set_owner(frame_addr, page_directory);
+    }
+    spin_unlock(&vma_lock);
+    cpu_irq_restore(irq);
+
+    if (raced)
+    {
+        zero_pool_free(frame_addr);                             /* Still zeroed */
+    }
+}
+
+/* Returns the area containing addr, vma_lock must be held */
+static vma_t *find_locked(page_directory_t *page_directory, uintptr_t addr)
+{
+    for (vma_t *vma = page_directory->vmas; vma && vma->start <= addr; vma = vma->next)
+    {
+        if (addr < vma->end)
+        {
+            return vma;
+        }
+    }
+    return 0;
+}
+
+/* Makes the page tables for every page from first up to last */
+static bool make_tables(page_directory_t *page_directory, uintptr_t first, uintptr_t last)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&table_lock);
+    bool ok = true;
+    for (uintptr_t addr = first; ok && addr < last; addr = (addr / TABLE_SPAN + 1) * TABLE_SPAN)
+    {
+        ok = get_page(addr, 1, page_directory) != 0;
+    }
+    spin_unlock(&table_lock);
+    cpu_irq_restore(irq);
+    return ok;
+}
+
+/* Returns the lowest address above VMA_KERNEL_START with room for n_bytes, leaving a guard page after every area */
+static uintptr_t find_gap_locked(page_directory_t *page_directory, uintptr_t n_bytes)
+{
+    uintptr_t candidate = VMA_KERNEL_START;
+
+    for (vma_t *vma = page_directory->vmas; vma; vma = vma->next)
+    {
+        if (vma->end + PAGE_SIZE <= candidate)
+        {
+            continue;                                           /* Below the search */
+        }
+        if (vma->start >= candidate + n_bytes + PAGE_SIZE)
+        {
+            break;                                              /* The gap before it is big enough */
+        }
+        candidate = vma->end + PAGE_SIZE;
+    }
+    return candidate;
+}
+
+/* Puts vma where it goes in the sorted list, unless it overlaps its neighbours */
+static bool link_locked(page_directory_t *page_directory, vma_t *vma)
+{
+    vma_t **link = &page_directory->vmas;
+    while (*link && (*link)->end <= vma->start)
+    {
+        link = &(*link)->next;
+    }
+
+    if (*link && (*link)->start < vma->end)
+    {
+        return false;
+    }
+    vma->next = *link;
+    *link = vma;
+    return true;
+}
+
+/* Records which address space a frame was faulted into */
+static void set_owner(phys_addr_t frame_addr, page_directory_t *page_directory)
+{
+    memmgr_frame_info_t *info = memmgr_frame_info(frame_addr);
+    if (info)
+    {
+        info->owner = page_directory;
+    }
+}
+
+/* Drops a mapping of a faulted in frame, returns true if it was the last, and the frame can be freed */
+static bool frame_put(phys_addr_t frame_addr)
+{
+    memmgr_frame_info_t *info = memmgr_frame_info(frame_addr);
+    if (!info)
+    {
+        return true;                                            /* Can't have been shared */
+    }
+
+    uint16_t shares = __atomic_load_n(&info->shares, __ATOMIC_RELAXED);
+    do
+    {
+        if (shares == 0)
+        {
+            info->owner = 0;
+            return true;
+        }
+    } while (!__atomic_compare_exchange_n(&info->shares, &shares, shares - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return false;
+}
+
+/*
+ * Resolves a write to a present page of a writable area: if the page is
+ * copy on write and its frame is still shared, it gets a copy of its own,
+ * otherwise it is just made writable again.
+ */
+static void copy_on_write(page_directory_t *page_directory, vma_t *vma, uintptr_t addr)
+{
+    void *page_addr = (void*)(addr & ~(uintptr_t)(PAGE_SIZE - 1));
+    page_t *page = get_page(addr, 0, page_directory);
+    phys_addr_t copy_addr = MEMMGR_PHYSICAL_NONE;
+    phys_addr_t shared_addr = MEMMGR_PHYSICAL_NONE;
+
+    tlb_gather_t gather;
+    memmgr_virtual_gather_init(&gather);
+
+    for (;;)
+    {
+        uint32_t irq = cpu_irq_save();
+        spin_lock(&vma_lock);
+
+        phys_addr_t frame_addr = memmgr_virtual_page_addr(page);
+        memmgr_frame_info_t *info = memmgr_frame_info(frame_addr);
+        bool cow = page->avail & VMA_PAGE_COW;
+        bool shared = cow && info && __atomic_load_n(&info->shares, __ATOMIC_ACQUIRE) > 0;
+
+        if (!cow)
+        {
+            if (!page->rw)
+            {
+                panic("Page fault writing to a read only page");
+            }
+            /* Another thread of the space got here first */
+        }
+        else if (!shared)
+        {
+            page->rw = 1;                                       /* The other mappings are gone */
+            page->avail &= ~VMA_PAGE_COW;
+            memmgr_virtual_flush_addr(page_addr);
+        }
+        else if (copy_addr != MEMMGR_PHYSICAL_NONE)
+        {
+            memcpy(memmgr_virtual_kmap(copy_addr), page_addr, PAGE_SIZE);
+
+            memmgr_virtual_map_page(page, copy_addr, !(vma->flags & VMA_USER), true);
+            set_owner(copy_addr, page_directory);
+            memmgr_virtual_gather_add(&gather, page_addr, 1);  /* Other cpus may still read the shared frame */
+            shared_addr = frame_addr;
+            copy_addr = MEMMGR_PHYSICAL_NONE;
+        }
+        else
+        {
+            spin_unlock(&vma_lock);
+            cpu_irq_restore(irq);
+
+            copy_addr = zero_pool_alloc(0);                     /* Then look again, it may not be needed by then */
+            if (copy_addr == MEMMGR_PHYSICAL_NONE)
+            {
+                panic("Out of memory copying a page on write");
+            }
+            continue;
+        }
+
+        spin_unlock(&vma_lock);
+        cpu_irq_restore(irq);
+        break;
+    }
+
+    memmgr_virtual_gather_commit(&gather);                      /* Before the shared frame can be freed */
+    if (shared_addr != MEMMGR_PHYSICAL_NONE && frame_put(shared_addr))
+    {
+        memmgr_frame_cache_free(vma_frames, shared_addr);       /* Its other mappings went while this copied */
+    }
+    if (copy_addr != MEMMGR_PHYSICAL_NONE)
+    {
+        memmgr_frame_cache_free(vma_frames, copy_addr);         /* Allocated, then not needed */
+    }
+}
+
@@ -0,0 +1,97 @@
+#ifndef _MEMMGR_VMA_H_
+#define _MEMMGR_VMA_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "registers.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_cache.h"
+
+/* Kernel virtual memory vma_reserve hands out, between the direct map and the top 4MB */
+#define VMA_KERNEL_START (DIRECT_MAP_BASE + DIRECT_MAP_SIZE)
+#define VMA_KERNEL_END (0xFFC00000u)
+
+/* Flags for a memory area */
+#define VMA_WRITABLE (0x1)
+#define VMA_USER (0x2)
+#define VMA_PHYSICAL (0x4)              /* Maps fixed physical memory, set by vma_map_physical */
+#define VMA_UNCACHED (0x8)              /* For vma_map_physical, caching disabled for device registers */
+
+/* In page_t.avail: the frame is shared until the page is written, when it gets a copy of its own */
+#define VMA_PAGE_COW (0x1)
+
+/* Bits in the error code of a page fault */
+#define PF_PRESENT (0x1)                /* The page was present, so it was a protection violation */
+#define PF_WRITE (0x2)                  /* The access was a write */
+#define PF_USER (0x4)                   /* The access came from ring 3 */
+
+/*
+ * A range of virtual memory that is backed by zero filled frames the first
+ * time each page is touched. Nothing is allocated for a page until then,
+ * except the page tables, which are created along with the area so that
+ * page faults never need them.
+ */
+struct vma
+{
+    uintptr_t start;                    /* First byte of the area, page aligned */
+    uintptr_t end;                      /* One past the last byte, page aligned */
+    uint32_t flags;
+    struct vma *next;                   /* The next area up */
+};
+typedef struct vma vma_t;
+
+/*
+ * Page faults take frames from frame_cache, and are handled by page_fault
+ * from here on. kmalloc must be ready, areas are allocated with it. Also
+ * reserves the pages memmgr_virtual_kmap maps frames at.
+ */
+void vma_init(memmgr_frame_cache_t *frame_cache);
+
+/*
+ * Lets areas be copied on write with vma_copy, which counts the mappings of
+ * each frame in its memmgr_frame_info descriptor. Turns on CR0.WP, so the
+ * kernel's writes to shared pages fault too; it has to be called before the
+ * other cpus start, they copy CR0.
+ */
+void vma_init_cow(void);
+
+/*
+ * Adds an area of size bytes at start, which must be page aligned. Returns
+ * false if it overlaps another area or a large page, or its page tables
+ * can't be allocated.
+ */
+bool vma_add(page_directory_t *page_directory, void *start, uintptr_t size, uint32_t flags);
+
+/*
+ * Finds room for an area of size bytes in the kernel's part of the address
+ * space and adds it. Areas are kept a page apart, so running off the end of
+ * one faults. Returns null if there isn't room.
+ */
+void *vma_reserve(page_directory_t *page_directory, uintptr_t size, uint32_t flags);
+
+/*
+ * Maps size bytes of physical memory starting at phys into a new area in
+ * the kernel's part of the address space, all up front. Returns the virtual
+ * address of phys, which needn't be page aligned, or null if there isn't
+ * room. The frames are never freed, not even by vma_release.
+ */
+void *vma_map_physical(page_directory_t *page_directory, phys_addr_t phys, uintptr_t size, uint32_t flags);
+
+/* Removes the area starting at start, and frees every frame that was faulted into it, once nothing shares it */
+void vma_release(page_directory_t *page_directory, void *start);
+
+/*
+ * Adds every area in from to to, which must have none of its own, sharing
+ * the frames faulted into them. Pages of writable areas are made read only
+ * in both, and copied the first time either writes to them. Returns false
+ * if it runs out of memory, or a frame has no descriptor or is shared too
+ * many times, leaving to partly copied.
+ */
+bool vma_copy(page_directory_t *from, page_directory_t *to);
+
+/* Returns the area containing addr, or null */
+vma_t *vma_find(page_directory_t *page_directory, void *addr);
+
+/* Handler for page faults, resolves the address against the current page directory's areas */
+void page_fault(registers_t *regs);
+#endif
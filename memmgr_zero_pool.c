@@ -0,0 +1,207 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "mem.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "log.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_zero_pool.h"
+
+static memmgr_frame_cache_t *pool_frames = 0;
+
+/* The zeroed frames, a stack */
+static phys_addr_t pool[ZERO_POOL_MAX];
+static volatile uint32_t pool_count = 0;
+static spinlock_t pool_lock;
+
+static zero_pool_stats_t pool_stats;
+
+/* Set when the idle loop found no free frames to zero, so it sleeps instead until the pool is used again */
+static volatile bool refill_failed = false;
+
+/* Whether the cpu has SSE2's movnti, to zero frames for the pool without filling the cache with them */
+static bool has_movnti = false;
+
+/*
+ * Internal Function Declarations
+ */
+static phys_addr_t reclaim_frame(void);
+static void zero_frame(phys_addr_t frame_addr, bool for_pool);
+static void zero_movnti(void *page);
+
+
+void zero_pool_init(memmgr_frame_cache_t *frame_cache)
+{
+    pool_frames = frame_cache;
+    pool_lock = SPINLOCK_INIT;
+    has_movnti = (cpu_features_edx() & CPUID_1_EDX_SSE2) != 0;
+    memmgr_frame_cache_set_reclaim(frame_cache, &reclaim_frame);
+}
+
+phys_addr_t zero_pool_alloc(uint32_t flags)
+{
+    phys_addr_t frame_addr = MEMMGR_PHYSICAL_NONE;
+    refill_failed = false;
+
+    if (!(flags & ZERO_POOL_ZEROED))
+    {
+        frame_addr = memmgr_frame_cache_alloc_free(pool_frames);   /* Leave the zeroed ones for those that want them */
+        if (frame_addr != MEMMGR_PHYSICAL_NONE)
+        {
+            return frame_addr;
+        }
+    }
+
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&pool_lock);
+    if (pool_count > 0)
+    {
+        frame_addr = pool[--pool_count];
+        pool_stats.hits++;
+    }
+    else if (flags & ZERO_POOL_ZEROED)
+    {
+        pool_stats.misses++;
+    }
+    spin_unlock(&pool_lock);
+    cpu_irq_restore(irq);
+
+    if (frame_addr == MEMMGR_PHYSICAL_NONE && (flags & ZERO_POOL_ZEROED))
+    {
+        frame_addr = memmgr_frame_cache_alloc_free(pool_frames);
+        if (frame_addr != MEMMGR_PHYSICAL_NONE)
+        {
+            zero_frame(frame_addr, false);                      /* About to be used, so into the cache with it */
+        }
+    }
+    return frame_addr;
+}
+
+void zero_pool_free(phys_addr_t frame_addr)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&pool_lock);
+    bool kept = pool_count < ZERO_POOL_MAX;
+    if (kept)
+    {
+        pool[pool_count++] = frame_addr;
+    }
+    spin_unlock(&pool_lock);
+    cpu_irq_restore(irq);
+
+    if (!kept)
+    {
+        memmgr_frame_cache_free(pool_frames, frame_addr);
+    }
+}
+
+bool zero_pool_wants_refill(void)
+{
+    return pool_frames && !refill_failed && __atomic_load_n(&pool_count, __ATOMIC_RELAXED) < ZERO_POOL_MAX;
+}
+
+bool zero_pool_refill_one(void)
+{
+    if (!zero_pool_wants_refill())
+    {
+        return false;
+    }
+
+    phys_addr_t frame_addr = memmgr_frame_cache_alloc_free(pool_frames);   /* Not one of the pool's own */
+    if (frame_addr == MEMMGR_PHYSICAL_NONE)
+    {
+        refill_failed = true;                                   /* Memory is short, so better left free */
+        return false;
+    }
+    zero_frame(frame_addr, true);
+
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&pool_lock);
+    bool kept = pool_count < ZERO_POOL_MAX;                     /* Another cpu may have filled it meanwhile */
+    if (kept)
+    {
+        pool[pool_count++] = frame_addr;
+        pool_stats.refills++;
+    }
+    bool filled = kept && pool_count == ZERO_POOL_MAX;
+    spin_unlock(&pool_lock);
+    cpu_irq_restore(irq);
+
+    if (!kept)
+    {
+        memmgr_frame_cache_free(pool_frames, frame_addr);
+    }
+    else if (filled)
+    {
+        zero_pool_stats_t stats;                                /* Once per fill, so how well it keeps up shows in the log */
+        zero_pool_stats(&stats);
+        klog("zero_pool: full, %u hits, %u misses, %u refills, %u reclaims",
+             stats.hits, stats.misses, stats.refills, stats.reclaims);
+    }
+    return kept;
+}
+
+void zero_pool_stats(zero_pool_stats_t *stats)
+{
+    uint32_t irq = cpu_irq_save();
+    spin_lock(&pool_lock);
+    *stats = pool_stats;
+    stats->count = pool_count;
+    spin_unlock(&pool_lock);
+    cpu_irq_restore(irq);
+}
+
+/* Hands a zeroed frame back to the frame cache, which has no free ones left */
+static phys_addr_t reclaim_frame(void)
+{
+    phys_addr_t frame_addr = MEMMGR_PHYSICAL_NONE;
+
+    spin_lock(&pool_lock);
+    if (pool_count > 0)
+    {
+        frame_addr = pool[--pool_count];
+        pool_stats.reclaims++;
+    }
+    spin_unlock(&pool_lock);
+    return frame_addr;
+}
+
+/* Zeroes a frame through the direct map, or this cpu's kmap window */
+static void zero_frame(phys_addr_t frame_addr, bool for_pool)
+{
+    uint32_t irq = cpu_irq_save();                              /* The window is this cpu's until it's done */
+    void *page = memmgr_virtual_kmap(frame_addr);
+
+    if (for_pool && has_movnti)
+    {
+        zero_movnti(page);
+    }
+    else
+    {
+        memset(page, 0, PAGE_SIZE);
+    }
+
+    cpu_irq_restore(irq);
+}
+
+/* Zeroes a page with non-temporal stores, which go around the cache */
+static void zero_movnti(void *page)
+{
+    uint32_t *words = (uint32_t *)page;
+    for (uintptr_t ii = 0; ii < PAGE_SIZE / sizeof(uint32_t); ii += 4)
+    {
+        __asm__ volatile (
+            "movnti [%0], %1;"
+            "movnti [%0 + 4], %1;"
+            "movnti [%0 + 8], %1;"
+            "movnti [%0 + 12], %1;"
+            : /* No output values */
+            : "r" (words + ii), "r" (0)
+            : "memory"
+        );
+    }
+    __asm__ volatile ("sfence" : : : "memory");                 /* Visible before the frame is handed out */
+}
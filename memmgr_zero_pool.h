@@ -0,0 +1,56 @@
+#ifndef _MEMMGR_ZERO_POOL_H_
+#define _MEMMGR_ZERO_POOL_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "memmgr_virtual.h"
+
+/* Most zeroed frames the pool holds, 1MB of them */
+#define ZERO_POOL_MAX (256)
+
+/* Flags for zero_pool_alloc */
+#define ZERO_POOL_ZEROED (0x1)          /* The frame has to hold nothing but zeros */
+
+/* How often the pool was used, see zero_pool_stats */
+struct zero_pool_stats
+{
+    uint32_t hits;                      /* Zeroed frames taken from the pool */
+    uint32_t misses;                    /* Zeroed frames the pool had none of, zeroed on the spot */
+    uint32_t refills;                   /* Frames the idle loop zeroed into the pool */
+    uint32_t reclaims;                  /* Zeroed frames given back to frame_cache when it ran out */
+    uint32_t count;                     /* Zeroed frames in the pool right now */
+};
+typedef struct zero_pool_stats zero_pool_stats_t;
+
+/*
+ * Frames zeroed ahead of time by the idle loop, so the page fault path
+ * doesn't have to. The frames come from frame_cache, which takes them back
+ * before it fails an allocation. vma_init must have run, the frames above
+ * the direct map are zeroed through a page per cpu in the kernel's part of
+ * the address space.
+ */
+void zero_pool_init(memmgr_frame_cache_t *frame_cache);
+
+/*
+ * Allocates a frame, or returns MEMMGR_PHYSICAL_NONE if there are none left.
+ * With ZERO_POOL_ZEROED it comes zeroed, from the pool if it has one.
+ * Without, the pool is only used once frame_cache runs out.
+ */
+phys_addr_t zero_pool_alloc(uint32_t flags);
+
+/* Gives back a zeroed frame from zero_pool_alloc that was never written to */
+void zero_pool_free(phys_addr_t frame_addr);
+
+/* Returns true if the pool isn't full, and the last refill found a frame, for the idle loop */
+bool zero_pool_wants_refill(void);
+
+/*
+ * Zeroes one more frame into the pool, for the idle loop to call with
+ * interrupts enabled. Returns false if the pool is full or there are no
+ * free frames. Logs the pool's counters each time it fills up.
+ */
+bool zero_pool_refill_one(void);
+
+/* Fills in the pool's counters */
+void zero_pool_stats(zero_pool_stats_t *stats);
+#endif
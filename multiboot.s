@@ -5,9 +5,29 @@ FLAGS       equ  MODULEALIGN | MEMINFO  ; this is the Multiboot 'flag' field
 MAGIC       equ  0x1BADB002             ; 'magic number' lets bootloader find the header
 CHECKSUM    equ -(MAGIC + FLAGS)        ; checksum required
 
+; Without the address fields (flag bit 16) GRUB and QEMU's -kernel both load
+; kernel.bin by the physical addresses (AT() in linker.ld) of its ELF program
+; headers. Either way the header has to be in the first 8KB of the file, which
+; it is, since .multiboot comes first in the first segment.
+
 section .multiboot
 
 align 4
     dd MAGIC
     dd FLAGS
     dd CHECKSUM
+
+; The multiboot2 header, for loaders that look for it instead. It asks for
+; nothing beyond the defaults, which include the memory map.
+MB2_MAGIC   equ  0xE85250D6             ; 'magic number' for multiboot2 loaders
+MB2_ARCH    equ  0                      ; 32 bit protected mode i386
+
+align 8
+mb2_header:
+    dd MB2_MAGIC
+    dd MB2_ARCH
+    dd mb2_header_end - mb2_header      ; header length
+    dd -(MB2_MAGIC + MB2_ARCH + (mb2_header_end - mb2_header))
+    dw 0, 0                             ; end tag: type 0, no flags
+    dd 8                                ; and 8 bytes long
+mb2_header_end:
@@ -0,0 +1,75 @@
+#ifndef _MULTIBOOT2_H_
+#define _MULTIBOOT2_H_ 1
+
+#include <stdint.h>
+
+/* In eax when a multiboot2 loader jumps to the kernel */
+#define MULTIBOOT2_BOOTLOADER_MAGIC (0x36D76289)
+
+/* The info starts with its total size, and the tags follow, each 8 byte aligned */
+#define MULTIBOOT2_TAG_ALIGN (8)
+
+/* Tag types bootinfo.c knows */
+#define MULTIBOOT2_TAG_END (0)
+#define MULTIBOOT2_TAG_CMDLINE (1)
+#define MULTIBOOT2_TAG_BOOT_LOADER_NAME (2)
+#define MULTIBOOT2_TAG_MODULE (3)
+#define MULTIBOOT2_TAG_MMAP (6)
+#define MULTIBOOT2_TAG_ELF_SECTIONS (9)
+
+struct multiboot2_info
+{
+    uint32_t total_size;                /* Including this header and the end tag */
+    uint32_t reserved;
+};
+typedef struct multiboot2_info multiboot2_info_t;
+
+struct multiboot2_tag
+{
+    uint32_t type;
+    uint32_t size;                      /* Not including the padding to the next tag */
+};
+typedef struct multiboot2_tag multiboot2_tag_t;
+
+/* MULTIBOOT2_TAG_CMDLINE and MULTIBOOT2_TAG_BOOT_LOADER_NAME */
+struct multiboot2_tag_string
+{
+    uint32_t type;
+    uint32_t size;
+    char string[];
+};
+typedef struct multiboot2_tag_string multiboot2_tag_string_t;
+
+struct multiboot2_tag_module
+{
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start;
+    uint32_t mod_end;                   /* One past the last byte */
+    char cmdline[];
+};
+typedef struct multiboot2_tag_module multiboot2_tag_module_t;
+
+/* The entries are entry_size apart, and start with the same fields as multiboot_mmap_entry after its size */
+struct multiboot2_tag_mmap
+{
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+    uint8_t entries[];
+};
+typedef struct multiboot2_tag_mmap multiboot2_tag_mmap_t;
+
+/* The ELF section headers are inside the tag, rather than pointed at */
+struct multiboot2_tag_elf_sections
+{
+    uint32_t type;
+    uint32_t size;
+    uint32_t num;
+    uint32_t entsize;
+    uint32_t shndx;
+    uint8_t sections[];
+};
+typedef struct multiboot2_tag_elf_sections multiboot2_tag_elf_sections_t;
+#endif
@@ -0,0 +1,78 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "percpu.h"
+
+/* Access bytes of the GDT entries */
+#define GDT_PRESENT (0x80)
+#define GDT_SEGMENT (0x10)              /* Code or data, rather than a system segment */
+#define GDT_CODE (0x0A)                 /* Executable and readable */
+#define GDT_DATA (0x02)                 /* Writable */
+#define GDT_TSS_AVAILABLE (0x09)        /* 32 bit TSS that isn't busy */
+
+/* Flags in the top half of limit_hi_flags */
+#define GDT_PAGES (0x8)                 /* The limit counts 4k pages rather than bytes */
+#define GDT_32BIT (0x4)
+
+_Static_assert(offsetof(percpu_t, id) == 0, "cpu_id() reads gs:[0]");
+_Static_assert(offsetof(percpu_t, self) == 4, "percpu_get() reads gs:[4]");
+
+static percpu_t percpus[MAX_CPUS];
+
+static void set_entry(gdt_entry_t *entry, uintptr_t base, uint32_t limit, uint8_t access, uint8_t flags);
+
+
+void percpu_init(uint32_t cpu, uintptr_t stack_top)
+{
+    percpu_t *percpu = &percpus[cpu];
+    percpu->id = cpu;
+    percpu->self = percpu;
+
+    percpu->tss = (tss_t){ 0 };
+    percpu->tss.ss0 = GDT_KERNEL_DATA;
+    percpu->tss.esp0 = stack_top;
+    percpu->tss.iomap_base = sizeof(tss_t);
+
+    set_entry(&percpu->gdt[0], 0, 0, 0, 0);
+    set_entry(&percpu->gdt[GDT_KERNEL_CODE / 8], 0, 0xFFFFF, GDT_PRESENT | GDT_SEGMENT | GDT_CODE, GDT_PAGES | GDT_32BIT);
+    set_entry(&percpu->gdt[GDT_KERNEL_DATA / 8], 0, 0xFFFFF, GDT_PRESENT | GDT_SEGMENT | GDT_DATA, GDT_PAGES | GDT_32BIT);
+    set_entry(&percpu->gdt[GDT_TSS / 8], (uintptr_t)&percpu->tss, sizeof(tss_t) - 1, GDT_PRESENT | GDT_TSS_AVAILABLE, 0);
+    set_entry(&percpu->gdt[GDT_PERCPU / 8], (uintptr_t)percpu, sizeof(percpu_t) - 1, GDT_PRESENT | GDT_SEGMENT | GDT_DATA, GDT_32BIT);
+
+    gdt_ptr_t gdt_ptr;
+    gdt_ptr.limit = sizeof(percpu->gdt) - 1;
+    gdt_ptr.base = (uintptr_t)percpu->gdt;
+
+    /* CS is reloaded with a far return, the code segment is the same one at the same selector */
+    __asm__ volatile (
+        "lgdt [%0];"
+        "push %1;"
+        "push OFFSET 1f;"
+        "retf;"
+        "1: mov ds, %2;"
+        "mov es, %2;"
+        "mov fs, %2;"
+        "mov ss, %2;"
+        "mov gs, %3;"
+        "ltr %4;"
+        : /* No output values */
+        : "r" (&gdt_ptr), "i" (GDT_KERNEL_CODE), "r" (GDT_KERNEL_DATA), "r" (GDT_PERCPU), "r" ((uint16_t)GDT_TSS)
+        : "memory"
+    );
+}
+
+percpu_t *percpu_of(uint32_t cpu)
+{
+    return &percpus[cpu];
+}
+
+/* Fills in a segment descriptor */
+static void set_entry(gdt_entry_t *entry, uintptr_t base, uint32_t limit, uint8_t access, uint8_t flags)
+{
+    entry->limit_lo = limit & 0xFFFF;
+    entry->base_lo = base & 0xFFFF;
+    entry->base_mid = (base >> 16) & 0xFF;
+    entry->access = access;
+    entry->limit_hi_flags = ((limit >> 16) & 0x0F) | (flags << 4);
+    entry->base_hi = (base >> 24) & 0xFF;
+}
@@ -0,0 +1,75 @@
+#ifndef _PERCPU_H_
+#define _PERCPU_H_ 1
+
+#include <stdint.h>
+#include <stdalign.h>
+#include "cpu.h"
+
+/* Selectors in every cpu's GDT, the code and data segments match loader.s */
+#define GDT_KERNEL_CODE (0x08)
+#define GDT_KERNEL_DATA (0x10)
+#define GDT_TSS (0x18)
+#define GDT_PERCPU (0x20)               /* Based at the cpu's percpu_t, loaded into gs */
+#define GDT_ENTRIES (5)
+
+struct gdt_entry
+{
+    uint16_t limit_lo;                  /* Bits 0-15 of the limit */
+    uint16_t base_lo;                   /* Bits 0-15 of the base */
+    uint8_t base_mid;                   /* Bits 16-23 of the base */
+    uint8_t access;                     /* Present, privilege level and type */
+    uint8_t limit_hi_flags;             /* Bits 16-19 of the limit, then granularity and size */
+    uint8_t base_hi;                    /* Bits 24-31 of the base */
+} __attribute__((packed));
+typedef struct gdt_entry gdt_entry_t;
+
+struct gdt_ptr
+{
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+typedef struct gdt_ptr gdt_ptr_t;
+
+/* The 32 bit task state segment, only ss0 and esp0 are used, for interrupts from ring 3 */
+struct tss
+{
+    uint32_t prev_task;
+    uint32_t esp0, ss0, esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;                /* Past the end, so there is no I/O permission bitmap */
+} __attribute__((packed));
+typedef struct tss tss_t;
+
+/* State each cpu keeps for itself, reachable through gs */
+struct percpu
+{
+    alignas(CACHE_LINE_SIZE) uint32_t id;   /* Index of the cpu, cpu_id() reads it so it comes first */
+    struct percpu *self;                    /* Where this is, percpu_get() reads it through gs */
+    uint32_t apic_id;                       /* Local APIC id, once smp_init has found it */
+    alignas(8) gdt_entry_t gdt[GDT_ENTRIES];
+    tss_t tss;
+};
+typedef struct percpu percpu_t;
+
+/*
+ * Loads cpu's own GDT and TSS on the calling cpu, and points gs at its
+ * percpu_t. stack_top is the stack interrupts from ring 3 switch to. Every
+ * cpu must call this before anything that uses cpu_id().
+ */
+void percpu_init(uint32_t cpu, uintptr_t stack_top);
+
+/* Returns the percpu_t of cpu, which doesn't have to be the one running */
+percpu_t *percpu_of(uint32_t cpu);
+
+/* Returns the percpu_t of the cpu this is running on */
+static inline percpu_t *percpu_get(void)
+{
+    percpu_t *self;
+    __asm__ volatile ("mov %0, gs:[4]" : "=r" (self));     /* The self field */
+    return self;
+}
+#endif
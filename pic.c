@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include "io.h"
+#include "idt.h"
+#include "pic.h"
+
+/* I/O ports of the two 8259s */
+#define PIC_MASTER_COMMAND (0x20)
+#define PIC_MASTER_DATA (0x21)
+#define PIC_SLAVE_COMMAND (0xA0)
+#define PIC_SLAVE_DATA (0xA1)
+
+#define ICW1_INIT (0x11)                /* Initialise, cascaded, expect ICW4 */
+#define ICW4_8086 (0x01)
+#define OCW2_EOI (0x20)
+#define OCW3_READ_ISR (0x0B)
+
+/* The spurious interrupt each PIC raises on its lowest priority line */
+#define PIC_SPURIOUS_MASTER (7)
+#define PIC_SPURIOUS_SLAVE (15)
+
+static void spurious_interrupt(registers_t *regs);
+
+void pic_init(void)
+{
+    outb(PIC_MASTER_COMMAND, ICW1_INIT);
+    io_wait();
+    outb(PIC_SLAVE_COMMAND, ICW1_INIT);
+    io_wait();
+    outb(PIC_MASTER_DATA, PIC_MASTER_VECTOR);           /* ICW2: vector offsets */
+    io_wait();
+    outb(PIC_SLAVE_DATA, PIC_SLAVE_VECTOR);
+    io_wait();
+    outb(PIC_MASTER_DATA, 0x04);                        /* ICW3: the slave is on IRQ2 */
+    io_wait();
+    outb(PIC_SLAVE_DATA, 0x02);                         /* and its cascade identity */
+    io_wait();
+    outb(PIC_MASTER_DATA, ICW4_8086);
+    io_wait();
+    outb(PIC_SLAVE_DATA, ICW4_8086);
+    io_wait();
+
+    pic_disable();
+    pic_unmask(2);                                      /* The slave is reached through IRQ2 */
+
+    idt_set_handler(PIC_MASTER_VECTOR + PIC_SPURIOUS_MASTER, &spurious_interrupt);
+    idt_set_handler(PIC_SLAVE_VECTOR + PIC_SPURIOUS_SLAVE - 8, &spurious_interrupt);
+}
+
+void pic_unmask(uint8_t irq)
+{
+    uint16_t port = (irq < 8) ? PIC_MASTER_DATA : PIC_SLAVE_DATA;
+    outb(port, inb(port) & ~(1u << (irq % 8)));
+}
+
+void pic_mask(uint8_t irq)
+{
+    uint16_t port = (irq < 8) ? PIC_MASTER_DATA : PIC_SLAVE_DATA;
+    outb(port, inb(port) | (1u << (irq % 8)));
+}
+
+void pic_disable(void)
+{
+    outb(PIC_MASTER_DATA, 0xFF);
+    outb(PIC_SLAVE_DATA, 0xFF);
+}
+
+void pic_eoi(uint8_t irq)
+{
+    if (irq >= 8)
+    {
+        outb(PIC_SLAVE_COMMAND, OCW2_EOI);
+    }
+    outb(PIC_MASTER_COMMAND, OCW2_EOI);
+}
+
+/* IRQ7 and IRQ15 also fire when a line drops before it is acknowledged, those aren't in service */
+static void spurious_interrupt(registers_t *regs)
+{
+    uint8_t irq = regs->int_no - PIC_MASTER_VECTOR;
+    if (irq >= 8)
+    {
+        irq = regs->int_no - PIC_SLAVE_VECTOR + 8;
+    }
+
+    uint16_t port = (irq < 8) ? PIC_MASTER_COMMAND : PIC_SLAVE_COMMAND;
+    outb(port, OCW3_READ_ISR);
+    if (inb(port) & (1u << (irq % 8)))
+    {
+        pic_eoi(irq);                                   /* A real one, nobody handles it though */
+        return;
+    }
+
+    if (irq >= 8)
+    {
+        outb(PIC_MASTER_COMMAND, OCW2_EOI);             /* The master did see the cascade */
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef _PIC_H_
+#define _PIC_H_ 1
+
+#include <stdint.h>
+
+/* Vectors the legacy interrupt controllers are moved to, out of the way of the exceptions */
+#define PIC_MASTER_VECTOR (0x20)
+#define PIC_SLAVE_VECTOR (0x28)
+
+/* IRQ lines */
+#define PIC_IRQ_TIMER (0)
+
+/* Remaps both PICs to PIC_MASTER_VECTOR and PIC_SLAVE_VECTOR, with every line masked */
+void pic_init(void);
+
+/* Lets irq through */
+void pic_unmask(uint8_t irq);
+
+/* Stops irq from being raised */
+void pic_mask(uint8_t irq);
+
+/* Masks every line, for when the local APICs take over */
+void pic_disable(void);
+
+/* Tells the PICs irq has been handled */
+void pic_eoi(uint8_t irq);
+#endif
@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include "util.h"
+#include "io.h"
+#include "pit.h"
+
+/* I/O ports of the 8254 */
+#define PIT_CHANNEL2 (0x42)
+#define PIT_COMMAND (0x43)
+
+#define PIT_CMD_CHANNEL2 (0x80)
+#define PIT_CMD_LOHI (0x30)             /* Low byte then high byte of the count */
+#define PIT_CMD_ONESHOT (0x00)          /* Mode 0, output goes high once the count runs out */
+
+/* The keyboard controller's port B, which gates channel 2 and reads its output */
+#define PIT_PORT_B (0x61)
+#define PORT_B_GATE2 (0x01)
+#define PORT_B_SPEAKER (0x02)
+#define PORT_B_OUT2 (0x20)
+
+/* Longest wait one count of channel 2 covers, in microseconds */
+#define PIT_MAX_WAIT_US (50000u)
+
+void pit_wait_us(uint32_t us)
+{
+    while (us > 0)
+    {
+        uint32_t chunk = (us > PIT_MAX_WAIT_US) ? PIT_MAX_WAIT_US : us;
+        uint32_t count = (uint32_t)udiv64((uint64_t)chunk * PIT_FREQUENCY, 1000000);
+        if (count == 0)
+        {
+            count = 1;
+        }
+
+        uint8_t port_b = inb(PIT_PORT_B) & ~PORT_B_SPEAKER;
+        outb(PIT_PORT_B, port_b & ~PORT_B_GATE2);               /* Hold the count until it is loaded */
+
+        outb(PIT_COMMAND, PIT_CMD_CHANNEL2 | PIT_CMD_LOHI | PIT_CMD_ONESHOT);
+        outb(PIT_CHANNEL2, count & 0xFF);
+        outb(PIT_CHANNEL2, (count >> 8) & 0xFF);
+
+        outb(PIT_PORT_B, port_b | PORT_B_GATE2);                /* Start counting */
+        while (!(inb(PIT_PORT_B) & PORT_B_OUT2))
+        {
+            __asm__ volatile ("pause");
+        }
+
+        us -= chunk;
+    }
+}
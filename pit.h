@@ -0,0 +1,11 @@
+#ifndef _PIT_H_
+#define _PIT_H_ 1
+
+#include <stdint.h>
+
+/* Frequency the 8254's counters run at */
+#define PIT_FREQUENCY (1193182u)
+
+/* Busy waits for us microseconds on channel 2, which works with interrupts disabled */
+void pit_wait_us(uint32_t us);
+#endif
@@ -0,0 +1,19 @@
+#ifndef _QEMU_H_
+#define _QEMU_H_ 1
+
+#include <stdint.h>
+#include "io.h"
+
+/* Port of the isa-debug-exit device bench_boot.sh starts QEMU with */
+#define QEMU_EXIT_PORT (0xF4)
+
+/* Codes for qemu_exit, QEMU's exit status is (code << 1) | 1 */
+#define QEMU_EXIT_SUCCESS (0)
+#define QEMU_EXIT_PANIC (1)
+
+/* Ends the run, without the device it's a write to an unused port and returns */
+static inline void qemu_exit(uint8_t code)
+{
+    outb(QEMU_EXIT_PORT, code);
+}
+#endif
@@ -2,11 +2,19 @@
 
 # This script can be used to quickly test MultiBoot-compliant
 # kernels.
+#
+# usage: run.sh [-k] [qemu options]
+#
+# With -k the kernel is booted by QEMU's own multiboot loader, with
+# COM1 and the monitor on stdio (ctrl-a c switches between them),
+# instead of through a GRUB image. It skips grub-mkrescue and the
+# GRUB menu, so it boots in well under a second.
 
 # ---- begin config params ----
 
 harddisk_image="bootable.iso"
 qemu_cmdline="kvm -monitor stdio"
+qemu_direct_cmdline="kvm -serial mon:stdio"
 kernel_args=""
 kernel_binary="kernel.bin"
 
@@ -24,6 +32,14 @@ function prereq() {
 	fi
 }
 
+if [ "$1" = "-k" ]; then
+	shift
+	prereq f "$kernel_binary"
+	$qemu_direct_cmdline "$@" -kernel "$kernel_binary" -append "$kernel_args"
+	echo
+	exit
+fi
+
 # check prerequisites
 prereq x grub-mkrescue grub2
 prereq x xorriso xorriso
@@ -0,0 +1,416 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "kernel.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_dumb.h"
+#include "memmgr_slab.h"
+#include "memmgr_zero_pool.h"
+#include "clock.h"
+#include "smp.h"
+#include "log.h"
+#include "sched.h"
+
+/* Switches stacks, from context.s */
+extern void context_switch(uintptr_t *old_esp, uintptr_t new_esp);
+
+static run_queue_t run_queues[MAX_CPUS];
+
+static volatile uint32_t next_thread_id = 0;
+
+/* A bit for each cpu that is running its idle thread, with its timer stopped */
+static volatile uint32_t idle_cpus = 0;
+
+/*
+ * Internal Function Declarations
+ */
+static thread_t *new_thread(const char *name);
+static void enqueue(run_queue_t *rq, thread_t *thread);
+static thread_t *dequeue(run_queue_t *rq);
+static thread_t *steal(uint32_t cpu);
+static void finish_switch(void);
+static void kick_idle(uint32_t target);
+static void thread_start(void) __attribute__((noreturn));
+
+
+void sched_init(void)
+{
+    for (uint32_t ii = 0; ii < MAX_CPUS; ii++)
+    {
+        run_queue_t *rq = &run_queues[ii];
+        rq->lock = SPINLOCK_INIT;
+        rq->head = 0;
+        rq->tail = 0;
+        rq->length = 0;
+        rq->current = 0;
+        rq->idle = 0;
+        rq->prev = 0;
+    }
+
+    sched_init_cpu();
+}
+
+void sched_init_cpu(void)
+{
+    thread_t *thread = new_thread("boot");
+    if (!thread)
+    {
+        panic("Could not allocate the first thread");
+    }
+
+    thread->state = THREAD_RUNNING;
+    thread->on_cpu = 1;
+    thread->cpu = cpu_id();
+    run_queues[thread->cpu].current = thread;               /* Running on the stack it was booted on */
+}
+
+thread_t *thread_create(const char *name, thread_entry_t *entry, void *arg)
+{
+    thread_t *thread = new_thread(name);
+    if (!thread)
+    {
+        return 0;
+    }
+
+    thread->stack = kmalloc(THREAD_STACK_SIZE);
+    if (!thread->stack)
+    {
+        kfree(thread);
+        return 0;
+    }
+    thread->entry = entry;
+    thread->arg = arg;
+
+    /* Make the stack look like context_switch was called from thread_start */
+    uint32_t *stack = (uint32_t *)((uintptr_t)thread->stack + THREAD_STACK_SIZE);
+    *--stack = 0;                                           /* thread_start's return address, it never returns */
+    *--stack = (uintptr_t)&thread_start;                    /* context_switch's return address */
+    *--stack = 0;                                           /* ebp */
+    *--stack = 0;                                           /* ebx */
+    *--stack = 0;                                           /* esi */
+    *--stack = 0;                                           /* edi */
+    thread->esp = (uintptr_t)stack;
+
+    uint32_t flags = cpu_irq_save();
+    run_queue_t *rq = &run_queues[cpu_id()];
+    thread->cpu = cpu_id();
+    spin_lock(&rq->lock);
+    enqueue(rq, thread);
+    spin_unlock(&rq->lock);
+    kick_idle(thread->cpu);
+    cpu_irq_restore(flags);
+
+    return thread;
+}
+
+void thread_exit(void)
+{
+    cpu_irq_save();                                         /* Never restored, the thread is gone */
+    sched_current()->state = THREAD_DEAD;
+    schedule();
+
+    panic("A dead thread was scheduled");
+}
+
+void thread_yield(void)
+{
+    schedule();
+}
+
+void thread_block(void)
+{
+    uint32_t flags = cpu_irq_save();                        /* A wake from an interrupt has to wait until we're off the cpu */
+    sched_current()->state = THREAD_BLOCKED;
+    schedule();
+    cpu_irq_restore(flags);
+}
+
+void thread_wake(thread_t *thread)
+{
+    while (__atomic_load_n(&thread->on_cpu, __ATOMIC_ACQUIRE))
+    {
+        __asm__ volatile ("pause");                         /* Still switching away from it */
+    }
+
+    uint32_t flags = cpu_irq_save();
+    run_queue_t *rq = &run_queues[thread->cpu];
+    spin_lock(&rq->lock);
+    bool woken = thread->state == THREAD_BLOCKED;
+    if (woken)
+    {
+        thread->state = THREAD_READY;
+        enqueue(rq, thread);
+    }
+    spin_unlock(&rq->lock);
+    if (woken)
+    {
+        kick_idle(thread->cpu);
+    }
+    cpu_irq_restore(flags);
+}
+
+thread_t *sched_current(void)
+{
+    return run_queues[cpu_id()].current;
+}
+
+void schedule(void)
+{
+    uint32_t flags = cpu_irq_save();
+    uint32_t cpu = cpu_id();
+    run_queue_t *rq = &run_queues[cpu];
+    thread_t *prev = rq->current;
+
+    spin_lock(&rq->lock);
+    if (prev->state == THREAD_RUNNING && prev != rq->idle)
+    {
+        prev->state = THREAD_READY;                         /* Back of the queue */
+        enqueue(rq, prev);
+    }
+    thread_t *next = dequeue(rq);
+    spin_unlock(&rq->lock);
+
+    if (!next)
+    {
+        next = steal(cpu);
+    }
+    if (!next)
+    {
+        next = rq->idle ? rq->idle : prev;                  /* Nothing to do */
+    }
+
+    next->state = THREAD_RUNNING;
+    next->cpu = cpu;
+
+    /* The timer only runs while there is a slice to end */
+    if (next == rq->idle)
+    {
+        clock_cancel();
+        __atomic_or_fetch(&idle_cpus, 1u << cpu, __ATOMIC_SEQ_CST);
+    }
+    else
+    {
+        clock_set_oneshot(SCHED_SLICE_NS);
+        __atomic_and_fetch(&idle_cpus, ~(1u << cpu), __ATOMIC_SEQ_CST);
+    }
+
+    if (next != prev)
+    {
+        next->on_cpu = 1;
+        rq->current = next;
+        rq->prev = prev;
+        switch_page_directory(next->page_directory ? next->page_directory : memmgr_virtual_kernel());
+        context_switch(&prev->esp, next->esp);
+        finish_switch();                                    /* Possibly on another cpu now */
+    }
+
+    cpu_irq_restore(flags);
+}
+
+void sched_tick(void)
+{
+    schedule();                                             /* The slice is used up */
+}
+
+void sched_idle(void)
+{
+    run_queue_t *rq = &run_queues[cpu_id()];
+
+    cpu_irq_save();
+    rq->idle = rq->current;
+    rq->idle->name = "idle";
+
+    for (;;)
+    {
+        schedule();                                         /* Runs anything that is ready, or steals it */
+
+        /*
+         * schedule() marked the cpu idle before this looks at the queue
+         * again, so a thread queued after this has seen it empty comes
+         * with a reschedule interrupt, which wakes the hlt.
+         */
+        if (__atomic_load_n(&rq->length, __ATOMIC_ACQUIRE) == 0)
+        {
+            if (log_pending())
+            {
+                cpu_irq_enable();                           /* Spare time goes on the log, a message at a time */
+                log_drain_one();
+            }
+            else if (zero_pool_wants_refill())
+            {
+                cpu_irq_enable();                           /* then on zeroing frames, a frame at a time */
+                zero_pool_refill_one();
+            }
+            else
+            {
+                cpu_idle();                                 /* Sleep until the next interrupt */
+            }
+        }
+        cpu_irq_save();
+    }
+}
+
+/* Allocates and fills in a thread control block, without a stack */
+static thread_t *new_thread(const char *name)
+{
+    thread_t *thread = kmalloc(sizeof(thread_t));
+    if (!thread)
+    {
+        return 0;
+    }
+
+    thread->esp = 0;
+    thread->id = __atomic_fetch_add(&next_thread_id, 1, __ATOMIC_RELAXED);
+    thread->name = name;
+    thread->state = THREAD_READY;
+    thread->on_cpu = 0;
+    thread->cpu = 0;
+    thread->stack = 0;
+    thread->entry = 0;
+    thread->arg = 0;
+    thread->page_directory = 0;
+    thread->next = 0;
+    return thread;
+}
+
+/* Adds a thread to the back of a run queue, its lock must be held */
+static void enqueue(run_queue_t *rq, thread_t *thread)
+{
+    thread->next = 0;
+    if (rq->tail)
+    {
+        rq->tail->next = thread;
+    }
+    else
+    {
+        rq->head = thread;
+    }
+    rq->tail = thread;
+    rq->length++;
+}
+
+/* Takes the thread from the front of a run queue, its lock must be held */
+static thread_t *dequeue(run_queue_t *rq)
+{
+    thread_t *thread = rq->head;
+    if (thread)
+    {
+        rq->head = thread->next;
+        if (!rq->head)
+        {
+            rq->tail = 0;
+        }
+        rq->length--;
+        thread->next = 0;
+    }
+    return thread;
+}
+
+/*
+ * Takes a thread from the cpu with the longest run queue. The thread
+ * closest to the back is taken, since its cache is the coldest, skipping
+ * any that are still being switched away from.
+ */
+static thread_t *steal(uint32_t cpu)
+{
+    run_queue_t *victim = 0;
+    for (uint32_t ii = 1; ii < MAX_CPUS; ii++)
+    {
+        run_queue_t *rq = &run_queues[(cpu + ii) % MAX_CPUS];
+        if (rq->length > 0 && (!victim || rq->length > victim->length))
+        {
+            victim = rq;                                    /* Racy, but only a hint */
+        }
+    }
+
+    if (!victim)
+    {
+        return 0;
+    }
+
+    spin_lock(&victim->lock);
+
+    thread_t *thread = 0;
+    thread_t *before = 0;
+    for (thread_t *prev = 0, *t = victim->head; t; prev = t, t = t->next)
+    {
+        if (!__atomic_load_n(&t->on_cpu, __ATOMIC_ACQUIRE))
+        {
+            thread = t;
+            before = prev;
+        }
+    }
+
+    if (thread)
+    {
+        if (before)
+        {
+            before->next = thread->next;
+        }
+        else
+        {
+            victim->head = thread->next;
+        }
+        if (victim->tail == thread)
+        {
+            victim->tail = before;
+        }
+        victim->length--;
+        thread->next = 0;
+    }
+
+    spin_unlock(&victim->lock);
+    return thread;
+}
+
+/* Runs on the new thread after every switch, once the old one's context is saved */
+static void finish_switch(void)
+{
+    run_queue_t *rq = &run_queues[cpu_id()];
+    thread_t *prev = rq->prev;
+    rq->prev = 0;
+
+    __atomic_store_n(&prev->on_cpu, 0, __ATOMIC_RELEASE);   /* Other cpus can run it now */
+
+    if (prev->state == THREAD_DEAD && prev->stack)
+    {
+        kfree(prev->stack);
+        kfree(prev);
+    }
+}
+
+/* Where a new thread starts, after its first switch */
+static void thread_start(void)
+{
+    finish_switch();
+    cpu_irq_enable();                                       /* schedule() switched with interrupts off */
+
+    thread_t *thread = sched_current();
+    thread->entry(thread->arg);
+    thread_exit();
+}
+
+/*
+ * Called after a thread was queued on target's run queue. If target is
+ * idle it is woken up to run it. Otherwise target is busy, and idle cpus
+ * have no timer to wake them, so one of them is woken up to steal it.
+ */
+static void kick_idle(uint32_t target)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);                /* The queue has to be seen to grow before idle_cpus is read */
+
+    uint32_t self = cpu_id();
+    uint32_t idle = __atomic_load_n(&idle_cpus, __ATOMIC_RELAXED) & ~(1u << self);
+    if (idle & (1u << target))
+    {
+        smp_send_reschedule(target);
+    }
+    else if (idle != 0)
+    {
+        smp_send_reschedule(__builtin_ctz(idle));
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include "cpu.h"
+#include "spinlock.h"
+
+/* Size of every thread's kernel stack */
+#define THREAD_STACK_SIZE (0x2000)
+
+/* How long a thread runs before it is preempted, if something else is waiting */
+#define SCHED_SLICE_NS (10000000u)
+
+/* Thread states */
+#define THREAD_READY (0)                /* On a run queue */
+#define THREAD_RUNNING (1)              /* Running on a cpu */
+#define THREAD_BLOCKED (2)              /* Waiting for thread_wake */
+#define THREAD_DEAD (3)                 /* Exited, freed once another thread is running */
+
+typedef void (thread_entry_t)(void *arg);
+
+struct thread
+{
+    uintptr_t esp;                      /* Saved stack pointer while it isn't running */
+    uint32_t id;
+    const char *name;
+    volatile uint32_t state;
+    volatile uint32_t on_cpu;           /* Set from being picked until its context is saved again */
+    uint32_t cpu;                       /* The cpu whose run queue it belongs to */
+    void *stack;                        /* Lowest address of its stack, null if it wasn't allocated here */
+    thread_entry_t *entry;
+    void *arg;
+    struct page_directory *page_directory;  /* Address space it runs in, null for just the kernel's. Set before it first runs */
+    struct thread *next;                /* Next thread in the run queue */
+};
+typedef struct thread thread_t;
+
+/* A cpu's threads that are ready to run, first in first out */
+struct run_queue
+{
+    alignas(CACHE_LINE_SIZE) spinlock_t lock;
+    thread_t *head;
+    thread_t *tail;
+    uint32_t length;
+    thread_t *current;                  /* The thread the cpu is running */
+    thread_t *idle;                     /* Runs when there's nothing else to */
+    thread_t *prev;                     /* The thread switched away from, until the switch is finished */
+};
+typedef struct run_queue run_queue_t;
+
+/* Sets up the run queues, and makes the caller the boot cpu's first thread. kmalloc must be ready */
+void sched_init(void);
+
+/* Makes the caller the first thread on the cpu it is running on, for the other cpus as they start */
+void sched_init_cpu(void);
+
+/* Creates a thread that calls entry(arg), and queues it on this cpu. Returns null if out of memory */
+thread_t *thread_create(const char *name, thread_entry_t *entry, void *arg);
+
+/* Ends the calling thread */
+void thread_exit(void) __attribute__((noreturn));
+
+/* Lets other threads run, the caller stays ready */
+void thread_yield(void);
+
+/* Stops the calling thread until thread_wake is called on it */
+void thread_block(void);
+
+/* Makes a blocked thread ready to run again */
+void thread_wake(thread_t *thread);
+
+/* Returns the thread running on this cpu */
+thread_t *sched_current(void);
+
+/*
+ * Switches to the next thread on this cpu's run queue, stealing one from
+ * the busiest other cpu if it is empty. The caller is queued again if it
+ * is still running. The cpu's timer is set to end the new thread's slice,
+ * or stopped if it is going idle.
+ */
+void schedule(void);
+
+/* Called from the timer interrupt with interrupts disabled, once a slice is used up */
+void sched_tick(void);
+
+/*
+ * Makes the caller this cpu's idle thread, which halts until there is
+ * something to run. No timer runs while it does, cpus with threads to
+ * spare send it a reschedule interrupt instead.
+ */
+void sched_idle(void) __attribute__((noreturn));
+#endif
@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "io.h"
+#include "serial.h"
+
+/* Registers of the 16550, as offsets from its base port */
+#define UART_DATA (0)                   /* Transmit/receive, or the divisor's low byte with DLAB set */
+#define UART_IER (1)                    /* Interrupt enable, or the divisor's high byte with DLAB set */
+#define UART_FCR (2)                    /* FIFO control */
+#define UART_LCR (3)                    /* Line control */
+#define UART_MCR (4)                    /* Modem control */
+#define UART_LSR (5)                    /* Line status */
+
+#define UART_CLOCK (115200u)            /* The divisor divides this down to the baud rate */
+
+#define LCR_8N1 (0x03)
+#define LCR_DLAB (0x80)                 /* Makes the first two registers the divisor */
+#define FCR_ENABLE (0x01)
+#define FCR_CLEAR (0x06)                /* Empty both FIFOs */
+#define FCR_TRIGGER_14 (0xC0)
+#define MCR_DTR_RTS (0x03)
+#define MCR_OUT2 (0x08)
+#define LSR_THR_EMPTY (0x20)            /* There is room for another byte */
+
+/* Whether serial_init found a port there */
+static bool present = false;
+
+void serial_init(void)
+{
+    uint16_t divisor = UART_CLOCK / SERIAL_BAUD;
+
+    outb(SERIAL_COM1 + UART_IER, 0x00);                 /* Polled, no interrupts */
+    outb(SERIAL_COM1 + UART_LCR, LCR_DLAB);
+    outb(SERIAL_COM1 + UART_DATA, divisor & 0xFF);
+    outb(SERIAL_COM1 + UART_IER, (divisor >> 8) & 0xFF);
+    outb(SERIAL_COM1 + UART_LCR, LCR_8N1);
+    outb(SERIAL_COM1 + UART_FCR, FCR_ENABLE | FCR_CLEAR | FCR_TRIGGER_14);
+    outb(SERIAL_COM1 + UART_MCR, MCR_DTR_RTS | MCR_OUT2);
+
+    /* Nothing on the bus reads back as all ones */
+    present = inb(SERIAL_COM1 + UART_LSR) != 0xFF;
+}
+
+void serial_putc(char c)
+{
+    if (!present)
+    {
+        return;
+    }
+
+    while (!(inb(SERIAL_COM1 + UART_LSR) & LSR_THR_EMPTY))
+    {
+        __asm__ volatile ("pause");
+    }
+    outb(SERIAL_COM1 + UART_DATA, (uint8_t)c);
+}
+
+void serial_write(const char *str)
+{
+    for (; *str != 0; str++)
+    {
+        if (*str == '\n')
+        {
+            serial_putc('\r');
+        }
+        serial_putc(*str);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _SERIAL_H_
+#define _SERIAL_H_ 1
+
+#include <stdint.h>
+
+/* I/O port of the first serial port */
+#define SERIAL_COM1 (0x3F8)
+
+/* Speed the port is set to, in bits per second */
+#define SERIAL_BAUD (115200u)
+
+/* Sets COM1 to SERIAL_BAUD, 8 data bits, no parity and one stop bit, with its FIFOs on */
+void serial_init(void);
+
+/* Writes c to COM1, waiting for room in the transmitter */
+void serial_putc(char c);
+
+/* Writes a string to COM1, with each '\n' sent as "\r\n" */
+void serial_write(const char *str);
+#endif
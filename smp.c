@@ -0,0 +1,253 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "mem.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "kernel.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_dumb.h"
+#include "memmgr_slab.h"
+#include "idt.h"
+#include "pit.h"
+#include "acpi.h"
+#include "lapic.h"
+#include "percpu.h"
+#include "clock.h"
+#include "log.h"
+#include "sched.h"
+#include "smp.h"
+
+/* The real mode code the other cpus start in, from trampoline.s */
+extern uint8_t trampoline_start[];
+extern uint8_t trampoline_data[];
+extern uint8_t trampoline_end[];
+
+/* What the trampoline needs from the boot cpu, at trampoline_data in the copy */
+struct trampoline_data
+{
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t efer;                      /* EFER bits to set, or 0 to leave it alone */
+    uint32_t stack;                     /* Top of the stack to call entry on */
+    uint32_t entry;
+};
+
+/* A TLB shootdown in progress, only one at a time */
+struct shootdown
+{
+    spinlock_t lock;
+    tlb_gather_t gather;
+    volatile uint32_t pending;          /* A bit for each cpu that hasn't flushed yet */
+};
+
+static uint32_t n_cpus = 1;
+
+/* A bit for each cpu that has loaded its GDT, and can be sent shootdowns */
+static volatile uint32_t cpus_online = 1;
+
+/* The cpu being started, and its stack. Only one is started at a time */
+static volatile uint32_t booting_cpu;
+static volatile uintptr_t booting_stack;
+static volatile uint32_t booting_done;
+
+static struct shootdown shootdown;
+
+/*
+ * Internal Function Declarations
+ */
+static bool start_cpu(uint32_t cpu, uint32_t apic_id, struct trampoline_data *data);
+static void ap_main(void) __attribute__((noreturn));
+static void tlb_shootdown(const tlb_gather_t *gather);
+static void nmi_interrupt(registers_t *regs);
+static void reschedule_interrupt(registers_t *regs);
+
+
+void smp_init(page_directory_t *page_directory)
+{
+    if (!acpi_init(page_directory))
+    {
+        return;
+    }
+
+    acpi_madt_t *madt = acpi_find_table("APIC");
+    if (!madt)
+    {
+        return;
+    }
+
+    percpu_get()->apic_id = lapic_id();
+
+    shootdown.lock = SPINLOCK_INIT;
+    shootdown.pending = 0;
+    idt_set_handler(INT_NMI, &nmi_interrupt);
+    idt_set_handler(INT_IPI, &reschedule_interrupt);
+
+    /* The first megabyte is never handed out, and stays identity mapped for the trampoline to turn paging on from */
+    uintptr_t size = trampoline_end - trampoline_start;
+    if (size > PAGE_SIZE)
+    {
+        panic("The AP trampoline doesn't fit in a page");
+    }
+
+    uint8_t *copy = PHY_TO_DIRECT(TRAMPOLINE_BASE);
+    memcpy(copy, trampoline_start, size);
+
+    struct trampoline_data *data = (struct trampoline_data*)(copy + (trampoline_data - trampoline_start));
+    data->cr0 = cpu_read_cr0();
+    data->cr3 = cpu_read_cr3();
+    data->cr4 = cpu_read_cr4();
+    data->efer = memmgr_virtual_nx() ? (uint32_t)EFER_NXE : 0;
+    data->entry = (uintptr_t)&ap_main;
+
+    /* Every cpu that is running from here on has to hear about TLB changes */
+    memmgr_virtual_set_shootdown(&tlb_shootdown);
+
+    uint8_t *entry = madt->entries;
+    uint8_t *end = (uint8_t*)madt + madt->header.length;
+    while (entry + sizeof(acpi_madt_entry_t) <= end && n_cpus < MAX_CPUS)
+    {
+        acpi_madt_lapic_t *lapic_entry = (acpi_madt_lapic_t*)entry;
+        if (lapic_entry->entry.type == ACPI_MADT_LAPIC
+            && (lapic_entry->flags & ACPI_MADT_LAPIC_ENABLED)
+            && lapic_entry->apic_id != percpu_get()->apic_id)
+        {
+            if (start_cpu(n_cpus, lapic_entry->apic_id, data))
+            {
+                n_cpus++;
+            }
+        }
+
+        if (lapic_entry->entry.length == 0)
+        {
+            break;                                              /* Broken table, don't loop forever */
+        }
+        entry += lapic_entry->entry.length;
+    }
+
+    klog("smp: %u cpus running", n_cpus);
+}
+
+uint32_t smp_cpu_count(void)
+{
+    return n_cpus;
+}
+
+void smp_send_reschedule(uint32_t cpu)
+{
+    lapic_send_ipi(percpu_of(cpu)->apic_id, INT_IPI);
+}
+
+/* Sends a cpu INIT and startup IPIs, and waits for it to reach ap_main */
+static bool start_cpu(uint32_t cpu, uint32_t apic_id, struct trampoline_data *data)
+{
+    void *stack = kmalloc(THREAD_STACK_SIZE);
+    if (!stack)
+    {
+        return false;
+    }
+
+    percpu_of(cpu)->apic_id = apic_id;
+    booting_cpu = cpu;
+    booting_stack = (uintptr_t)stack + THREAD_STACK_SIZE;
+    booting_done = 0;
+    data->stack = booting_stack;
+
+    /* The INIT, startup, startup sequence from the Intel MultiProcessor Specification */
+    lapic_send_init(apic_id);
+    pit_wait_us(10000);
+    for (uint32_t ii = 0; ii < 2 && !booting_done; ii++)
+    {
+        lapic_send_startup(apic_id, TRAMPOLINE_BASE / PAGE_SIZE);
+        pit_wait_us(200);
+    }
+
+    for (uint32_t waited = 0; !booting_done && waited < SMP_START_TIMEOUT; waited += 100)
+    {
+        pit_wait_us(100);
+    }
+
+    /* The stack isn't freed if it never turned up, in case it still does */
+    if (!booting_done)
+    {
+        klog("smp: the cpu with APIC id %u didn't start", apic_id);
+    }
+    return booting_done;
+}
+
+/* Where the other cpus arrive from the trampoline */
+static void ap_main(void)
+{
+    uint32_t cpu = booting_cpu;
+
+    percpu_init(cpu, booting_stack);                            /* cpu_id() works from here on */
+    idt_load();
+    lapic_enable();
+    clock_init_cpu();
+    __atomic_or_fetch(&cpus_online, 1u << cpu, __ATOMIC_SEQ_CST);
+
+    sched_init_cpu();                                           /* The boot stack becomes the first thread */
+    __atomic_store_n(&booting_done, 1, __ATOMIC_RELEASE);       /* The boot cpu can move on to the next one */
+    sched_idle();
+}
+
+/*
+ * Makes every other cpu invalidate a batch. They are sent NMIs, which they
+ * take even while spinning on a lock with interrupts disabled, so the wait
+ * can't deadlock on whatever lock the caller holds.
+ */
+static void tlb_shootdown(const tlb_gather_t *gather)
+{
+    uint32_t flags = cpu_irq_save();
+    uint32_t others = cpus_online & ~(1u << cpu_id());
+    if (others == 0)
+    {
+        cpu_irq_restore(flags);
+        return;
+    }
+
+    spin_lock(&shootdown.lock);
+    shootdown.gather = *gather;
+    __atomic_store_n(&shootdown.pending, others, __ATOMIC_RELEASE);
+
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        if (others & (1u << cpu))
+        {
+            lapic_send_nmi(percpu_of(cpu)->apic_id);
+        }
+    }
+
+    while (__atomic_load_n(&shootdown.pending, __ATOMIC_ACQUIRE) != 0)
+    {
+        __asm__ volatile ("pause");
+    }
+
+    spin_unlock(&shootdown.lock);
+    cpu_irq_restore(flags);
+}
+
+/* Non maskable interrupts are shootdowns, anything else is a hardware error */
+static void nmi_interrupt(registers_t *regs)
+{
+    UNUSED(regs);
+
+    uint32_t self = 1u << cpu_id();
+    if (!(__atomic_load_n(&shootdown.pending, __ATOMIC_ACQUIRE) & self))
+    {
+        panic("Non maskable interrupt");
+    }
+
+    memmgr_virtual_gather_flush(&shootdown.gather);
+    __atomic_and_fetch(&shootdown.pending, ~self, __ATOMIC_RELEASE);
+}
+
+/* Only wakes the cpu up, it looks at its run queue on the way back to its idle loop */
+static void reschedule_interrupt(registers_t *regs)
+{
+    UNUSED(regs);
+    lapic_eoi();
+}
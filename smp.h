@@ -0,0 +1,27 @@
+#ifndef _SMP_H_
+#define _SMP_H_ 1
+
+#include <stdint.h>
+#include "memmgr_virtual.h"
+
+/* Where the AP trampoline is copied, it matches trampoline.s */
+#define TRAMPOLINE_BASE (0x8000)
+
+/* How long a cpu gets to show up after its startup IPIs, in microseconds */
+#define SMP_START_TIMEOUT (100000)
+
+/*
+ * Finds the other cpus in the ACPI MADT and starts them. Each one loads its
+ * own GDT and TSS, makes its boot stack its first thread and parks in
+ * sched_idle. Afterwards TLB shootdowns reach every cpu. The scheduler, the
+ * boot cpu's local APIC and the clock must be ready. Without ACPI tables
+ * only the boot cpu runs.
+ */
+void smp_init(page_directory_t *page_directory);
+
+/* Returns how many cpus are running */
+uint32_t smp_cpu_count(void);
+
+/* Interrupts cpu, so that it looks at its run queue if it was idle */
+void smp_send_reschedule(uint32_t cpu);
+#endif
@@ -0,0 +1,32 @@
+#ifndef _SPINLOCK_H_
+#define _SPINLOCK_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef volatile uint32_t spinlock_t;
+
+#define SPINLOCK_INIT (0)
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+    {
+        while (*lock)
+        {
+            __asm__ volatile ("pause");     /* Spin on a plain read until it looks free */
+        }
+    }
+}
+
+/* Takes the lock if it is free, returns false without waiting if it isn't */
+static inline bool spin_trylock(spinlock_t *lock)
+{
+    return *lock == 0 && !__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+#endif
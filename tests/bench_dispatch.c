@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "util.h"
+#include "cpu.h"
+#include "registers.h"
+#include "harness.h"
+
+/* Times each stub is entered per measurement */
+#define BENCH_DISPATCHES (1u << 20)
+
+/*
+ * Copies of the generic and fast stubs in dispatch_int.s, which can't be
+ * assembled or entered through the IDT on the host. They are called
+ * instead of interrupted into, and end in ret where the real ones iret, so
+ * they time everything except int and iret, which both kinds share.
+ *
+ * The generic stub compares DS with bench_dispatch_skip_ds instead of
+ * KERNEL_DATA, so it can be made to take either path, and loads the host's
+ * own selectors instead of the kernel's. The fast stub has no interrupted CS
+ * on its stack, so it compares bench_dispatch_cs with KERNEL_CODE instead.
+ * Both load the host's GS, since the C library uses it.
+ */
+void (*bench_dispatch_handlers[256])(registers_t *regs);
+uint32_t bench_dispatch_skip_ds;
+uint32_t bench_dispatch_ds;
+uint32_t bench_dispatch_gs;
+uint32_t bench_dispatch_cs;
+
+void bench_dispatch_generic(void);
+void bench_dispatch_fast(void);
+
+__asm__ (
+    ".text\n"
+    "bench_dispatch_common:\n"
+    "    pusha\n"
+    "    mov     ax, gs\n"
+    "    push    eax\n"
+    "    mov     ax, ds\n"
+    "    push    eax\n"
+    "    cmp     ax, word ptr [bench_dispatch_skip_ds]\n"
+    "    je      1f\n"
+    "    mov     ax, word ptr [bench_dispatch_ds]\n"
+    "    mov     ds, ax\n"
+    "    mov     es, ax\n"
+    "    mov     fs, ax\n"
+    "    mov     ax, word ptr [bench_dispatch_gs]\n"
+    "    mov     gs, ax\n"
+    "1:\n"
+    "    cld\n"
+    "    mov     eax, [esp + 40]\n"
+    "    push    esp\n"
+    "    call    [bench_dispatch_handlers + eax*4]\n"
+    "    add     esp, 4\n"
+    "    pop     eax\n"
+    "    pop     edx\n"
+    "    cmp     ax, word ptr [bench_dispatch_skip_ds]\n"
+    "    je      2f\n"
+    "    mov     ds, ax\n"
+    "    mov     es, ax\n"
+    "    mov     fs, ax\n"
+    "    mov     gs, dx\n"
+    "2:\n"
+    "    popa\n"
+    "    add     esp, 8\n"
+    "    ret\n"
+    "\n"
+    ".globl bench_dispatch_generic\n"
+    "bench_dispatch_generic:\n"
+    "    push    0\n"
+    "    push    0x21\n"
+    "    jmp     bench_dispatch_common\n"
+    "\n"
+    ".globl bench_dispatch_fast\n"
+    "bench_dispatch_fast:\n"
+    "    push    0\n"
+    "    push    0x20\n"
+    "    pusha\n"
+    "    mov     eax, gs\n"
+    "    push    eax\n"
+    "    mov     eax, ds\n"
+    "    push    eax\n"
+    "    cmp     dword ptr [bench_dispatch_cs], 0x08\n"
+    "    je      3f\n"
+    "    mov     ax, word ptr [bench_dispatch_gs]\n"
+    "    mov     gs, ax\n"
+    "3:\n"
+    "    cld\n"
+    "    push    esp\n"
+    "    call    [bench_dispatch_handlers + 0x20*4]\n"
+    "    add     esp, 8\n"
+    "    pop     eax\n"
+    "    cmp     dword ptr [bench_dispatch_cs], 0x08\n"
+    "    je      4f\n"
+    "    mov     gs, ax\n"
+    "4:\n"
+    "    popa\n"
+    "    add     esp, 8\n"
+    "    ret\n"
+);
+
+/*
+ * Internal Function Declarations
+ */
+static void handler(registers_t *regs);
+static void report_cycles(const char *name, void (*stub)(void));
+
+
+/* What both vectors are handled by, so only the stubs differ */
+static void handler(registers_t *regs)
+{
+    bench_sink += regs->int_no;
+}
+
+static void report_cycles(const char *name, void (*stub)(void))
+{
+    uint64_t start = cpu_rdtsc();
+    for (uint32_t ii = 0; ii < BENCH_DISPATCHES; ii++)
+    {
+        __asm__ volatile ("call %0" : : "r" (stub) : "memory", "cc");
+    }
+    uint64_t tenths = (cpu_rdtsc() - start) * 10 / BENCH_DISPATCHES;
+    printf("%-48s %8llu.%llu cycles/op\n", name, (unsigned long long)(tenths / 10), (unsigned long long)(tenths % 10));
+}
+
+static void bench_stubs(void)
+{
+    uint16_t ds, gs;
+    __asm__ ("mov %0, ds" : "=r" (ds));
+    __asm__ ("mov %0, gs" : "=r" (gs));
+    bench_dispatch_ds = ds;
+    bench_dispatch_gs = gs;
+    bench_dispatch_handlers[0x20] = &handler;
+    bench_dispatch_handlers[0x21] = &handler;
+
+    bench_dispatch_skip_ds = ds;                                /* Interrupted the kernel, nothing to reload */
+    report_cycles("dispatch: generic stub, from the kernel", &bench_dispatch_generic);
+    bench_dispatch_skip_ds = 0;                                 /* Interrupted user code, every segment reloaded twice */
+    report_cycles("dispatch: generic stub, from user code", &bench_dispatch_generic);
+    bench_dispatch_cs = 0x08;                                   /* Interrupted the kernel, GS is already loaded */
+    report_cycles("dispatch: fast stub, from the kernel", &bench_dispatch_fast);
+    bench_dispatch_cs = 0x1B;                                   /* Interrupted user code, only GS reloaded */
+    report_cycles("dispatch: fast stub, from user code", &bench_dispatch_fast);
+}
+
+const test_case_t dispatch_benchmarks[] =
+{
+    { "dispatch stubs", bench_stubs },
+    { 0, 0 }
+};
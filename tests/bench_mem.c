@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "mem.h"
+#include "harness.h"
+
+/* Bytes each benchmark moves in total, divided between the calls */
+#define BENCH_BYTES (1u << 26)
+
+/* Big enough for the largest size, and one past it for the unaligned runs */
+#define BUFFER_SIZE (65536 + 64)
+
+typedef void *(bench_copy_t)(void *restrict dst, const void *restrict src, size_t n);
+typedef void *(bench_set_t)(void *dst, int c, size_t n);
+
+static const size_t sizes[] = { 16, 64, 256, 4096, 65536 };
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static _Alignas(64) uint8_t src_buffer[BUFFER_SIZE];
+static _Alignas(64) uint8_t dst_buffer[BUFFER_SIZE];
+
+/* The loops the kernel had before, a word at a time, with the compiler kept from turning them into calls */
+static void *__attribute__((optimize("no-tree-loop-distribute-patterns"))) copy_words(void *restrict dst, const void *restrict src, size_t n)
+{
+    uint32_t *to = dst;
+    const uint32_t *from = src;
+    for (size_t ii = 0; ii < n / sizeof(uint32_t); ii++)
+    {
+        to[ii] = from[ii];
+    }
+    return dst;
+}
+
+static void *__attribute__((optimize("no-tree-loop-distribute-patterns"))) set_words(void *dst, int c, size_t n)
+{
+    uint32_t *to = dst;
+    for (size_t ii = 0; ii < n / sizeof(uint32_t); ii++)
+    {
+        to[ii] = (uint8_t)c * 0x01010101u;
+    }
+    return dst;
+}
+
+/*
+ * Internal Function Declarations
+ */
+static void time_copy(const char *what, bench_copy_t *copy, size_t offset);
+static void time_set(const char *what, bench_set_t *set);
+
+
+static void time_copy(const char *what, bench_copy_t *copy, size_t offset)
+{
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        char name[64];
+        size_t n = sizes[ii];
+        uint32_t ops = BENCH_BYTES / n;
+        snprintf(name, sizeof(name), "mem: %s %zu bytes", what, n);
+
+        uint64_t start = bench_now_ns();
+        for (uint32_t jj = 0; jj < ops; jj++)
+        {
+            bench_sink = (uintptr_t)copy(dst_buffer + offset, src_buffer, n);
+        }
+        bench_report(name, bench_now_ns() - start, ops);
+    }
+}
+
+static void time_set(const char *what, bench_set_t *set)
+{
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        char name[64];
+        size_t n = sizes[ii];
+        uint32_t ops = BENCH_BYTES / n;
+        snprintf(name, sizeof(name), "mem: %s %zu bytes", what, n);
+
+        uint64_t start = bench_now_ns();
+        for (uint32_t jj = 0; jj < ops; jj++)
+        {
+            bench_sink = (uintptr_t)set(dst_buffer, (int)jj, n);
+        }
+        bench_report(name, bench_now_ns() - start, ops);
+    }
+}
+
+static void bench_copy(void)
+{
+    mem_init();
+    printf("ERMS %s\n", mem_has_erms() ? "supported" : "not supported");
+    time_copy("word loop copy", &copy_words, 0);
+    time_copy("rep movsd copy", &mem_copy_movsd, 0);
+    time_copy("rep movsb copy", &mem_copy_movsb, 0);
+    time_copy("rep movsd copy, unaligned", &mem_copy_movsd, 1);
+    time_copy("rep movsb copy, unaligned", &mem_copy_movsb, 1);
+}
+
+static void bench_set(void)
+{
+    time_set("word loop set", &set_words);
+    time_set("rep stosd set", &mem_set_stosd);
+    time_set("rep stosb set", &mem_set_stosb);
+}
+
+static void bench_move_compare(void)
+{
+    /* In the same buffer with dst above src, so the copy goes backwards */
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        char name[64];
+        size_t n = sizes[ii];
+        uint32_t ops = BENCH_BYTES / n;
+        snprintf(name, sizeof(name), "mem: move backwards %zu bytes", n);
+
+        uint64_t start = bench_now_ns();
+        for (uint32_t jj = 0; jj < ops; jj++)
+        {
+            bench_sink = (uintptr_t)mem_move(dst_buffer + 8, dst_buffer, n);
+        }
+        bench_report(name, bench_now_ns() - start, ops);
+    }
+
+    mem_copy_movsd(dst_buffer, src_buffer, BUFFER_SIZE);            /* Equal, so every byte is compared */
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        char name[64];
+        size_t n = sizes[ii];
+        uint32_t ops = BENCH_BYTES / n;
+        snprintf(name, sizeof(name), "mem: compare equal %zu bytes", n);
+
+        uint64_t start = bench_now_ns();
+        for (uint32_t jj = 0; jj < ops; jj++)
+        {
+            bench_sink = (uintptr_t)mem_compare(dst_buffer, src_buffer, n);
+        }
+        bench_report(name, bench_now_ns() - start, ops);
+    }
+}
+
+const test_case_t mem_benchmarks[] =
+{
+    { "mem copy", bench_copy },
+    { "mem set", bench_set },
+    { "mem move/compare", bench_move_compare },
+    { 0, 0 }
+};
@@ -0,0 +1,251 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "memmgr_buddy.h"
+#include "memmgr_frame.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_dumb.h"
+#include "sim.h"
+#include "harness.h"
+
+/* How many times each operation is timed, divided between the steps of a benchmark */
+#define BENCH_OPS (1u << 20)
+
+/* RAM of the simulated machine, big enough that the frame bitmap has four levels */
+#define BENCH_RAM (0xC0000000u)
+
+/* Rounds of alloc/free on top of an allocator that is already half full */
+static void bench_physical_alloc_free(void)
+{
+    memmgr_physical_t phy;
+    memmgr_physical_init(&phy, BENCH_RAM);
+    memmgr_physical_set_frames(&phy, malloc(memmgr_physical_size(&phy)));
+    for (uintptr_t ii = 0; ii < phy.n_frames / 2; ii++)
+    {
+        memmgr_physical_alloc(&phy, 1, PAGE_SIZE);
+    }
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / 2; ii++)
+    {
+        phys_addr_t addr = memmgr_physical_alloc(&phy, 1, PAGE_SIZE);
+        memmgr_physical_free(&phy, addr, 1);
+    }
+    bench_report("memmgr_physical: alloc+free 1 frame, half full", bench_now_ns() - start, BENCH_OPS);
+
+    start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / 2; ii++)
+    {
+        phys_addr_t addr = memmgr_physical_alloc(&phy, 16, 16 * PAGE_SIZE);
+        memmgr_physical_free(&phy, addr, 16);
+    }
+    bench_report("memmgr_physical: alloc+free 16 aligned frames", bench_now_ns() - start, BENCH_OPS);
+    free(phy.levels[0]);
+}
+
+/* Allocating every frame one at a time, and freeing them all again */
+static void bench_physical_fill(void)
+{
+    memmgr_physical_t phy;
+    memmgr_physical_init(&phy, BENCH_RAM);
+    memmgr_physical_set_frames(&phy, malloc(memmgr_physical_size(&phy)));
+
+    uint64_t start = bench_now_ns();
+    for (uintptr_t ii = 0; ii < phy.n_frames; ii++)
+    {
+        bench_sink = memmgr_physical_alloc(&phy, 1, PAGE_SIZE);
+    }
+    bench_report("memmgr_physical: alloc 1 frame until full", bench_now_ns() - start, phy.n_frames);
+
+    start = bench_now_ns();
+    for (uintptr_t ii = 0; ii < phy.n_frames; ii += 2)
+    {
+        memmgr_physical_free(&phy, (phys_addr_t)ii * PAGE_SIZE, 1);
+    }
+    bench_report("memmgr_physical: free every other frame", bench_now_ns() - start, phy.n_frames / 2);
+    free(phy.levels[0]);
+}
+
+static void bench_buddy_alloc_free(void)
+{
+    memmgr_physical_t phy;
+    memmgr_buddy_t buddy;
+    memmgr_physical_init(&phy, BENCH_RAM);
+    memmgr_physical_set_frames(&phy, malloc(memmgr_physical_size(&phy)));
+    memmgr_buddy_init(&buddy, BENCH_RAM);
+    memmgr_buddy_set_bitmaps(&buddy, malloc(memmgr_buddy_size(&buddy)));
+    memmgr_buddy_seed(&buddy, &phy, 0, phy.n_frames);
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / 2; ii++)
+    {
+        phys_addr_t addr = memmgr_buddy_alloc(&buddy, 1, PAGE_SIZE);
+        memmgr_buddy_free(&buddy, addr, 1);
+    }
+    bench_report("memmgr_buddy: alloc+free 1 frame", bench_now_ns() - start, BENCH_OPS);
+
+    start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / 2; ii++)
+    {
+        phys_addr_t addr = memmgr_buddy_alloc(&buddy, 16, PAGE_SIZE);
+        memmgr_buddy_free(&buddy, addr, 16);
+    }
+    bench_report("memmgr_buddy: alloc+free 16 frames", bench_now_ns() - start, BENCH_OPS);
+    free(phy.levels[0]);
+    free(buddy.orders[0].levels[0]);
+}
+
+static void bench_frame_cache(void)
+{
+    sim_t sim;
+    alignas(CACHE_LINE_SIZE) static memmgr_frame_cache_t cache;
+    sim_init(&sim, BENCH_RAM);
+    memmgr_frame_cache_init(&cache, sim.frames, MEMMGR_FRAME_CACHE_MAX_DEPTH / 2);
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / 2; ii++)
+    {
+        phys_addr_t addr = memmgr_frame_cache_alloc(&cache);
+        memmgr_frame_cache_free(&cache, addr);
+    }
+    bench_report("memmgr_frame_cache: alloc+free 1 frame", bench_now_ns() - start, BENCH_OPS);
+
+    /* Past the depth of the magazine, so it refills and drains */
+    phys_addr_t frames[MEMMGR_FRAME_CACHE_MAX_DEPTH];
+    start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / (2 * MEMMGR_FRAME_CACHE_MAX_DEPTH); ii++)
+    {
+        for (uint32_t jj = 0; jj < MEMMGR_FRAME_CACHE_MAX_DEPTH; jj++)
+        {
+            frames[jj] = memmgr_frame_cache_alloc(&cache);
+        }
+        for (uint32_t jj = 0; jj < MEMMGR_FRAME_CACHE_MAX_DEPTH; jj++)
+        {
+            memmgr_frame_cache_free(&cache, frames[jj]);
+        }
+    }
+    bench_report("memmgr_frame_cache: alloc+free bursts of 64", bench_now_ns() - start, BENCH_OPS);
+    sim_free(&sim);
+}
+
+static void bench_dumb_alloc_free(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    alignas(CACHE_LINE_SIZE) static memmgr_frame_cache_t cache;
+    sim_init(&sim, BENCH_RAM);
+    dumb_init(&dumb, &sim.directory);
+    memmgr_frame_cache_init(&cache, sim.frames, MEMMGR_FRAME_CACHE_MAX_DEPTH / 2);
+    dumb_set_frames(&dumb, &cache);
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS / 2; ii++)
+    {
+        void *addr = dumb_alloc(&dumb, PAGE_SIZE);
+        dumb_free(&dumb, addr, PAGE_SIZE);
+    }
+    bench_report("memmgr_dumb: alloc+free 1 page", bench_now_ns() - start, BENCH_OPS);
+    sim_free(&sim);
+}
+
+static void bench_phy_to_virt(void)
+{
+    sim_t sim;
+    sim_init(&sim, BENCH_RAM);
+    uintptr_t rmap_frames = (BENCH_RAM - DIRECT_MAP_SIZE) / PAGE_SIZE;
+    uint32_t *rmap = calloc(rmap_frames, sizeof(uint32_t));
+    memmgr_virtual_set_rmap(&sim.directory, rmap, rmap_frames);
+    for (uintptr_t ii = 0; ii < rmap_frames; ii += 2)
+    {
+        memmgr_virtual_rmap_add(&sim.directory, DIRECT_MAP_SIZE + (phys_addr_t)ii * PAGE_SIZE, (void*)(0x40000000 + ii * PAGE_SIZE));
+    }
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS; ii++)
+    {
+        bench_sink = (uintptr_t)memmgr_virtual_phy_to_virt(&sim.directory, (phys_addr_t)(ii * 4099u) % DIRECT_MAP_SIZE);
+    }
+    bench_report("memmgr_virtual: phy_to_virt, direct map", bench_now_ns() - start, BENCH_OPS);
+
+    start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS; ii++)
+    {
+        phys_addr_t addr = DIRECT_MAP_SIZE + (phys_addr_t)(ii * 4099u) % (BENCH_RAM - DIRECT_MAP_SIZE);
+        bench_sink = (uintptr_t)memmgr_virtual_phy_to_virt(&sim.directory, addr);
+    }
+    bench_report("memmgr_virtual: phy_to_virt, reverse map", bench_now_ns() - start, BENCH_OPS);
+    free(rmap);
+    sim_free(&sim);
+}
+
+static void bench_virt_to_phy(void)
+{
+    sim_t sim;
+    sim_init(&sim, BENCH_RAM);
+    uintptr_t kernel = (uintptr_t)&KERNEL_BASE + (uintptr_t)&_start_pa;
+    uintptr_t kernel_size = (uintptr_t)&_end_pa - (uintptr_t)&_start_pa;
+
+    uint64_t start = bench_now_ns();
+    for (uint32_t ii = 0; ii < BENCH_OPS; ii++)
+    {
+        bench_sink = memmgr_virtual_virt_to_phy(&sim.directory, (void*)(kernel + (ii * 4099u) % kernel_size));
+    }
+    bench_report("memmgr_virtual: virt_to_phy", bench_now_ns() - start, BENCH_OPS);
+    sim_free(&sim);
+}
+
+static int walk_page_cb(void *data, uintptr_t dir_offset, uintptr_t page_offset, page_t *page)
+{
+    UNUSED(dir_offset);
+    UNUSED(page_offset);
+    *(uintptr_t *)data += page->frame;
+    return PG_DIR_WALK_CONTINUE;
+}
+
+static void bench_walk(void)
+{
+    sim_t sim;
+    sim_init(&sim, BENCH_RAM);
+    for (uintptr_t ii = 0; ii < 16 * PAGES_PER_TABLE; ii++)   /* Sixteen more full tables */
+    {
+        sim_map(&sim, 0x40000000 + ii * PAGE_SIZE, 0x10000000 + ii * PAGE_SIZE);
+    }
+
+    uintptr_t rounds = 1000;
+    uintptr_t sum = 0;
+    uint64_t start = bench_now_ns();
+    for (uintptr_t ii = 0; ii < rounds; ii++)
+    {
+        page_directory_walk(&sim.directory, 0, walk_page_cb, &sum);
+    }
+    bench_sink = sum;
+    bench_report("memmgr_virtual: page_directory_walk, 16k pages", bench_now_ns() - start, rounds);
+
+    memmgr_physical_t *phy = &sim.phy;
+    start = bench_now_ns();
+    for (uintptr_t ii = 0; ii < rounds; ii++)
+    {
+        memmgr_set_from_page_directory(phy, &sim.directory);
+    }
+    bench_report("memmgr_physical: set_from_page_directory", bench_now_ns() - start, rounds);
+    sim_free(&sim);
+}
+
+const test_case_t memmgr_benchmarks[] =
+{
+    { "physical alloc/free", bench_physical_alloc_free },
+    { "physical fill", bench_physical_fill },
+    { "buddy alloc/free", bench_buddy_alloc_free },
+    { "frame cache", bench_frame_cache },
+    { "dumb alloc/free", bench_dumb_alloc_free },
+    { "phy_to_virt", bench_phy_to_virt },
+    { "virt_to_phy", bench_virt_to_phy },
+    { "page_directory_walk", bench_walk },
+    { 0, 0 }
+};
@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 199309L   /* clock_gettime */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "harness.h"
+
+volatile uintptr_t bench_sink;
+
+/* Whether the running test has failed */
+static bool failed;
+
+/*
+ * Internal Function Declarations
+ */
+static uint32_t run_list(const test_case_t *tests, bool bench, const char *filter, uint32_t *n_failed);
+
+
+/*
+ * Runs every test, or every benchmark with "bench" as the first argument.
+ * Any other argument only runs the ones whose name contains it. Exits with
+ * 1 if a test failed.
+ */
+int main(int argc, char **argv)
+{
+    bool bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+    const char *filter = (argc > (bench ? 2 : 1)) ? argv[bench ? 2 : 1] : 0;
+    uint32_t n_run = 0;
+    uint32_t n_failed = 0;
+
+    if (bench)
+    {
+        run_list(memmgr_benchmarks, true, filter, &n_failed);
+        run_list(mem_benchmarks, true, filter, &n_failed);
+        run_list(dispatch_benchmarks, true, filter, &n_failed);
+        return 0;
+    }
+
+    n_run += run_list(memmgr_physical_tests, false, filter, &n_failed);
+    n_run += run_list(memmgr_virtual_tests, false, filter, &n_failed);
+    n_run += run_list(memmgr_dumb_tests, false, filter, &n_failed);
+    n_run += run_list(memmgr_frame_info_tests, false, filter, &n_failed);
+    n_run += run_list(mem_tests, false, filter, &n_failed);
+
+    printf("%u tests, %u failed\n", n_run, n_failed);
+    return n_failed ? 1 : 0;
+}
+
+void test_fail(const char *file, int line, const char *expr, uint64_t a, uint64_t b)
+{
+    if (a != b)
+    {
+        printf("    %s:%d: %s failed, 0x%llx != 0x%llx\n", file, line, expr, (unsigned long long)a, (unsigned long long)b);
+    }
+    else
+    {
+        printf("    %s:%d: %s failed\n", file, line, expr);
+    }
+    failed = true;
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void bench_report(const char *name, uint64_t elapsed_ns, uint64_t ops)
+{
+    uint64_t tenths = ops ? elapsed_ns * 10 / ops : 0;      /* Tenths of a nanosecond */
+    printf("%-48s %8llu.%llu ns/op\n", name, (unsigned long long)(tenths / 10), (unsigned long long)(tenths % 10));
+}
+
+/* Runs the tests in a list whose names contain filter, and returns how many ran */
+static uint32_t run_list(const test_case_t *tests, bool bench, const char *filter, uint32_t *n_failed)
+{
+    uint32_t n_run = 0;
+
+    for (const test_case_t *test = tests; test->name; test++)
+    {
+        if (filter && !strstr(test->name, filter))
+        {
+            continue;
+        }
+
+        host_cpu = (host_cpu_t){ 0 };
+        failed = false;
+        test->run();
+        n_run++;
+
+        if (!bench)
+        {
+            printf("%-60s %s\n", test->name, failed ? "FAIL" : "ok");
+        }
+        if (failed)
+        {
+            (*n_failed)++;
+        }
+    }
+    return n_run;
+}
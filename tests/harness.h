@@ -0,0 +1,80 @@
+#ifndef _HARNESS_H_
+#define _HARNESS_H_ 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * The host test harness. The memory managers are built for the host with
+ * HOSTED defined, and run against the simulated machine in sim.h. Each test
+ * file exports a list of tests ending in a null entry.
+ */
+struct test_case
+{
+    const char *name;
+    void (*run)(void);
+};
+typedef struct test_case test_case_t;
+
+/* Fails the running test, and returns from it, if cond is false */
+#define TEST_ASSERT(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            test_fail(__FILE__, __LINE__, #cond, 0, 0); \
+            return; \
+        } \
+    } while (0)
+
+/* Like TEST_ASSERT, but shows both values when they differ */
+#define TEST_ASSERT_EQ(a, b) \
+    do \
+    { \
+        uint64_t _a = (uint64_t)(a); \
+        uint64_t _b = (uint64_t)(b); \
+        if (_a != _b) \
+        { \
+            test_fail(__FILE__, __LINE__, #a " == " #b, _a, _b); \
+            return; \
+        } \
+    } while (0)
+
+/* Records a failure of the running test */
+void test_fail(const char *file, int line, const char *expr, uint64_t a, uint64_t b);
+
+/* Nanoseconds from a monotonic clock, for timing benchmarks */
+uint64_t bench_now_ns(void);
+
+/* Prints how long each of ops operations took, on average */
+void bench_report(const char *name, uint64_t elapsed_ns, uint64_t ops);
+
+/* Stops the compiler from optimising away a result the benchmark doesn't use */
+extern volatile uintptr_t bench_sink;
+
+/*
+ * What the HOSTED cpu.h functions do instead of touching the hardware, see
+ * host_cpu.c. The tests look at the flush counts.
+ */
+struct host_cpu
+{
+    uint32_t id;                        /* What cpu_id() returns */
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t cr3_writes;                /* cpu_write_cr3 calls */
+    uint32_t tlb_flushes;               /* cpu_flush_tlb calls */
+    uint32_t invlpgs;                   /* cpu_invlpg calls */
+};
+typedef struct host_cpu host_cpu_t;
+
+extern host_cpu_t host_cpu;
+
+extern const test_case_t memmgr_physical_tests[];
+extern const test_case_t memmgr_virtual_tests[];
+extern const test_case_t memmgr_dumb_tests[];
+extern const test_case_t memmgr_frame_info_tests[];
+extern const test_case_t mem_tests[];
+extern const test_case_t memmgr_benchmarks[];
+extern const test_case_t mem_benchmarks[];
+extern const test_case_t dispatch_benchmarks[];
+#endif
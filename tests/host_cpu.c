@@ -0,0 +1,94 @@
+#include <stdint.h>
+#include "util.h"
+#include "cpu.h"
+#include "harness.h"
+
+/*
+ * The HOSTED versions of the cpu.h functions that need ring 0 or the
+ * kernel's gs. Interrupts can't be disabled from user space, so the tests
+ * are single threaded and nothing is interrupted anyway.
+ */
+
+host_cpu_t host_cpu;
+
+uint32_t cpu_id(void)
+{
+    return host_cpu.id;
+}
+
+uint32_t cpu_read_cr2(void)
+{
+    return 0;
+}
+
+uint32_t cpu_read_cr0(void)
+{
+    return 0;
+}
+
+void cpu_write_cr0(uint32_t cr0)
+{
+    UNUSED(cr0);
+}
+
+uint32_t cpu_read_cr3(void)
+{
+    return host_cpu.cr3;
+}
+
+void cpu_write_cr3(uint32_t cr3)
+{
+    host_cpu.cr3 = cr3;
+    host_cpu.cr3_writes++;
+}
+
+uint32_t cpu_read_cr4(void)
+{
+    return host_cpu.cr4;
+}
+
+void cpu_write_cr4(uint32_t cr4)
+{
+    host_cpu.cr4 = cr4;
+}
+
+uint64_t cpu_read_msr(uint32_t msr)
+{
+    UNUSED(msr);
+    return 0;
+}
+
+void cpu_write_msr(uint32_t msr, uint64_t value)
+{
+    UNUSED(msr);
+    UNUSED(value);
+}
+
+void cpu_flush_tlb(void)
+{
+    host_cpu.tlb_flushes++;
+}
+
+void cpu_invlpg(uintptr_t addr)
+{
+    UNUSED(addr);
+    host_cpu.invlpgs++;
+}
+
+uint32_t cpu_irq_save(void)
+{
+    return 0;
+}
+
+void cpu_irq_enable(void)
+{
+}
+
+void cpu_idle(void)
+{
+}
+
+void cpu_irq_restore(uint32_t flags)
+{
+    UNUSED(flags);
+}
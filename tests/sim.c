@@ -0,0 +1,102 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "util.h"
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "memmgr_buddy.h"
+#include "memmgr_frame.h"
+#include "sim.h"
+
+/* The first megabyte, which the bootstrap identity maps */
+#define SIM_LOW_MEMORY (0x100000u)
+
+/*
+ * Internal Function Declarations
+ */
+static page_table_t *add_table(sim_t *sim, uintptr_t dir);
+
+
+void sim_init(sim_t *sim, phys_addr_t ram_size)
+{
+    memset(sim, 0, sizeof(*sim));
+    sim->ram_size = ram_size;
+    sim->directory.tablesPhysical = aligned_alloc(PAGE_SIZE, DIRECTORY_PAGES * PAGE_SIZE);
+    sim->tables = aligned_alloc(PAGE_SIZE, SIM_MAX_TABLES * sizeof(page_table_t));
+    memset(sim->directory.tablesPhysical, 0, DIRECTORY_PAGES * PAGE_SIZE);
+
+    for (uintptr_t addr = 0; addr < SIM_LOW_MEMORY; addr += PAGE_SIZE)
+    {
+        sim_map(sim, addr, addr);
+    }
+
+    uintptr_t kernel_base = (uintptr_t)&KERNEL_BASE;
+    for (uintptr_t ii = 0; ii < SIM_KERNEL_TABLES; ii++)
+    {
+        add_table(sim, kernel_base / TABLE_SPAN + ii);
+    }
+    for (uintptr_t addr = (uintptr_t)&_start_pa; addr < (uintptr_t)&_end_pa; addr += PAGE_SIZE)
+    {
+        sim_map(sim, kernel_base + addr, addr);
+    }
+
+    /* What kmain does: only the frames nothing uses are free */
+    memmgr_physical_init(&sim->phy, ram_size);
+    sim->bitmap = malloc(memmgr_physical_size(&sim->phy));
+    memmgr_physical_set_frames(&sim->phy, sim->bitmap);
+    memmgr_physical_set_range(&sim->phy, 0, idivc((uintptr_t)&_end_pa, PAGE_SIZE));
+    memmgr_set_from_page_directory(&sim->phy, &sim->directory);
+
+#ifdef MEMMGR_BUDDY
+    memmgr_buddy_init(&sim->buddy, ram_size);
+    sim->buddy_bitmaps = malloc(memmgr_buddy_size(&sim->buddy));
+    memmgr_buddy_set_bitmaps(&sim->buddy, sim->buddy_bitmaps);
+    memmgr_buddy_seed(&sim->buddy, &sim->phy, 0, sim->phy.n_frames);
+    sim->frames = &sim->buddy;
+#else
+    sim->frames = &sim->phy;
+#endif
+}
+
+void sim_free(sim_t *sim)
+{
+    free(sim->directory.tablesPhysical);
+    free(sim->tables);
+    free(sim->bitmap);
+#ifdef MEMMGR_BUDDY
+    free(sim->buddy_bitmaps);
+#endif
+}
+
+void sim_map(sim_t *sim, uintptr_t virt, phys_addr_t phys)
+{
+    uintptr_t page = virt / PAGE_SIZE;
+    uintptr_t dir = page / PAGES_PER_TABLE;
+
+    page_table_t *table = sim->directory.tables[dir];
+    if (!(sim->directory.tablesPhysical[dir] & PDE_PRESENT))
+    {
+        table = add_table(sim, dir);
+    }
+    memmgr_virtual_map_page(&table->pages[page % PAGES_PER_TABLE], phys, virt >= (uintptr_t)&KERNEL_BASE, true);
+}
+
+phys_addr_t sim_table_phys(sim_t *sim, page_table_t *table)
+{
+    return SIM_TABLE_BASE + (phys_addr_t)(table - sim->tables) * PAGE_SIZE;
+}
+
+/* Takes the next page table and puts it in the directory at dir */
+static page_table_t *add_table(sim_t *sim, uintptr_t dir)
+{
+    if (sim->n_tables == SIM_MAX_TABLES)
+    {
+        abort();                                                /* A test needs more, raise SIM_MAX_TABLES */
+    }
+
+    page_table_t *table = &sim->tables[sim->n_tables++];
+    memset(table, 0, sizeof(*table));
+    sim->directory.tables[dir] = table;
+    sim->directory.tablesPhysical[dir] = sim_table_phys(sim, table) | PDE_PRESENT | PDE_WRITABLE;
+    return table;
+}
@@ -0,0 +1,51 @@
+#ifndef _SIM_H_
+#define _SIM_H_ 1
+
+#include <stdint.h>
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "memmgr_frame.h"
+
+/* Page tables the simulated machine can hand out, including the ones it starts with */
+#define SIM_MAX_TABLES (64)
+
+/* Present page tables from KERNEL_BASE up, for the kernel image and the dumb allocator */
+#define SIM_KERNEL_TABLES (4)
+
+/* Pretend physical address of the first page table, in low memory like the bootstrap's */
+#define SIM_TABLE_BASE (0x80000u)
+
+/*
+ * A simulated machine with ram_size bytes of RAM, and a page directory
+ * laid out like the one bootstrap.s hands to kmain: the first megabyte
+ * identity mapped, and the kernel image mapped at KERNEL_BASE with 4k
+ * pages. Its structures live in host memory, but the addresses in them
+ * are the simulated ones, so nothing they map can be dereferenced.
+ */
+struct sim
+{
+    page_directory_t directory;
+    page_table_t *tables;               /* Backs every page table, in host memory */
+    uintptr_t n_tables;                 /* How many of tables are in use */
+    phys_addr_t ram_size;
+    memmgr_physical_t phy;              /* Everything the directory maps or the kernel uses is marked */
+    uint32_t *bitmap;
+#ifdef MEMMGR_BUDDY
+    memmgr_buddy_t buddy;               /* Seeded with the frames phy says are free */
+    uint32_t *buddy_bitmaps;
+#endif
+    memmgr_frame_t *frames;             /* The frame allocator the kernel would use */
+};
+typedef struct sim sim_t;
+
+void sim_init(sim_t *sim, phys_addr_t ram_size);
+
+/* Gives back the host memory behind the machine */
+void sim_free(sim_t *sim);
+
+/* Maps the page at virt to phys, adding a page table for it if there isn't one */
+void sim_map(sim_t *sim, uintptr_t virt, phys_addr_t phys);
+
+/* Returns the pretend physical address of one of the machine's page tables */
+phys_addr_t sim_table_phys(sim_t *sim, page_table_t *table);
+#endif
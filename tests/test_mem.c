@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mem.h"
+#include "harness.h"
+
+/* Room for the biggest size, every offset, and guard bytes either side */
+#define BUFFER_SIZE (16384)
+#define GUARD (0xA5)
+
+typedef void *(mem_copy_t)(void *restrict dst, const void *restrict src, size_t n);
+typedef void *(mem_set_t)(void *dst, int c, size_t n);
+
+static const size_t sizes[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 12, 15, 16, 17, 31, 32, 33, 63, 64, 65, 255, 256, 257, 4095, 4096, 4099 };
+#define N_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint8_t src_buffer[BUFFER_SIZE];
+static uint8_t dst_buffer[BUFFER_SIZE];
+
+/*
+ * Internal Function Declarations
+ */
+static void fill(uint8_t *buffer, size_t n, uint8_t seed);
+static bool check_copy(mem_copy_t *copy);
+static bool check_set(mem_set_t *set);
+static bool check_move(size_t n, size_t from, size_t to);
+
+
+/* A pattern with no repeats shorter than 251 bytes, so a copy from the wrong place shows up */
+static void fill(uint8_t *buffer, size_t n, uint8_t seed)
+{
+    for (size_t ii = 0; ii < n; ii++)
+    {
+        buffer[ii] = (uint8_t)((ii + seed) % 251);
+    }
+}
+
+/* Copies every size between every pair of alignments, and checks nothing around the copy changed */
+static bool check_copy(mem_copy_t *copy)
+{
+    fill(src_buffer, BUFFER_SIZE, 1);
+
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        for (size_t src_offset = 0; src_offset < 4; src_offset++)
+        {
+            for (size_t dst_offset = 0; dst_offset < 4; dst_offset++)
+            {
+                size_t n = sizes[ii];
+                for (size_t jj = 0; jj < BUFFER_SIZE; jj++)
+                {
+                    dst_buffer[jj] = GUARD;
+                }
+
+                uint8_t *dst = dst_buffer + 16 + dst_offset;
+                const uint8_t *src = src_buffer + 16 + src_offset;
+                if (copy(dst, src, n) != dst)
+                {
+                    return false;
+                }
+
+                for (size_t jj = 0; jj < BUFFER_SIZE; jj++)
+                {
+                    bool inside = &dst_buffer[jj] >= dst && &dst_buffer[jj] < dst + n;
+                    if (dst_buffer[jj] != (inside ? src[&dst_buffer[jj] - dst] : GUARD))
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/* Sets every size at every alignment, with a value that only uses its low byte */
+static bool check_set(mem_set_t *set)
+{
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        for (size_t offset = 0; offset < 4; offset++)
+        {
+            size_t n = sizes[ii];
+            for (size_t jj = 0; jj < BUFFER_SIZE; jj++)
+            {
+                dst_buffer[jj] = GUARD;
+            }
+
+            uint8_t *dst = dst_buffer + 16 + offset;
+            if (set(dst, 0x1234, n) != dst)
+            {
+                return false;
+            }
+
+            for (size_t jj = 0; jj < BUFFER_SIZE; jj++)
+            {
+                bool inside = &dst_buffer[jj] >= dst && &dst_buffer[jj] < dst + n;
+                if (dst_buffer[jj] != (inside ? 0x34 : GUARD))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/* Moves n bytes from offset from to offset to of the same buffer, and compares with a copy through another one */
+static bool check_move(size_t n, size_t from, size_t to)
+{
+    fill(dst_buffer, BUFFER_SIZE, 3);
+    for (size_t ii = 0; ii < BUFFER_SIZE; ii++)
+    {
+        src_buffer[ii] = dst_buffer[ii];
+    }
+    for (size_t ii = 0; ii < n; ii++)
+    {
+        src_buffer[to + ii] = dst_buffer[from + ii];                /* What the result should be */
+    }
+
+    if (mem_move(dst_buffer + to, dst_buffer + from, n) != dst_buffer + to)
+    {
+        return false;
+    }
+    return mem_compare(dst_buffer, src_buffer, BUFFER_SIZE) == 0;
+}
+
+static void test_copy(void)
+{
+    TEST_ASSERT(check_copy(&mem_copy_movsd));
+    TEST_ASSERT(check_copy(&mem_copy_movsb));
+}
+
+static void test_set(void)
+{
+    TEST_ASSERT(check_set(&mem_set_stosd));
+    TEST_ASSERT(check_set(&mem_set_stosb));
+}
+
+static void test_move(void)
+{
+    for (size_t ii = 0; ii < N_SIZES; ii++)
+    {
+        size_t n = sizes[ii];
+        TEST_ASSERT(check_move(n, 100, 101));                       /* Forwards onto itself, copied backwards */
+        TEST_ASSERT(check_move(n, 101, 100));                       /* Backwards onto itself, copied forwards */
+        TEST_ASSERT(check_move(n, 100, 100 + n / 2 + 3));
+        TEST_ASSERT(check_move(n, 100 + n / 2 + 3, 100));
+        TEST_ASSERT(check_move(n, 0, n + 8));                       /* Apart */
+        TEST_ASSERT(check_move(n, 64, 64));
+    }
+}
+
+static void test_compare(void)
+{
+    fill(src_buffer, 64, 5);
+    fill(dst_buffer, 64, 5);
+    TEST_ASSERT_EQ(mem_compare(src_buffer, dst_buffer, 64), 0);
+    TEST_ASSERT_EQ(mem_compare(src_buffer, dst_buffer, 0), 0);
+
+    /* The first byte that differs decides, not the value of the word it is in */
+    dst_buffer[41] = 0xFF;
+    dst_buffer[42] = 0x00;
+    TEST_ASSERT(mem_compare(src_buffer, dst_buffer, 64) < 0);
+    TEST_ASSERT(mem_compare(dst_buffer, src_buffer, 64) > 0);
+    TEST_ASSERT_EQ(mem_compare(src_buffer, dst_buffer, 41), 0);
+    TEST_ASSERT(mem_compare(src_buffer + 1, dst_buffer + 1, 41) < 0);  /* Unaligned */
+
+    dst_buffer[41] = src_buffer[41];
+    TEST_ASSERT(mem_compare(src_buffer, dst_buffer, 64) > 0);       /* Bytes compare unsigned */
+}
+
+const test_case_t mem_tests[] =
+{
+    { "mem: copy every size and alignment", test_copy },
+    { "mem: set every size and alignment", test_set },
+    { "mem: move overlapping both ways", test_move },
+    { "mem: compare by the first different byte", test_compare },
+    { 0, 0 }
+};
@@ -0,0 +1,185 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdalign.h>
+#include "util.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "memmgr_frame.h"
+#include "memmgr_frame_cache.h"
+#include "memmgr_dumb.h"
+#include "memmgr_vma.h"
+#include "sim.h"
+#include "harness.h"
+
+/* Free pages the dumb allocator has in the simulated machine's kernel tables */
+#define DUMB_FREE_PAGES (SIM_KERNEL_TABLES * PAGES_PER_TABLE - ((uintptr_t)&_end_pa - (uintptr_t)&_start_pa) / PAGE_SIZE)
+
+static void test_alloc_bumps_frames(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+
+    /* Before the frame allocator is ready, frames come from just after the kernel */
+    uintptr_t first = (uintptr_t)dumb_alloc(&dumb, 2 * PAGE_SIZE);
+    TEST_ASSERT_EQ(first, (uintptr_t)&KERNEL_BASE);             /* The kernel image starts a megabyte in */
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)first), (uintptr_t)&_end_pa);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)(first + PAGE_SIZE)), (uintptr_t)&_end_pa + PAGE_SIZE);
+    TEST_ASSERT_EQ(dumb.allocated_frames, 2);
+
+    uintptr_t second = (uintptr_t)dumb_alloc(&dumb, 1);         /* Rounded up to a page */
+    TEST_ASSERT_EQ(second, first + 2 * PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)second), (uintptr_t)&_end_pa + 2 * PAGE_SIZE);
+    sim_free(&sim);
+}
+
+/* Pretends the bootloader left something in the second and third frames after the kernel */
+static bool frame_used_after_kernel(phys_addr_t frame_addr)
+{
+    phys_addr_t end = (uintptr_t)&_end_pa;
+    return frame_addr >= end + PAGE_SIZE && frame_addr < end + 3 * PAGE_SIZE;
+}
+
+static void test_alloc_skips_used_frames(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+    dumb_set_frame_used(&dumb, &frame_used_after_kernel);
+
+    uintptr_t addr = (uintptr_t)dumb_alloc(&dumb, 2 * PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)addr), (uintptr_t)&_end_pa);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)(addr + PAGE_SIZE)), (uintptr_t)&_end_pa + 3 * PAGE_SIZE);
+    TEST_ASSERT_EQ(dumb.allocated_frames, 2);
+    sim_free(&sim);
+}
+
+static void test_alloc_aligned(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+
+    uintptr_t first = (uintptr_t)dumb_alloc(&dumb, PAGE_SIZE);
+    uintptr_t aligned = (uintptr_t)dumb_alloc_aligned(&dumb, PAGE_SIZE, 16 * PAGE_SIZE);
+    TEST_ASSERT_EQ(aligned % (16 * PAGE_SIZE), 0);
+    TEST_ASSERT(aligned > first);
+    TEST_ASSERT_EQ(dumb.allocated_frames, 2);                   /* The gap isn't backed */
+    sim_free(&sim);
+}
+
+static void test_alloc_skips_mapped_pages(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+
+    /* The kernel image is in the way of anything that doesn't fit below it */
+    uintptr_t below = (uintptr_t)&_start_pa / PAGE_SIZE;
+    uintptr_t addr = (uintptr_t)dumb_alloc(&dumb, (below + 1) * PAGE_SIZE);
+    TEST_ASSERT_EQ(addr, (uintptr_t)&KERNEL_BASE + (uintptr_t)&_end_pa);
+
+    TEST_ASSERT(dumb_alloc(&dumb, DUMB_FREE_PAGES * PAGE_SIZE) == 0);  /* More than is left */
+    sim_free(&sim);
+}
+
+static void test_free_reuses_hole(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    alignas(CACHE_LINE_SIZE) static memmgr_frame_cache_t cache;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+    memmgr_frame_cache_init(&cache, sim.frames, 8);
+    dumb_set_frames(&dumb, &cache);
+
+    uintptr_t addr = (uintptr_t)dumb_alloc(&dumb, 3 * PAGE_SIZE);
+    TEST_ASSERT(addr != 0);
+    phys_addr_t middle = memmgr_virtual_virt_to_phy(&sim.directory, (void*)(addr + PAGE_SIZE));
+    TEST_ASSERT(middle >= (uintptr_t)&_end_pa);
+
+    dumb_free(&dumb, (void*)(addr + PAGE_SIZE), PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)(addr + PAGE_SIZE)), (phys_addr_t)~0);
+    TEST_ASSERT_EQ(host_cpu.invlpgs, 1);
+    TEST_ASSERT_EQ(dumb.allocated_frames, 2);
+
+    /* The hole is found first, and the frame comes straight back out of the cache */
+    TEST_ASSERT_EQ((uintptr_t)dumb_alloc(&dumb, PAGE_SIZE), addr + PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)(addr + PAGE_SIZE)), middle);
+    sim_free(&sim);
+}
+
+/* A frame some other allocator held on to, such as the zero pool */
+static phys_addr_t held_frame = MEMMGR_PHYSICAL_NONE;
+
+static phys_addr_t reclaim_held(void)
+{
+    phys_addr_t frame_addr = held_frame;
+    held_frame = MEMMGR_PHYSICAL_NONE;
+    return frame_addr;
+}
+
+static void test_alloc_reclaims_frames(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    alignas(CACHE_LINE_SIZE) static memmgr_frame_cache_t cache;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+    memmgr_frame_cache_init(&cache, sim.frames, 8);
+    memmgr_frame_cache_set_reclaim(&cache, &reclaim_held);
+    dumb_set_frames(&dumb, &cache);
+
+    held_frame = memmgr_frame_cache_alloc_free(&cache);
+    TEST_ASSERT(held_frame != MEMMGR_PHYSICAL_NONE);
+    while (memmgr_frame_cache_alloc_free(&cache) != MEMMGR_PHYSICAL_NONE)
+    {
+        /* Use up every free frame */
+    }
+    phys_addr_t expected = held_frame;
+
+    /* Out of free frames, so the held one is taken back, and then there are none */
+    uintptr_t addr = (uintptr_t)dumb_alloc(&dumb, PAGE_SIZE);
+    TEST_ASSERT(addr != 0);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(&sim.directory, (void*)addr), expected);
+    TEST_ASSERT_EQ(held_frame, MEMMGR_PHYSICAL_NONE);
+    TEST_ASSERT_EQ((uintptr_t)dumb_alloc(&dumb, PAGE_SIZE), 0);
+    sim_free(&sim);
+}
+
+static void test_alloc_stays_below_areas(void)
+{
+    sim_t sim;
+    memmgr_dumb_t dumb;
+    sim_init(&sim, 64 * 1024 * 1024);
+    dumb_init(&dumb, &sim.directory);
+
+    /* A page table vma_reserve made ahead of time, for an area with one page filled in so far */
+    sim_map(&sim, VMA_KERNEL_START, 0x1000);
+
+    uintptr_t n_allocs = 0;
+    for (uintptr_t addr; (addr = (uintptr_t)dumb_alloc(&dumb, PAGE_SIZE)) != 0; n_allocs++)
+    {
+        TEST_ASSERT(addr < DUMB_END);
+    }
+    TEST_ASSERT_EQ(n_allocs, DUMB_FREE_PAGES);                  /* Every page of its own tables, and none of the area's */
+    sim_free(&sim);
+}
+
+const test_case_t memmgr_dumb_tests[] =
+{
+    { "memmgr_dumb: early frames come from after the kernel", test_alloc_bumps_frames },
+    { "memmgr_dumb: early frames skip the ones in use", test_alloc_skips_used_frames },
+    { "memmgr_dumb: aligned allocations", test_alloc_aligned },
+    { "memmgr_dumb: allocations go around mapped pages", test_alloc_skips_mapped_pages },
+    { "memmgr_dumb: freed pages and frames are reused", test_free_reuses_hole },
+    { "memmgr_dumb: never hands out pages in memory areas", test_alloc_stays_below_areas },
+    { "memmgr_dumb: takes back held frames once none are free", test_alloc_reclaims_frames },
+    { 0, 0 }
+};
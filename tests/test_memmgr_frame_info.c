@@ -0,0 +1,36 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "util.h"
+#include "memmgr_physical.h"
+#include "memmgr_virtual.h"
+#include "memmgr_frame_info.h"
+#include "harness.h"
+
+static void test_lookup(void)
+{
+    uintptr_t n_frames = 1024;
+    memmgr_frame_info_t *infos = malloc(memmgr_frame_info_size(n_frames));
+    memmgr_frame_info_init(infos, n_frames);
+
+    TEST_ASSERT(memmgr_frame_info(0) == &infos[0]);
+    TEST_ASSERT(memmgr_frame_info(5 * PAGE_SIZE + 0x123) == &infos[5]);     /* Any address in the frame */
+    TEST_ASSERT(memmgr_frame_info((n_frames - 1) * PAGE_SIZE) == &infos[n_frames - 1]);
+    TEST_ASSERT(memmgr_frame_info(n_frames * PAGE_SIZE) == 0);              /* Past the end */
+
+    memmgr_frame_info_t *info = memmgr_frame_info(7 * PAGE_SIZE);
+    TEST_ASSERT_EQ(info->shares, 0);
+    TEST_ASSERT_EQ(info->flags, 0);
+    TEST_ASSERT(info->owner == 0);
+    TEST_ASSERT_EQ(info->lru_prev, MEMMGR_FRAME_NONE);
+    TEST_ASSERT_EQ(info->lru_next, MEMMGR_FRAME_NONE);
+
+    memmgr_frame_info_init(0, 0);
+    free(infos);
+}
+
+const test_case_t memmgr_frame_info_tests[] =
+{
+    { "memmgr_frame_info: descriptors by address", test_lookup },
+    { 0, 0 }
+};
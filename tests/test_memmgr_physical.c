@@ -0,0 +1,160 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "harness.h"
+
+/* A frame bitmap covering n_frames frames, all of them free */
+static memmgr_physical_t make_bitmap(uintptr_t n_frames)
+{
+    memmgr_physical_t phy;
+    memmgr_physical_init(&phy, (phys_addr_t)n_frames * PAGE_SIZE);
+    memmgr_physical_set_frames(&phy, malloc(memmgr_physical_size(&phy)));
+    return phy;
+}
+
+/* Counts the frames that are in use */
+static uintptr_t count_used(memmgr_physical_t *phy)
+{
+    uintptr_t used = 0;
+    for (uintptr_t ii = 0; ii < phy->n_frames; ii++)
+    {
+        used += memmgr_physical_test(phy, (phys_addr_t)ii * PAGE_SIZE);
+    }
+    return used;
+}
+
+static void test_init_levels(void)
+{
+    memmgr_physical_t phy;
+
+    memmgr_physical_init(&phy, 128 * 1024 * 1024);              /* 32768 frames: 1024 words, then 32, then 1 */
+    TEST_ASSERT_EQ(phy.n_frames, 32768);
+    TEST_ASSERT_EQ(phy.n_levels, 3);
+    TEST_ASSERT_EQ(phy.n_words[0], 1024);
+    TEST_ASSERT_EQ(phy.n_words[1], 32);
+    TEST_ASSERT_EQ(phy.n_words[2], 1);
+    TEST_ASSERT_EQ(memmgr_physical_size(&phy), (1024 + 32 + 1) * 4);
+
+    memmgr_physical_init(&phy, PAGE_SIZE + 1);                  /* A partial frame counts */
+    TEST_ASSERT_EQ(phy.n_frames, 2);
+    TEST_ASSERT_EQ(phy.n_levels, 1);
+}
+
+static void test_set_clear_range(void)
+{
+    memmgr_physical_t phy = make_bitmap(200);
+
+    memmgr_physical_set_range(&phy, 30 * PAGE_SIZE, 70);        /* Crosses two word boundaries */
+    TEST_ASSERT(!memmgr_physical_test(&phy, 29 * PAGE_SIZE));
+    TEST_ASSERT(memmgr_physical_test(&phy, 30 * PAGE_SIZE));
+    TEST_ASSERT(memmgr_physical_test(&phy, 64 * PAGE_SIZE));
+    TEST_ASSERT(memmgr_physical_test(&phy, 99 * PAGE_SIZE));
+    TEST_ASSERT(!memmgr_physical_test(&phy, 100 * PAGE_SIZE));
+    TEST_ASSERT_EQ(count_used(&phy), 70);
+
+    memmgr_physical_clear_range(&phy, 40 * PAGE_SIZE, 10);
+    TEST_ASSERT(memmgr_physical_test(&phy, 39 * PAGE_SIZE));
+    TEST_ASSERT(!memmgr_physical_test(&phy, 40 * PAGE_SIZE));
+    TEST_ASSERT(!memmgr_physical_test(&phy, 49 * PAGE_SIZE));
+    TEST_ASSERT(memmgr_physical_test(&phy, 50 * PAGE_SIZE));
+    TEST_ASSERT_EQ(count_used(&phy), 60);
+
+    memmgr_physical_set_range(&phy, 190 * PAGE_SIZE, 1000);     /* Cut off at the end */
+    memmgr_physical_set_range(&phy, 5000 * PAGE_SIZE, 1);       /* Ignored */
+    TEST_ASSERT_EQ(count_used(&phy), 70);
+    TEST_ASSERT(memmgr_physical_test(&phy, 200 * PAGE_SIZE));   /* Past the end counts as used */
+}
+
+static void test_summary_levels(void)
+{
+    memmgr_physical_t phy = make_bitmap(32 * 32 * 4);
+
+    memmgr_physical_set_range(&phy, 0, 32 * 32);                /* Fills a whole top level bit */
+    TEST_ASSERT_EQ(phy.levels[1][0], 0xFFFFFFFFu);
+    TEST_ASSERT_EQ(phy.levels[2][0] & 1, 1);
+
+    memmgr_physical_clear_range(&phy, 500 * PAGE_SIZE, 1);      /* One hole clears the summary bits above it */
+    TEST_ASSERT_EQ(phy.levels[2][0] & 1, 0);
+    TEST_ASSERT_EQ(phy.levels[1][0], ~(1u << (500 / 32)));
+
+    memmgr_physical_set_range(&phy, 500 * PAGE_SIZE, 1);
+    TEST_ASSERT_EQ(phy.levels[2][0] & 1, 1);
+}
+
+static void test_tail_frames_never_free(void)
+{
+    memmgr_physical_t phy = make_bitmap(33);                    /* The rest of the second word doesn't exist */
+
+    for (uintptr_t ii = 0; ii < 33; ii++)
+    {
+        TEST_ASSERT(memmgr_physical_alloc(&phy, 1, PAGE_SIZE) != MEMMGR_PHYSICAL_NONE);
+    }
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), MEMMGR_PHYSICAL_NONE);
+}
+
+static void test_alloc_next_fit(void)
+{
+    memmgr_physical_t phy = make_bitmap(64);
+
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), 0);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), 1 * PAGE_SIZE);
+    memmgr_physical_free(&phy, 0, 1);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), 2 * PAGE_SIZE);  /* Carries on from the last one */
+
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 61, PAGE_SIZE), 3 * PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), 0);              /* Then wraps around to the hole */
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), MEMMGR_PHYSICAL_NONE);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 0, PAGE_SIZE), MEMMGR_PHYSICAL_NONE);
+}
+
+static void test_alloc_run_first_fit(void)
+{
+    memmgr_physical_t phy = make_bitmap(256);
+
+    memmgr_physical_set_range(&phy, 3 * PAGE_SIZE, 1);
+    memmgr_physical_set_range(&phy, 10 * PAGE_SIZE, 1);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 5, PAGE_SIZE), 4 * PAGE_SIZE);  /* 0-2 is too small */
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 2, PAGE_SIZE), 11 * PAGE_SIZE); /* 9 is too small */
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 16, 16 * PAGE_SIZE), 16 * PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, 64 * PAGE_SIZE), 64 * PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 200, PAGE_SIZE), MEMMGR_PHYSICAL_NONE);
+}
+
+static void test_alloc_finds_last_frame(void)
+{
+    memmgr_physical_t phy = make_bitmap(32 * 32 * 32 * 2);      /* Four levels */
+
+    memmgr_physical_set_range(&phy, 0, phy.n_frames - 1);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), (phys_addr_t)(phy.n_frames - 1) * PAGE_SIZE);
+    TEST_ASSERT_EQ(memmgr_physical_alloc(&phy, 1, PAGE_SIZE), MEMMGR_PHYSICAL_NONE);
+}
+
+static void test_free_run(void)
+{
+    memmgr_physical_t phy = make_bitmap(128);
+    uintptr_t run = 0;
+
+    memmgr_physical_set_range(&phy, 0, 128);
+    memmgr_physical_clear_range(&phy, 40 * PAGE_SIZE, 30);
+    TEST_ASSERT_EQ(memmgr_physical_free_run(&phy, 0, 128, &run), 40 * PAGE_SIZE);
+    TEST_ASSERT_EQ(run, 30);
+    TEST_ASSERT_EQ(memmgr_physical_free_run(&phy, 50 * PAGE_SIZE, 10, &run), 50 * PAGE_SIZE);
+    TEST_ASSERT_EQ(run, 10);                                    /* Cut off at the end of the range */
+    TEST_ASSERT_EQ(memmgr_physical_free_run(&phy, 0, 40, &run), MEMMGR_PHYSICAL_NONE);
+    TEST_ASSERT_EQ(memmgr_physical_free_run(&phy, 128 * PAGE_SIZE, 1, &run), MEMMGR_PHYSICAL_NONE);
+}
+
+const test_case_t memmgr_physical_tests[] =
+{
+    { "memmgr_physical: init sizes the summary levels", test_init_levels },
+    { "memmgr_physical: set and clear ranges", test_set_clear_range },
+    { "memmgr_physical: summary bits follow full words", test_summary_levels },
+    { "memmgr_physical: frames past the end are never free", test_tail_frames_never_free },
+    { "memmgr_physical: alloc resumes after the last one", test_alloc_next_fit },
+    { "memmgr_physical: alloc finds the first aligned run", test_alloc_run_first_fit },
+    { "memmgr_physical: alloc finds the last free frame", test_alloc_finds_last_frame },
+    { "memmgr_physical: free_run", test_free_run },
+    { 0, 0 }
+};
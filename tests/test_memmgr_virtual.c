@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "util.h"
+#include "memmgr_virtual.h"
+#include "memmgr_physical.h"
+#include "sim.h"
+#include "harness.h"
+
+/* Somewhere in the kernel half with nothing mapped */
+#define TEST_VIRT (0xC8000000u)
+
+/* Counts what page_directory_walk visits, and stops or skips where it is told to */
+struct walk_count
+{
+    uintptr_t tables;
+    uintptr_t pages;
+    uintptr_t stop_after;               /* Pages to visit before stopping, 0 to visit them all */
+    uintptr_t skip_dir;                 /* Directory entry whose pages aren't visited */
+};
+
+static int count_table_cb(void *data, uintptr_t dir_offset, page_table_t *table)
+{
+    struct walk_count *count = data;
+    UNUSED(table);
+    count->tables++;
+    return (dir_offset == count->skip_dir) ? PG_DIR_WALK_SKIP : PG_DIR_WALK_CONTINUE;
+}
+
+static int count_page_cb(void *data, uintptr_t dir_offset, uintptr_t page_offset, page_t *page)
+{
+    struct walk_count *count = data;
+    UNUSED(dir_offset);
+    UNUSED(page_offset);
+    UNUSED(page);
+    count->pages++;
+    return (count->pages == count->stop_after) ? PG_DIR_WALK_STOP : PG_DIR_WALK_CONTINUE;
+}
+
+static void test_virt_to_phy(void)
+{
+    sim_t sim;
+    sim_init(&sim, 64 * 1024 * 1024);
+    page_directory_t *dir = &sim.directory;
+
+    uintptr_t kernel = (uintptr_t)&KERNEL_BASE + (uintptr_t)&_start_pa;
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)(kernel + 0x123)), (uintptr_t)&_start_pa + 0x123);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)0xB8000), 0xB8000);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)(uintptr_t)&KERNEL_BASE), (phys_addr_t)~0);   /* Present table, no page */
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)TEST_VIRT), (phys_addr_t)~0);                 /* No table */
+
+    sim_map(&sim, TEST_VIRT, 0x3000000);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)(TEST_VIRT + 0xFFF)), 0x3000FFF);
+    sim_free(&sim);
+}
+
+static void test_large_page(void)
+{
+    sim_t sim;
+    sim_init(&sim, 64 * 1024 * 1024);
+    page_directory_t *dir = &sim.directory;
+
+    uintptr_t entry = TEST_VIRT / TABLE_SPAN;                   /* A large page maps what a table would */
+    dir->tablesPhysical[entry] = 2 * LARGE_PAGE_SIZE | PDE_PRESENT | PDE_WRITABLE | PDE_LARGE;
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)(TEST_VIRT + 0x12345)), 2 * LARGE_PAGE_SIZE + 0x12345);
+    TEST_ASSERT(get_page(TEST_VIRT, 1, dir) == 0);              /* There is no page_t for it */
+
+    struct walk_count count = { 0, 0, 0, ~0u };
+    page_directory_walk(dir, 0, count_page_cb, &count);
+    struct walk_count without = { 0, 0, 0, entry };
+    page_directory_walk(dir, count_table_cb, count_page_cb, &without);
+    TEST_ASSERT_EQ(count.pages - without.pages, PAGES_PER_TABLE);  /* Walked as a table's worth of pages */
+    sim_free(&sim);
+}
+
+static void test_phy_to_virt(void)
+{
+    sim_t sim;
+    sim_init(&sim, 64 * 1024 * 1024);
+    page_directory_t *dir = &sim.directory;
+
+    TEST_ASSERT(memmgr_virtual_phy_to_virt(dir, 0x1234) == (void*)(DIRECT_MAP_BASE + 0x1234));
+    TEST_ASSERT(memmgr_virtual_phy_to_virt(dir, DIRECT_MAP_SIZE) == (void*)~0);    /* No reverse map yet */
+
+    uint32_t *rmap = calloc(16, sizeof(uint32_t));
+    memmgr_virtual_set_rmap(dir, rmap, 16);
+    sim_map(&sim, TEST_VIRT, DIRECT_MAP_SIZE + 3 * PAGE_SIZE);
+    memmgr_virtual_rmap_add(dir, DIRECT_MAP_SIZE + 3 * PAGE_SIZE, (void*)TEST_VIRT);
+    TEST_ASSERT(memmgr_virtual_phy_to_virt(dir, DIRECT_MAP_SIZE + 3 * PAGE_SIZE + 0x10) == (void*)(TEST_VIRT + 0x10));
+    TEST_ASSERT(memmgr_virtual_phy_to_virt(dir, DIRECT_MAP_SIZE + 4 * PAGE_SIZE) == (void*)~0);
+    TEST_ASSERT(memmgr_virtual_phy_to_virt(dir, DIRECT_MAP_SIZE + 16 * PAGE_SIZE) == (void*)~0); /* Past the reverse map */
+
+    memmgr_virtual_unmap(dir, (void*)TEST_VIRT);                /* Unmapping forgets it */
+    TEST_ASSERT(memmgr_virtual_phy_to_virt(dir, DIRECT_MAP_SIZE + 3 * PAGE_SIZE) == (void*)~0);
+    TEST_ASSERT_EQ(host_cpu.invlpgs, 1);
+    free(rmap);
+    sim_free(&sim);
+}
+
+static void test_unmap_range_gathers(void)
+{
+    sim_t sim;
+    sim_init(&sim, 64 * 1024 * 1024);
+    page_directory_t *dir = &sim.directory;
+    tlb_gather_t gather;
+
+    for (uintptr_t ii = 0; ii < 3; ii++)
+    {
+        sim_map(&sim, TEST_VIRT + ii * PAGE_SIZE, 0x2000000 + ii * PAGE_SIZE);
+    }
+    memmgr_virtual_gather_init(&gather);
+    memmgr_virtual_unmap_range(dir, (void*)(TEST_VIRT - PAGE_SIZE), 5, &gather);  /* Only 3 were present */
+    TEST_ASSERT_EQ(gather.end - gather.start, 3);
+    TEST_ASSERT(gather.global);
+    TEST_ASSERT_EQ(host_cpu.invlpgs, 0);                        /* Nothing is flushed until the commit */
+    memmgr_virtual_gather_commit(&gather);
+    TEST_ASSERT_EQ(host_cpu.invlpgs, 3);
+    TEST_ASSERT_EQ(memmgr_virtual_virt_to_phy(dir, (void*)TEST_VIRT), (phys_addr_t)~0);
+
+    memmgr_virtual_gather_commit(&gather);                      /* Committing an empty batch does nothing */
+    TEST_ASSERT_EQ(host_cpu.invlpgs, 3);
+
+    for (uintptr_t ii = 0; ii < TLB_FLUSH_CEILING + 1; ii++)
+    {
+        sim_map(&sim, TEST_VIRT + ii * PAGE_SIZE, 0x2000000 + ii * PAGE_SIZE);
+    }
+    memmgr_virtual_unmap_range(dir, (void*)TEST_VIRT, TLB_FLUSH_CEILING + 1, &gather);
+    memmgr_virtual_gather_commit(&gather);
+    TEST_ASSERT_EQ(host_cpu.invlpgs, 3);                        /* Too many, so one full flush instead */
+    TEST_ASSERT_EQ(host_cpu.tlb_flushes, 1);
+    sim_free(&sim);
+}
+
+static void test_walk(void)
+{
+    sim_t sim;
+    sim_init(&sim, 64 * 1024 * 1024);
+    page_directory_t *dir = &sim.directory;
+
+    uintptr_t kernel_pages = ((uintptr_t)&_end_pa - (uintptr_t)&_start_pa) / PAGE_SIZE;
+    uintptr_t low_pages = 0x100000 / PAGE_SIZE;
+
+    struct walk_count count = { 0, 0, 0, ~0u };
+    page_directory_walk(dir, count_table_cb, count_page_cb, &count);
+    TEST_ASSERT_EQ(count.tables, sim.n_tables);
+    TEST_ASSERT_EQ(count.pages, low_pages + kernel_pages);
+
+    struct walk_count stop = { 0, 0, 10, ~0u };
+    page_directory_walk(dir, count_table_cb, count_page_cb, &stop);
+    TEST_ASSERT_EQ(stop.pages, 10);
+    TEST_ASSERT_EQ(stop.tables, 1);
+
+    struct walk_count skip = { 0, 0, 0, 0 };                    /* Skip the identity mapped low memory */
+    page_directory_walk(dir, count_table_cb, count_page_cb, &skip);
+    TEST_ASSERT_EQ(skip.pages, kernel_pages);
+    sim_free(&sim);
+}
+
+static void test_set_from_page_directory(void)
+{
+    sim_t sim;
+    sim_init(&sim, 1024 * 1024 * 1024);
+
+    sim_map(&sim, TEST_VIRT, 0x30000000);                       /* Marked in use */
+    sim_map(&sim, DIRECT_MAP_BASE + 0x20000000 - PAGE_SIZE, 0x20000000 - PAGE_SIZE);  /* The direct map isn't */
+    memmgr_set_from_page_directory(&sim.phy, &sim.directory);
+
+    TEST_ASSERT(memmgr_physical_test(&sim.phy, 0x30000000));
+    TEST_ASSERT(!memmgr_physical_test(&sim.phy, 0x30000000 + PAGE_SIZE));
+    TEST_ASSERT(!memmgr_physical_test(&sim.phy, 0x20000000 - PAGE_SIZE));
+    TEST_ASSERT(memmgr_physical_test(&sim.phy, (uintptr_t)&_end_pa - PAGE_SIZE));
+    TEST_ASSERT(!memmgr_physical_test(&sim.phy, (uintptr_t)&_end_pa));
+    sim_free(&sim);
+}
+
+static void test_switch_page_directory(void)
+{
+    static page_directory_t first, second;
+    first.physicalAddr = 0x100000;
+    second.physicalAddr = 0x200000;
+
+    switch_page_directory(&first);
+    TEST_ASSERT_EQ(host_cpu.cr3, 0x100000);
+    TEST_ASSERT(memmgr_virtual_current() == &first);
+    switch_page_directory(&first);                              /* Already loaded, so the TLB is kept */
+    TEST_ASSERT_EQ(host_cpu.cr3_writes, 1);
+
+    host_cpu.id = 1;                                            /* Each cpu has its own */
+    switch_page_directory(&second);
+    TEST_ASSERT(memmgr_virtual_current() == &second);
+    TEST_ASSERT_EQ(host_cpu.cr3_writes, 2);
+    host_cpu.id = 0;
+    TEST_ASSERT(memmgr_virtual_current() == &first);
+}
+
+const test_case_t memmgr_virtual_tests[] =
+{
+    { "memmgr_virtual: virt_to_phy through page tables", test_virt_to_phy },
+    { "memmgr_virtual: large pages", test_large_page },
+    { "memmgr_virtual: phy_to_virt through the direct and reverse maps", test_phy_to_virt },
+    { "memmgr_virtual: unmap_range batches the TLB flush", test_unmap_range_gathers },
+    { "memmgr_virtual: page_directory_walk", test_walk },
+    { "memmgr_virtual: set_from_page_directory skips the direct map", test_set_from_page_directory },
+    { "memmgr_virtual: switch_page_directory keeps a loaded one", test_switch_page_directory },
+    { 0, 0 }
+};
@@ -0,0 +1,80 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#include "cpu.h"
+#include "kernel.h"
+#include "clock.h"
+#include "log.h"
+#include "trace.h"
+
+/* Width of the name column in trace_dump */
+#define TRACE_NAME_WIDTH (32)
+
+struct trace_mark
+{
+    const char *name;
+    uint64_t tsc;
+};
+typedef struct trace_mark trace_mark_t;
+
+static trace_mark_t marks[TRACE_MAX_MARKS];
+static uint32_t n_marks = 0;
+
+/* rdtsc faults on cpus without one, so nothing is marked there */
+static bool enabled = false;
+
+/*
+ * Internal Function Declarations
+ */
+static void add_mark(const char *name, uint64_t tsc);
+
+
+void trace_init(void)
+{
+    enabled = (cpu_features_edx() & CPUID_1_EDX_TSC) != 0;
+    if (!enabled)
+    {
+        return;
+    }
+
+    add_mark("bootstrap", _b_tsc_entry);                        /* Where the bootloader jumped to */
+    add_mark("bootstrap paging", _b_tsc_paging);                /* Page tables built and paging on */
+    trace_mark("kinit");                                        /* Higher half GDT and stack */
+}
+
+void trace_mark(const char *name)
+{
+    if (enabled)
+    {
+        add_mark(name, cpu_rdtsc());
+    }
+}
+
+void trace_dump(void)
+{
+    if (n_marks < 2)
+    {
+        return;
+    }
+
+    klog("%-*s%12s%12s", TRACE_NAME_WIDTH, "boot phase", "cycles", "us");
+    for (uint32_t ii = 1; ii <= n_marks; ii++)
+    {
+        /* One past the last phase is the total from the first mark */
+        bool total = (ii == n_marks);
+        uint64_t cycles = total ? marks[n_marks - 1].tsc - marks[0].tsc : marks[ii].tsc - marks[ii - 1].tsc;
+
+        klog("%-*s%12llu%12llu", TRACE_NAME_WIDTH, total ? "total" : marks[ii].name,
+             cycles, udiv64(clock_tsc_to_ns(cycles), NSEC_PER_USEC));
+    }
+}
+
+static void add_mark(const char *name, uint64_t tsc)
+{
+    if (n_marks < TRACE_MAX_MARKS)
+    {
+        marks[n_marks].name = name;
+        marks[n_marks].tsc = tsc;
+        n_marks++;
+    }
+}
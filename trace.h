@@ -0,0 +1,23 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_ 1
+
+#include <stdint.h>
+
+/* Most points boot can mark, any after that are dropped */
+#define TRACE_MAX_MARKS (32)
+
+/*
+ * Boot time tracing. trace_mark records the TSC under a name, and the
+ * time between one mark and the next is the phase named after the later
+ * one. Only the boot cpu marks, so there is no locking.
+ */
+
+/* Takes the marks bootstrap.s made before paging, it must run before unmap_bootstrap */
+void trace_init(void);
+
+/* Records the TSC at the end of the phase called name, which must stay around */
+void trace_mark(const char *name);
+
+/* Logs a line per phase, with cycles and microseconds, which needs clock_init to have run */
+void trace_dump(void);
+#endif
@@ -0,0 +1,96 @@
+global trampoline_start
+global trampoline_data
+global trampoline_end
+
+; The trampoline is copied here before the other cpus are started, it must
+; match TRAMPOLINE_BASE in smp.h. A startup IPI can only start a cpu on a
+; page boundary below 1MB, in real mode
+TRAMPOLINE_BASE equ 0x8000
+
+; Address of a label in the copy
+%define TRAMPOLINE(label) (TRAMPOLINE_BASE + ((label) - trampoline_start))
+
+CODE_SEGMENT equ 0x08
+DATA_SEGMENT equ 0x10
+
+MSR_EFER equ 0xC0000080
+
+;
+;   AP Trampoline
+;       Where the other cpus start. Switches to protected mode, turns on
+;       paging the same way the boot cpu has it, and calls into the kernel
+;       on the stack smp_init set up for it.
+;
+
+section .text
+
+bits 16
+
+trampoline_start:
+    cli
+    cld
+    xor     ax, ax                          ; CS is TRAMPOLINE_BASE >> 4, the data
+    mov     ds, ax                          ; segment starts from 0 instead
+
+    lgdt    [TRAMPOLINE(trampoline_gdtr)]   ; Load the flat GDT below
+
+    mov     eax, cr0
+    or      eax, 1                          ; Protected mode (CR0.PE)
+    mov     cr0, eax
+    jmp     dword CODE_SEGMENT:TRAMPOLINE(trampoline_32)
+
+bits 32
+
+trampoline_32:
+    mov     ax, DATA_SEGMENT
+    mov     ds, ax
+    mov     es, ax
+    mov     fs, ax
+    mov     gs, ax
+    mov     ss, ax
+
+    ; PAE, large and global pages have to be on before paging is
+    mov     eax, [TRAMPOLINE(trampoline_data.cr4)]
+    mov     cr4, eax
+
+    mov     eax, [TRAMPOLINE(trampoline_data.efer)]
+    test    eax, eax                        ; Only touch EFER if NX is in use
+    jz      .Paging
+    mov     ecx, MSR_EFER
+    mov     ebx, eax
+    rdmsr
+    or      eax, ebx
+    wrmsr
+
+    .Paging:
+    mov     eax, [TRAMPOLINE(trampoline_data.cr3)]
+    mov     cr3, eax
+    mov     eax, [TRAMPOLINE(trampoline_data.cr0)]
+    mov     cr0, eax                        ; The trampoline is identity mapped, so it carries on
+
+    mov     esp, [TRAMPOLINE(trampoline_data.stack)]
+    call    [TRAMPOLINE(trampoline_data.entry)]
+
+    .Halt:                                  ; The entry point never returns
+    hlt
+    jmp     .Halt
+
+align 8
+trampoline_gdt:
+    dd      0x00000000, 0x00000000          ; Null entry
+    dd      0x0000FFFF, 0x00CF9A00          ; Code segment
+    dd      0x0000FFFF, 0x00CF9200          ; Data segment
+trampoline_gdtr:
+    dw      trampoline_gdtr - trampoline_gdt - 1
+    dd      TRAMPOLINE(trampoline_gdt)
+
+align 4
+trampoline_data:                            ; Filled in by smp_init, struct trampoline_data in smp.c
+    .cr0:   dd 0
+    .cr3:   dd 0
+    .cr4:   dd 0
+    .efer:  dd 0                            ; EFER bits to set, or 0
+    .stack: dd 0
+    .entry: dd 0
+
+trampoline_end:
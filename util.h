@@ -8,6 +8,24 @@ static inline uintptr_t idivc(uintptr_t x, uintptr_t y)
     return (x ? (((x-1)/y) + 1) : 0);
 }
 
+/* Divides a 64 bit number by a 32 bit one, without needing libgcc's __udivdi3 */
+static inline uint64_t udiv64(uint64_t x, uint32_t y)
+{
+    uint32_t high = (uint32_t)(x >> 32);
+    uint32_t quotient_high = high / y;
+    uint32_t remainder = high % y;                  /* Less than y, so the second div can't overflow */
+    uint32_t quotient_low;
+    __asm__ ("div %2" : "=a" (quotient_low), "=d" (remainder) : "rm" (y), "a" ((uint32_t)x), "d" (remainder));
+    return ((uint64_t)quotient_high << 32) | quotient_low;
+}
+
+/* Returns (x * mult) >> shift without overflowing, for shift up to 32 */
+static inline uint64_t umul_shift64(uint64_t x, uint32_t mult, uint32_t shift)
+{
+    uint64_t low = ((uint64_t)(uint32_t)x * mult) >> shift;
+    uint64_t high = (uint64_t)(uint32_t)(x >> 32) * mult;
+    return low + ((shift == 32) ? high : high << (32 - shift));
+}
 
 /* Mark a variable as unused */
 #define UNUSED(x) ((void)(x))